@@ -0,0 +1,666 @@
+#include "encoding.h"
+#include "../utils/cpu_features.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+namespace
+{
+	constexpr char32_t kReplacement = 0xFFFD;
+
+	template <typename CharT>
+	inline CharT* PutCodePoint(CharT* out, char32_t cp)
+	{
+		if constexpr (sizeof(CharT) == 2) {
+			if (cp >= 0x10000) {
+				cp -= 0x10000;
+				*out++ = static_cast<CharT>(0xD800 + (cp >> 10));
+				*out++ = static_cast<CharT>(0xDC00 + (cp & 0x3FF));
+				return out;
+			}
+		}
+		*out++ = static_cast<CharT>(cp);
+		return out;
+	}
+
+	inline char* PutUtf8(char* out, char32_t cp)
+	{
+		if (cp < 0x80) {
+			*out++ = static_cast<char>(cp);
+		}
+		else if (cp < 0x800) {
+			*out++ = static_cast<char>(0xC0 | (cp >> 6));
+			*out++ = static_cast<char>(0x80 | (cp & 0x3F));
+		}
+		else if (cp < 0x10000) {
+			*out++ = static_cast<char>(0xE0 | (cp >> 12));
+			*out++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+			*out++ = static_cast<char>(0x80 | (cp & 0x3F));
+		}
+		else {
+			*out++ = static_cast<char>(0xF0 | (cp >> 18));
+			*out++ = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+			*out++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+			*out++ = static_cast<char>(0x80 | (cp & 0x3F));
+		}
+		return out;
+	}
+
+	// Decodes the sequence whose non-ASCII lead byte is at in[i] and advances i past it.
+	// An ill-formed sequence consumes its maximal valid prefix, yields U+FFFD and returns false.
+	inline bool DecodeSequence(const unsigned char* in, size_t length, size_t& i, char32_t& cp)
+	{
+		const unsigned char lead = in[i++];
+		size_t need = 0;
+		unsigned char lo = 0x80;
+		unsigned char hi = 0xBF;
+
+		if (lead >= 0xC2 && lead <= 0xDF) {
+			need = 1;
+			cp = lead & 0x1F;
+		}
+		else if (lead >= 0xE0 && lead <= 0xEF) {
+			need = 2;
+			cp = lead & 0x0F;
+			if (lead == 0xE0) lo = 0xA0;       // overlong
+			else if (lead == 0xED) hi = 0x9F;  // surrogates
+		}
+		else if (lead >= 0xF0 && lead <= 0xF4) {
+			need = 3;
+			cp = lead & 0x07;
+			if (lead == 0xF0) lo = 0x90;       // overlong
+			else if (lead == 0xF4) hi = 0x8F;  // above U+10FFFF
+		}
+		else {
+			cp = kReplacement;
+			return false;
+		}
+
+		for (size_t k = 0; k < need; ++k) {
+			if (i >= length || in[i] < lo || in[i] > hi) {
+				cp = kReplacement;
+				return false;
+			}
+			cp = (cp << 6) | (in[i] & 0x3F);
+			++i;
+			lo = 0x80;
+			hi = 0xBF;
+		}
+		return true;
+	}
+
+#if defined(UTILITIES_SSE2)
+	// Widens leading 16-byte ASCII blocks, returns the number of bytes consumed
+	template <typename CharT>
+	size_t WidenAsciiSse2(const unsigned char* in, size_t length, CharT* out)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		size_t i = 0;
+		for (; i + 16 <= length; i += 16) {
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+			if (_mm_movemask_epi8(v) != 0) {
+				break;
+			}
+
+			const __m128i lo = _mm_unpacklo_epi8(v, zero);
+			const __m128i hi = _mm_unpackhi_epi8(v, zero);
+			auto* dst = reinterpret_cast<__m128i*>(out + i);
+			if constexpr (sizeof(CharT) == 2) {
+				_mm_storeu_si128(dst, lo);
+				_mm_storeu_si128(dst + 1, hi);
+			}
+			else {
+				_mm_storeu_si128(dst, _mm_unpacklo_epi16(lo, zero));
+				_mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(lo, zero));
+				_mm_storeu_si128(dst + 2, _mm_unpacklo_epi16(hi, zero));
+				_mm_storeu_si128(dst + 3, _mm_unpackhi_epi16(hi, zero));
+			}
+		}
+		return i;
+	}
+
+	// Narrows leading 16-unit ASCII blocks, returns the number of units consumed
+	template <typename CharT>
+	size_t NarrowAsciiSse2(const CharT* in, size_t length, char* out)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		size_t i = 0;
+		for (; i + 16 <= length; i += 16) {
+			const auto* src = reinterpret_cast<const __m128i*>(in + i);
+			__m128i packed;
+			if constexpr (sizeof(CharT) == 2) {
+				const __m128i a = _mm_loadu_si128(src);
+				const __m128i b = _mm_loadu_si128(src + 1);
+				const __m128i high = _mm_and_si128(_mm_or_si128(a, b), _mm_set1_epi16(static_cast<short>(0xFF80)));
+				if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, zero)) != 0xFFFF) {
+					break;
+				}
+				packed = _mm_packus_epi16(a, b);
+			}
+			else {
+				const __m128i a = _mm_loadu_si128(src);
+				const __m128i b = _mm_loadu_si128(src + 1);
+				const __m128i c = _mm_loadu_si128(src + 2);
+				const __m128i d = _mm_loadu_si128(src + 3);
+				const __m128i all = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+				const __m128i high = _mm_and_si128(all, _mm_set1_epi32(static_cast<int>(0xFFFFFF80)));
+				if (_mm_movemask_epi8(_mm_cmpeq_epi32(high, zero)) != 0xFFFF) {
+					break;
+				}
+				packed = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+		}
+		return i;
+	}
+#endif
+
+#if defined(UTILITIES_X86)
+	template <typename CharT>
+	UTILITIES_TARGET_AVX2 size_t WidenAsciiAvx2(const unsigned char* in, size_t length, CharT* out)
+	{
+		size_t i = 0;
+		for (; i + 32 <= length; i += 32) {
+			const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+			if (_mm256_movemask_epi8(v) != 0) {
+				break;
+			}
+
+			const __m128i lo = _mm256_castsi256_si128(v);
+			const __m128i hi = _mm256_extracti128_si256(v, 1);
+			auto* dst = reinterpret_cast<__m256i*>(out + i);
+			if constexpr (sizeof(CharT) == 2) {
+				_mm256_storeu_si256(dst, _mm256_cvtepu8_epi16(lo));
+				_mm256_storeu_si256(dst + 1, _mm256_cvtepu8_epi16(hi));
+			}
+			else {
+				_mm256_storeu_si256(dst, _mm256_cvtepu8_epi32(lo));
+				_mm256_storeu_si256(dst + 1, _mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8)));
+				_mm256_storeu_si256(dst + 2, _mm256_cvtepu8_epi32(hi));
+				_mm256_storeu_si256(dst + 3, _mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8)));
+			}
+		}
+		return i;
+	}
+#endif
+
+	template <typename CharT>
+	inline size_t WidenAscii(const unsigned char* in, size_t length, CharT* out)
+	{
+#if defined(UTILITIES_X86)
+		if (CpuFeatures::Get().avx2) {
+			return WidenAsciiAvx2(in, length, out);
+		}
+#endif
+#if defined(UTILITIES_SSE2)
+		return WidenAsciiSse2(in, length, out);
+#else
+		return 0;
+#endif
+	}
+
+	template <typename CharT>
+	inline size_t NarrowAscii(const CharT* in, size_t length, char* out)
+	{
+#if defined(UTILITIES_SSE2)
+		return NarrowAsciiSse2(in, length, out);
+#else
+		return 0;
+#endif
+	}
+
+	template <typename CharT>
+	size_t DecodeUtf8(const char* input, size_t length, CharT* output)
+	{
+		const auto* in = reinterpret_cast<const unsigned char*>(input);
+		CharT* out = output;
+		size_t i = 0;
+
+		while (i < length) {
+			if (in[i] < 0x80) {
+				const size_t run = WidenAscii(in + i, length - i, out);
+				i += run;
+				out += run;
+				while (i < length && in[i] < 0x80) {
+					*out++ = static_cast<CharT>(in[i++]);
+				}
+				continue;
+			}
+			char32_t cp;
+			DecodeSequence(in, length, i, cp);
+			out = PutCodePoint(out, cp);
+		}
+		return static_cast<size_t>(out - output);
+	}
+
+	template <typename CharT>
+	size_t EncodeUtf8(const CharT* input, size_t length, char* output)
+	{
+		char* out = output;
+		size_t i = 0;
+
+		while (i < length) {
+			char32_t cp = static_cast<char32_t>(input[i]);
+			if (cp < 0x80) {
+				const size_t run = NarrowAscii(input + i, length - i, out);
+				i += run;
+				out += run;
+				while (i < length && static_cast<char32_t>(input[i]) < 0x80) {
+					*out++ = static_cast<char>(input[i++]);
+				}
+				continue;
+			}
+
+			++i;
+			if constexpr (sizeof(CharT) == 2) {
+				if (cp >= 0xD800 && cp <= 0xDBFF && i < length
+					&& static_cast<char32_t>(input[i]) >= 0xDC00 && static_cast<char32_t>(input[i]) <= 0xDFFF) {
+					cp = 0x10000 + ((cp - 0xD800) << 10) + (static_cast<char32_t>(input[i]) - 0xDC00);
+					++i;
+				}
+				else if (cp >= 0xD800 && cp <= 0xDFFF) {
+					cp = kReplacement;
+				}
+			}
+			else if (cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
+				cp = kReplacement;
+			}
+			out = PutUtf8(out, cp);
+		}
+		return static_cast<size_t>(out - output);
+	}
+
+	bool ValidateUtf8Scalar(const unsigned char* in, size_t length)
+	{
+		size_t i = 0;
+		while (i < length) {
+			if (i + 8 <= length) {
+				uint64_t word;
+				std::memcpy(&word, in + i, sizeof(word));
+				if ((word & 0x8080808080808080ull) == 0) {
+					i += 8;
+					continue;
+				}
+			}
+			if (in[i] < 0x80) {
+				++i;
+				continue;
+			}
+
+			char32_t cp;
+			if (!DecodeSequence(in, length, i, cp)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+#if defined(UTILITIES_X86)
+	// Lookup tables of the Keiser-Lemire validation algorithm. Each error class gets a bit,
+	// a byte pair is invalid when the bits selected by (high nibble of the previous byte,
+	// low nibble of the previous byte, high nibble of the current byte) intersect.
+	namespace Utf8Error
+	{
+		constexpr uint8_t TooShort = 1 << 0;     // 11______ 0_______
+		constexpr uint8_t TooLong = 1 << 1;      // 0_______ 10______
+		constexpr uint8_t Overlong3 = 1 << 2;    // 11100000 100_____
+		constexpr uint8_t TooLarge = 1 << 3;     // 11110100 1001____
+		constexpr uint8_t Surrogate = 1 << 4;    // 11101101 101_____
+		constexpr uint8_t Overlong2 = 1 << 5;    // 1100000_ 10______
+		constexpr uint8_t TooLarge1000 = 1 << 6; // 11110101+ 1000____
+		constexpr uint8_t Overlong4 = 1 << 6;    // 11110000 1000____
+		constexpr uint8_t TwoConts = 1 << 7;     // 10______ 10______
+		constexpr uint8_t Carry = TooShort | TooLong | TwoConts;
+	}
+
+	alignas(16) constexpr uint8_t kByte1High[16] = {
+		Utf8Error::TooLong, Utf8Error::TooLong, Utf8Error::TooLong, Utf8Error::TooLong,
+		Utf8Error::TooLong, Utf8Error::TooLong, Utf8Error::TooLong, Utf8Error::TooLong,
+		Utf8Error::TwoConts, Utf8Error::TwoConts, Utf8Error::TwoConts, Utf8Error::TwoConts,
+		Utf8Error::TooShort | Utf8Error::Overlong2,
+		Utf8Error::TooShort,
+		Utf8Error::TooShort | Utf8Error::Overlong3 | Utf8Error::Surrogate,
+		Utf8Error::TooShort | Utf8Error::TooLarge | Utf8Error::TooLarge1000 | Utf8Error::Overlong4,
+	};
+
+	constexpr uint8_t kLargeCarry = Utf8Error::Carry | Utf8Error::TooLarge | Utf8Error::TooLarge1000;
+
+	alignas(16) constexpr uint8_t kByte1Low[16] = {
+		Utf8Error::Carry | Utf8Error::Overlong3 | Utf8Error::Overlong2 | Utf8Error::Overlong4,
+		Utf8Error::Carry | Utf8Error::Overlong2,
+		Utf8Error::Carry,
+		Utf8Error::Carry,
+		Utf8Error::Carry | Utf8Error::TooLarge,
+		kLargeCarry, kLargeCarry, kLargeCarry,
+		kLargeCarry, kLargeCarry, kLargeCarry, kLargeCarry, kLargeCarry,
+		kLargeCarry | Utf8Error::Surrogate,
+		kLargeCarry, kLargeCarry,
+	};
+
+	constexpr uint8_t kContinuation = Utf8Error::TooLong | Utf8Error::Overlong2 | Utf8Error::TwoConts;
+
+	alignas(16) constexpr uint8_t kByte2High[16] = {
+		Utf8Error::TooShort, Utf8Error::TooShort, Utf8Error::TooShort, Utf8Error::TooShort,
+		Utf8Error::TooShort, Utf8Error::TooShort, Utf8Error::TooShort, Utf8Error::TooShort,
+		kContinuation | Utf8Error::Overlong3 | Utf8Error::TooLarge1000 | Utf8Error::Overlong4,
+		kContinuation | Utf8Error::Overlong3 | Utf8Error::TooLarge,
+		kContinuation | Utf8Error::Surrogate | Utf8Error::TooLarge,
+		kContinuation | Utf8Error::Surrogate | Utf8Error::TooLarge,
+		Utf8Error::TooShort, Utf8Error::TooShort, Utf8Error::TooShort, Utf8Error::TooShort,
+	};
+
+	struct Utf8StateSsse3
+	{
+		__m128i error;
+		__m128i previous;
+		__m128i previousIncomplete;
+	};
+
+	UTILITIES_TARGET_SSSE3 inline void CheckBlockSsse3(const __m128i input, Utf8StateSsse3& state)
+	{
+		if (_mm_movemask_epi8(input) == 0) {
+			state.error = _mm_or_si128(state.error, state.previousIncomplete);
+			state.previousIncomplete = _mm_setzero_si128();
+			state.previous = input;
+			return;
+		}
+
+		const __m128i nibble = _mm_set1_epi8(0x0F);
+		const __m128i prev1 = _mm_alignr_epi8(input, state.previous, 15);
+		const __m128i byte1High = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(kByte1High)),
+			_mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+		const __m128i byte1Low = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(kByte1Low)),
+			_mm_and_si128(prev1, nibble));
+		const __m128i byte2High = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(kByte2High)),
+			_mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+		const __m128i special = _mm_and_si128(_mm_and_si128(byte1High, byte1Low), byte2High);
+
+		// Bytes two and three positions after a 3/4 byte lead must be continuations
+		const __m128i prev2 = _mm_alignr_epi8(input, state.previous, 14);
+		const __m128i prev3 = _mm_alignr_epi8(input, state.previous, 13);
+		const __m128i must23 = _mm_and_si128(
+			_mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8(static_cast<char>(0xE0 - 0x80))),
+				_mm_subs_epu8(prev3, _mm_set1_epi8(static_cast<char>(0xF0 - 0x80)))),
+			_mm_set1_epi8(static_cast<char>(0x80)));
+
+		state.error = _mm_or_si128(state.error, _mm_xor_si128(must23, special));
+
+		// A lead byte in the last three positions still expects continuations
+		const __m128i maxValue = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			static_cast<char>(0xF0 - 1), static_cast<char>(0xE0 - 1), static_cast<char>(0xC0 - 1));
+		state.previousIncomplete = _mm_subs_epu8(input, maxValue);
+		state.previous = input;
+	}
+
+	UTILITIES_TARGET_SSSE3 bool ValidateUtf8Ssse3(const unsigned char* in, size_t length)
+	{
+		Utf8StateSsse3 state{ _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128() };
+
+		size_t i = 0;
+		for (; i + 16 <= length; i += 16) {
+			CheckBlockSsse3(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)), state);
+		}
+		if (i < length) {
+			alignas(16) unsigned char tail[16] = {};
+			std::memcpy(tail, in + i, length - i);
+			CheckBlockSsse3(_mm_load_si128(reinterpret_cast<const __m128i*>(tail)), state);
+		}
+
+		const __m128i error = _mm_or_si128(state.error, state.previousIncomplete);
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xFFFF;
+	}
+
+	struct Utf8StateAvx2
+	{
+		__m256i error;
+		__m256i previous;
+		__m256i previousIncomplete;
+	};
+
+	template <int N>
+	UTILITIES_TARGET_AVX2 inline __m256i PreviousBytesAvx2(const __m256i input, const __m256i previous)
+	{
+		// Shift the 64-byte window [previous, input] right by N across the lane boundary
+		return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(previous, input, 0x21), 16 - N);
+	}
+
+	UTILITIES_TARGET_AVX2 inline void CheckBlockAvx2(const __m256i input, Utf8StateAvx2& state)
+	{
+		if (_mm256_movemask_epi8(input) == 0) {
+			state.error = _mm256_or_si256(state.error, state.previousIncomplete);
+			state.previousIncomplete = _mm256_setzero_si256();
+			state.previous = input;
+			return;
+		}
+
+		const __m256i nibble = _mm256_set1_epi8(0x0F);
+		const __m256i prev1 = PreviousBytesAvx2<1>(input, state.previous);
+		const __m256i byte1High = _mm256_shuffle_epi8(
+			_mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(kByte1High))),
+			_mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+		const __m256i byte1Low = _mm256_shuffle_epi8(
+			_mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(kByte1Low))),
+			_mm256_and_si256(prev1, nibble));
+		const __m256i byte2High = _mm256_shuffle_epi8(
+			_mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(kByte2High))),
+			_mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+		const __m256i special = _mm256_and_si256(_mm256_and_si256(byte1High, byte1Low), byte2High);
+
+		const __m256i prev2 = PreviousBytesAvx2<2>(input, state.previous);
+		const __m256i prev3 = PreviousBytesAvx2<3>(input, state.previous);
+		const __m256i must23 = _mm256_and_si256(
+			_mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8(static_cast<char>(0xE0 - 0x80))),
+				_mm256_subs_epu8(prev3, _mm256_set1_epi8(static_cast<char>(0xF0 - 0x80)))),
+			_mm256_set1_epi8(static_cast<char>(0x80)));
+
+		state.error = _mm256_or_si256(state.error, _mm256_xor_si256(must23, special));
+
+		const __m256i maxValue = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			static_cast<char>(0xF0 - 1), static_cast<char>(0xE0 - 1), static_cast<char>(0xC0 - 1));
+		state.previousIncomplete = _mm256_subs_epu8(input, maxValue);
+		state.previous = input;
+	}
+
+	UTILITIES_TARGET_AVX2 bool ValidateUtf8Avx2(const unsigned char* in, size_t length)
+	{
+		Utf8StateAvx2 state{ _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256() };
+
+		size_t i = 0;
+		for (; i + 64 <= length; i += 64) {
+			const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+			const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i + 32));
+			if (_mm256_movemask_epi8(_mm256_or_si256(a, b)) == 0) {
+				state.error = _mm256_or_si256(state.error, state.previousIncomplete);
+				state.previousIncomplete = _mm256_setzero_si256();
+				state.previous = b;
+				continue;
+			}
+			CheckBlockAvx2(a, state);
+			CheckBlockAvx2(b, state);
+		}
+		for (; i + 32 <= length; i += 32) {
+			CheckBlockAvx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i)), state);
+		}
+		if (i < length) {
+			alignas(32) unsigned char tail[32] = {};
+			std::memcpy(tail, in + i, length - i);
+			CheckBlockAvx2(_mm256_load_si256(reinterpret_cast<const __m256i*>(tail)), state);
+		}
+
+		const __m256i error = _mm256_or_si256(state.error, state.previousIncomplete);
+		return _mm256_testz_si256(error, error) != 0;
+	}
+#endif
+
+	template <typename StringT>
+	StringT DecodeToString(std::string_view str)
+	{
+		StringT result(Encoding::MaxUnitsFromUtf8(str.size()), 0);
+		result.resize(DecodeUtf8(str.data(), str.size(), result.data()));
+		return result;
+	}
+
+	template <typename CharT>
+	std::string EncodeToString(std::basic_string_view<CharT> str)
+	{
+		std::string result(Encoding::MaxBytesToUtf8(str.size(), sizeof(CharT)), 0);
+		result.resize(EncodeUtf8(str.data(), str.size(), result.data()));
+		return result;
+	}
+
+	// Below this many input bytes a batch is not worth spreading over threads
+	constexpr size_t kParallelBatchBytes = 1 << 20;
+
+	template <typename OutT, typename InputT, typename Convert>
+	Encoding::Batch<OutT> ConvertBatch(std::span<const InputT> inputs, unsigned threads, size_t expansion, Convert convert)
+	{
+		Encoding::Batch<OutT> batch;
+		batch.views.resize(inputs.size());
+
+		// Worst-case slot of every string, plus its terminator
+		std::vector<size_t> offsets(inputs.size() + 1, 0);
+		for (size_t i = 0; i < inputs.size(); ++i) {
+			offsets[i + 1] = offsets[i] + inputs[i].size() * expansion + 1;
+		}
+		const size_t capacity = offsets.back();
+		batch.arena.reset(new OutT[capacity > 0 ? capacity : 1]);
+
+		const size_t inputUnits = capacity - inputs.size();
+		if (threads <= 1 || inputs.size() < 2 || inputUnits < kParallelBatchBytes * expansion) {
+			// Pack tightly, the worst-case slots only matter when writers run concurrently
+			OutT* cursor = batch.arena.get();
+			for (size_t i = 0; i < inputs.size(); ++i) {
+				const size_t written = convert(inputs[i].data(), inputs[i].size(), cursor);
+				cursor[written] = 0;
+				batch.views[i] = { cursor, written };
+				cursor += written + 1;
+			}
+			return batch;
+		}
+
+		auto convertRange = [&](size_t first, size_t last) {
+			for (size_t i = first; i < last; ++i) {
+				OutT* slot = batch.arena.get() + offsets[i];
+				const size_t written = convert(inputs[i].data(), inputs[i].size(), slot);
+				slot[written] = 0;
+				batch.views[i] = { slot, written };
+			}
+		};
+
+		// Cut the input into ranges of roughly equal size
+		const size_t workers = std::min<size_t>(threads, inputs.size());
+		std::vector<std::thread> pool;
+		pool.reserve(workers - 1);
+		size_t first = 0;
+		for (size_t w = 1; w < workers && first < inputs.size(); ++w) {
+			const size_t target = capacity * w / workers;
+			const size_t last = static_cast<size_t>(std::upper_bound(offsets.begin() + first + 1, offsets.end() - 1, target) - offsets.begin());
+			pool.emplace_back(convertRange, first, last);
+			first = last;
+		}
+		convertRange(first, inputs.size());
+
+		for (std::thread& worker : pool) {
+			worker.join();
+		}
+		return batch;
+	}
+}
+
+std::u16string Encoding::Utf8ToUtf16(std::string_view str)
+{
+	return DecodeToString<std::u16string>(str);
+}
+
+std::u32string Encoding::Utf8ToUtf32(std::string_view str)
+{
+	return DecodeToString<std::u32string>(str);
+}
+
+std::wstring Encoding::Utf8ToWide(std::string_view str)
+{
+	return DecodeToString<std::wstring>(str);
+}
+
+std::string Encoding::Utf16ToUtf8(std::u16string_view str)
+{
+	return EncodeToString(str);
+}
+
+std::string Encoding::Utf32ToUtf8(std::u32string_view str)
+{
+	return EncodeToString(str);
+}
+
+std::string Encoding::WideToUtf8(std::wstring_view str)
+{
+	return EncodeToString(str);
+}
+
+Encoding::Batch<wchar_t> Encoding::Utf8ToWideBatch(std::span<const std::string_view> inputs, unsigned threads)
+{
+	return ConvertBatch<wchar_t>(inputs, threads, 1, DecodeUtf8<wchar_t>);
+}
+
+Encoding::Batch<wchar_t> Encoding::Utf8ToWideBatch(std::span<const std::string> inputs, unsigned threads)
+{
+	return ConvertBatch<wchar_t>(inputs, threads, 1, DecodeUtf8<wchar_t>);
+}
+
+Encoding::Batch<char> Encoding::WideToUtf8Batch(std::span<const std::wstring_view> inputs, unsigned threads)
+{
+	return ConvertBatch<char>(inputs, threads, MaxBytesToUtf8(1, sizeof(wchar_t)), EncodeUtf8<wchar_t>);
+}
+
+Encoding::Batch<char> Encoding::WideToUtf8Batch(std::span<const std::wstring> inputs, unsigned threads)
+{
+	return ConvertBatch<char>(inputs, threads, MaxBytesToUtf8(1, sizeof(wchar_t)), EncodeUtf8<wchar_t>);
+}
+
+bool Encoding::ValidateUtf8(std::string_view str)
+{
+	const auto* in = reinterpret_cast<const unsigned char*>(str.data());
+#if defined(UTILITIES_X86)
+	const CpuFeatures& cpu = CpuFeatures::Get();
+	if (cpu.avx2) {
+		return ValidateUtf8Avx2(in, str.size());
+	}
+	if (cpu.ssse3) {
+		return ValidateUtf8Ssse3(in, str.size());
+	}
+#endif
+	return ValidateUtf8Scalar(in, str.size());
+}
+
+size_t Encoding::Utf8ToUtf16(const char* input, size_t length, char16_t* output)
+{
+	return DecodeUtf8(input, length, output);
+}
+
+size_t Encoding::Utf8ToUtf32(const char* input, size_t length, char32_t* output)
+{
+	return DecodeUtf8(input, length, output);
+}
+
+size_t Encoding::Utf8ToWide(const char* input, size_t length, wchar_t* output)
+{
+	return DecodeUtf8(input, length, output);
+}
+
+size_t Encoding::Utf16ToUtf8(const char16_t* input, size_t length, char* output)
+{
+	return EncodeUtf8(input, length, output);
+}
+
+size_t Encoding::Utf32ToUtf8(const char32_t* input, size_t length, char* output)
+{
+	return EncodeUtf8(input, length, output);
+}
+
+size_t Encoding::WideToUtf8(const wchar_t* input, size_t length, char* output)
+{
+	return EncodeUtf8(input, length, output);
+}
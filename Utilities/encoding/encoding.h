@@ -0,0 +1,58 @@
+#pragma once
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Portable UTF-8 <-> UTF-16/UTF-32 transcoding. Every conversion is a single pass into a
+// buffer sized for the worst case, with an SSE2/AVX2 fast path for runs of ASCII.
+// Malformed input is never rejected, each maximal invalid subsequence becomes U+FFFD.
+class Encoding
+{
+public:
+	// Result of a batch conversion. Every view points into the single arena allocation
+	// and is NUL-terminated, so view.data() can go straight to C APIs.
+	template <typename CharT>
+	struct Batch
+	{
+		std::unique_ptr<CharT[]> arena;
+		std::vector<std::basic_string_view<CharT>> views;
+	};
+
+	static std::u16string Utf8ToUtf16(std::string_view str);
+	static std::u32string Utf8ToUtf32(std::string_view str);
+	static std::wstring Utf8ToWide(std::string_view str);
+
+	static std::string Utf16ToUtf8(std::u16string_view str);
+	static std::string Utf32ToUtf8(std::u32string_view str);
+	static std::string WideToUtf8(std::wstring_view str);
+
+	// Converts many strings at once into one arena. With threads > 1 large batches are
+	// split into byte-balanced ranges that convert concurrently into disjoint arena slices.
+	static Batch<wchar_t> Utf8ToWideBatch(std::span<const std::string_view> inputs, unsigned threads = 1);
+	static Batch<wchar_t> Utf8ToWideBatch(std::span<const std::string> inputs, unsigned threads = 1);
+	static Batch<char> WideToUtf8Batch(std::span<const std::wstring_view> inputs, unsigned threads = 1);
+	static Batch<char> WideToUtf8Batch(std::span<const std::wstring> inputs, unsigned threads = 1);
+
+	// Strict UTF-8 check (no overlongs, surrogates or code points past U+10FFFF).
+	// Picks an AVX2, SSSE3 or scalar kernel at runtime.
+	static bool ValidateUtf8(std::string_view str);
+
+	// Raw kernels. The output must have room for MaxUnitsFromUtf8() or MaxBytesToUtf8()
+	// elements, the return value is the number of elements written.
+	static size_t Utf8ToUtf16(const char* input, size_t length, char16_t* output);
+	static size_t Utf8ToUtf32(const char* input, size_t length, char32_t* output);
+	static size_t Utf8ToWide(const char* input, size_t length, wchar_t* output);
+
+	static size_t Utf16ToUtf8(const char16_t* input, size_t length, char* output);
+	static size_t Utf32ToUtf8(const char32_t* input, size_t length, char* output);
+	static size_t WideToUtf8(const wchar_t* input, size_t length, char* output);
+
+	static constexpr size_t MaxUnitsFromUtf8(size_t utf8Length) { return utf8Length; }
+	static constexpr size_t MaxBytesToUtf8(size_t unitCount, size_t unitSize)
+	{
+		// A UTF-16 unit never expands past 3 bytes (pairs take 4 bytes for 2 units)
+		return unitCount * (unitSize == 2 ? 3 : 4);
+	}
+};
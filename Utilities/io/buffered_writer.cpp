@@ -0,0 +1,103 @@
+#include "buffered_writer.h"
+#include "../utils/utilities.h"
+
+#include <algorithm>
+
+BufferedFileWriter::BufferedFileWriter(size_t bufferSize)
+	: m_BufferSize((std::min<size_t>)((std::max<size_t>)(bufferSize, 1), 1u << 30))
+{
+}
+
+BufferedFileWriter::~BufferedFileWriter()
+{
+	Close();
+}
+
+bool BufferedFileWriter::Open(const std::string& path, Mode mode, std::string* error)
+{
+	Close();
+
+	// FILE_APPEND_DATA without FILE_WRITE_DATA makes every write an atomic append
+	const DWORD access = mode == Mode::Append ? FILE_APPEND_DATA : GENERIC_WRITE;
+	const DWORD disposition = mode == Mode::Append ? OPEN_ALWAYS : CREATE_ALWAYS;
+	m_File = CreateFileW(fs::path(path).c_str(), access, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, disposition,
+		FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (m_File == INVALID_HANDLE_VALUE) {
+		if (error) *error = Utilities::Stringify("Could not open ", path, ": ", Utilities::GetLastErrorString());
+		return false;
+	}
+
+	m_Path = path;
+	m_Buffer.reserve(m_BufferSize);
+	return true;
+}
+
+bool BufferedFileWriter::Close(std::string* error)
+{
+	if (m_File == INVALID_HANDLE_VALUE) {
+		return true;
+	}
+
+	const bool flushed = Flush(false, error);
+	CloseHandle(m_File);
+	m_File = INVALID_HANDLE_VALUE;
+	m_Buffer.clear();
+	return flushed;
+}
+
+bool BufferedFileWriter::Write(std::string_view data, std::string* error)
+{
+	if (m_Buffer.size() + data.size() > m_BufferSize) {
+		if (!Flush(false, error)) {
+			return false;
+		}
+		// Anything at least a buffer long skips the copy
+		if (data.size() >= m_BufferSize) {
+			return WriteOut(data, error);
+		}
+	}
+	m_Buffer.append(data);
+	return true;
+}
+
+bool BufferedFileWriter::Commit(std::string* error)
+{
+	return m_Buffer.size() < m_BufferSize || Flush(false, error);
+}
+
+bool BufferedFileWriter::Flush(bool sync, std::string* error)
+{
+	if (m_File == INVALID_HANDLE_VALUE) {
+		if (error) *error = "file is not open";
+		return false;
+	}
+
+	if (!m_Buffer.empty()) {
+		const bool written = WriteOut(m_Buffer, error);
+		m_Buffer.clear();
+		if (!written) {
+			return false;
+		}
+	}
+
+	if (sync && !FlushFileBuffers(m_File)) {
+		if (error) *error = Utilities::Stringify("Could not flush ", m_Path, ": ", Utilities::GetLastErrorString());
+		return false;
+	}
+	return true;
+}
+
+bool BufferedFileWriter::WriteOut(std::string_view data, std::string* error)
+{
+	size_t offset = 0;
+	while (offset < data.size()) {
+		const DWORD chunk = static_cast<DWORD>((std::min<size_t>)(data.size() - offset, 0x80000000u));
+		DWORD written = 0;
+		if (!WriteFile(m_File, data.data() + offset, chunk, &written, nullptr)) {
+			if (error) *error = Utilities::Stringify("Could not write ", m_Path, ": ", Utilities::GetLastErrorString());
+			return false;
+		}
+		offset += written;
+	}
+	return true;
+}
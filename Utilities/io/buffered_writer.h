@@ -0,0 +1,48 @@
+#pragma once
+#include <Windows.h>
+#include <string>
+#include <string_view>
+
+// Write-only file handle that gathers small writes into one buffer and hands the OS a
+// single WriteFile per buffer-full. In append mode every write lands at the current end
+// of the file. The file is not shared for writing, so a second writer cannot open it while
+// this one is open; the journals built on top rely on being the only appender.
+class BufferedFileWriter
+{
+public:
+	enum class Mode
+	{
+		Truncate,
+		Append
+	};
+
+	explicit BufferedFileWriter(size_t bufferSize = 1 << 20);
+	~BufferedFileWriter();
+
+	BufferedFileWriter(const BufferedFileWriter&) = delete;
+	BufferedFileWriter& operator=(const BufferedFileWriter&) = delete;
+
+	bool Open(const std::string& path, Mode mode, std::string* error = nullptr);
+	// Flushes what is buffered, a failure is only reported through the return value
+	bool Close(std::string* error = nullptr);
+	bool IsOpen() const { return m_File != INVALID_HANDLE_VALUE; }
+
+	bool Write(std::string_view data, std::string* error = nullptr);
+	// Hands the buffer to the OS. With sync the data is also flushed to the disk.
+	bool Flush(bool sync = false, std::string* error = nullptr);
+
+	// Lets callers serialize straight into the pending buffer, call Commit() afterwards
+	std::string& Buffer() { return m_Buffer; }
+	bool Commit(std::string* error = nullptr);
+
+	size_t BufferSize() const { return m_BufferSize; }
+	const std::string& Path() const { return m_Path; }
+
+private:
+	bool WriteOut(std::string_view data, std::string* error);
+
+	HANDLE m_File = INVALID_HANDLE_VALUE;
+	std::string m_Path;
+	std::string m_Buffer;
+	size_t m_BufferSize;
+};
@@ -0,0 +1,59 @@
+#include "chunked_reader.h"
+#include "../utils/utilities.h"
+
+#include <algorithm>
+
+ChunkedReader::ChunkedReader(size_t chunkSize)
+	: m_Buffer((std::min<size_t>)((std::max<size_t>)(chunkSize, 1), 1u << 30))
+{
+}
+
+ChunkedReader::~ChunkedReader()
+{
+	Close();
+}
+
+bool ChunkedReader::Open(const std::string& path, std::string* error)
+{
+	Close();
+
+	m_File = CreateFileW(fs::path(path).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (m_File == INVALID_HANDLE_VALUE) {
+		if (error) *error = Utilities::Stringify("Could not open ", path, ": ", Utilities::GetLastErrorString());
+		return false;
+	}
+	return true;
+}
+
+void ChunkedReader::Close()
+{
+	if (m_File != INVALID_HANDLE_VALUE) {
+		CloseHandle(m_File);
+		m_File = INVALID_HANDLE_VALUE;
+	}
+	m_Failed = false;
+	setg(nullptr, nullptr, nullptr);
+}
+
+ChunkedReader::int_type ChunkedReader::underflow()
+{
+	if (gptr() < egptr()) {
+		return traits_type::to_int_type(*gptr());
+	}
+	if (m_File == INVALID_HANDLE_VALUE || m_Failed) {
+		return traits_type::eof();
+	}
+
+	DWORD read = 0;
+	if (!ReadFile(m_File, m_Buffer.data(), static_cast<DWORD>(m_Buffer.size()), &read, nullptr)) {
+		m_Failed = true;
+		return traits_type::eof();
+	}
+	if (read == 0) {
+		return traits_type::eof();
+	}
+
+	setg(m_Buffer.data(), m_Buffer.data(), m_Buffer.data() + read);
+	return traits_type::to_int_type(*gptr());
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <Windows.h>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+// Stream buffer that reads a file through one fixed-size chunk, so an std::istream on top
+// of it (or nlohmann's SAX parser) walks files of any size in constant memory.
+class ChunkedReader : public std::streambuf
+{
+public:
+	explicit ChunkedReader(size_t chunkSize = 1 << 20);
+	~ChunkedReader() override;
+
+	ChunkedReader(const ChunkedReader&) = delete;
+	ChunkedReader& operator=(const ChunkedReader&) = delete;
+
+	bool Open(const std::string& path, std::string* error = nullptr);
+	void Close();
+
+	// A read error ends the stream early, check this after EOF
+	bool Failed() const { return m_Failed; }
+
+protected:
+	int_type underflow() override;
+
+private:
+	HANDLE m_File = INVALID_HANDLE_VALUE;
+	std::vector<char> m_Buffer;
+	bool m_Failed = false;
+};
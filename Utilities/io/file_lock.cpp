@@ -0,0 +1,112 @@
+#include "file_lock.h"
+#include "../utils/utilities.h"
+
+namespace
+{
+	// The first 16 bytes of the lock file hold the generation and its complement, the byte
+	// after them is the one locked. Windows locks are mandatory, so the counter has to sit
+	// outside the locked range to stay readable.
+	constexpr DWORD kLockOffset = 16;
+
+	fs::path LockPath(const std::string& filename)
+	{
+		fs::path path(filename);
+		path += ".lock";
+		return path;
+	}
+
+	// False only when the file cannot be read. A short file has never been bumped.
+	bool ReadGeneration(HANDLE file, uint64_t& generation)
+	{
+		// One write of 16 bytes is not guaranteed to be seen whole, a torn read shows up as a
+		// value that does not match its complement
+		for (int attempt = 0; attempt < 100; ++attempt) {
+			uint64_t words[2] = {};
+			OVERLAPPED overlapped = {};
+			DWORD read = 0;
+			if (!ReadFile(file, words, sizeof(words), &read, &overlapped)) {
+				if (GetLastError() != ERROR_HANDLE_EOF) {
+					return false;
+				}
+				read = 0;
+			}
+			if (read < sizeof(words)) {
+				generation = 0;
+				return true;
+			}
+			if (words[1] == ~words[0]) {
+				generation = words[0];
+				return true;
+			}
+			Sleep(0);
+		}
+		return false;
+	}
+}
+
+JsonFileLock::~JsonFileLock()
+{
+	Release();
+}
+
+bool JsonFileLock::Acquire(const std::string& filename, bool exclusive, std::string& message)
+{
+	Release();
+
+	m_Path = LockPath(filename);
+	m_File = CreateFileW(m_Path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (m_File == INVALID_HANDLE_VALUE) {
+		message = Utilities::Stringify("Could not open ", m_Path.string(), ": ", Utilities::GetLastErrorString());
+		return false;
+	}
+	OVERLAPPED overlapped = {};
+	overlapped.Offset = kLockOffset;
+	if (!LockFileEx(m_File, exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0, 0, 1, 0, &overlapped)) {
+		message = Utilities::Stringify("Could not lock ", m_Path.string(), ": ", Utilities::GetLastErrorString());
+		CloseHandle(m_File);
+		m_File = INVALID_HANDLE_VALUE;
+		return false;
+	}
+	return true;
+}
+
+void JsonFileLock::Release()
+{
+	if (m_File != INVALID_HANDLE_VALUE) {
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = kLockOffset;
+		UnlockFileEx(m_File, 0, 1, 0, &overlapped);
+		CloseHandle(m_File);
+		m_File = INVALID_HANDLE_VALUE;
+	}
+}
+
+bool JsonFileLock::BumpGeneration(std::string& message)
+{
+	uint64_t generation = 0;
+	ReadGeneration(m_File, generation);
+	++generation;
+	const uint64_t words[2] = { generation, ~generation };
+	OVERLAPPED overlapped = {};
+	DWORD written = 0;
+	if (!WriteFile(m_File, words, sizeof(words), &written, &overlapped) || written != sizeof(words)) {
+		message = Utilities::Stringify("Could not update the generation in ", m_Path.string(), ": ", Utilities::GetLastErrorString());
+		return false;
+	}
+	return true;
+}
+
+uint64_t JsonFileLock::PeekGeneration(const std::string& filename)
+{
+	// Opened read-only: checking for changes should not create the lock file
+	HANDLE file = CreateFileW(LockPath(filename).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return 0;
+	}
+	uint64_t generation = 0;
+	ReadGeneration(file, generation);
+	CloseHandle(file);
+	return generation;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <Windows.h>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+// Cross-process lock on "<file>.lock" next to a JSON file, shared for readers and exclusive
+// for writers, plus the generation counter kept in the same file. A lock belongs to the
+// handle and goes away with it, also when the process dies.
+class JsonFileLock
+{
+public:
+	JsonFileLock() = default;
+	~JsonFileLock();
+
+	JsonFileLock(const JsonFileLock&) = delete;
+	JsonFileLock& operator=(const JsonFileLock&) = delete;
+
+	// Blocks until the lock is granted
+	bool Acquire(const std::string& filename, bool exclusive, std::string& message);
+	void Release();
+	bool IsHeld() const { return m_File != INVALID_HANDLE_VALUE; }
+
+	// Exclusive holders only. A counter that does not read back starts over, readers only
+	// compare it for equality.
+	bool BumpGeneration(std::string& message);
+
+	// Reads the counter without locking and without creating the lock file, 0 when there is none
+	static uint64_t PeekGeneration(const std::string& filename);
+
+private:
+	std::filesystem::path m_Path;
+	HANDLE m_File = INVALID_HANDLE_VALUE;
+};
@@ -0,0 +1,89 @@
+#include "mapped_file.h"
+#include "../utils/utilities.h"
+
+#include <cstdint>
+#include <utility>
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+	*this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this != &other) {
+		Close();
+		m_File = std::exchange(other.m_File, INVALID_HANDLE_VALUE);
+		m_Mapping = std::exchange(other.m_Mapping, nullptr);
+		m_Data = std::exchange(other.m_Data, nullptr);
+		m_Size = std::exchange(other.m_Size, 0);
+	}
+	return *this;
+}
+
+bool MappedFile::Open(const std::string& path, std::string* error)
+{
+	Close();
+
+	m_File = CreateFileW(fs::path(path).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (m_File == INVALID_HANDLE_VALUE) {
+		if (error) *error = Utilities::Stringify("Could not open ", path, ": ", Utilities::GetLastErrorString());
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_File, &size)) {
+		if (error) *error = Utilities::Stringify("Could not get the size of ", path, ": ", Utilities::GetLastErrorString());
+		Close();
+		return false;
+	}
+	if (static_cast<unsigned long long>(size.QuadPart) > SIZE_MAX) {
+		if (error) *error = Utilities::Stringify(path, " is too large to map into this process.");
+		Close();
+		return false;
+	}
+
+	// A zero-length file cannot be mapped
+	m_Size = static_cast<size_t>(size.QuadPart);
+	if (m_Size == 0) {
+		return true;
+	}
+
+	m_Mapping = CreateFileMappingW(m_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!m_Mapping) {
+		if (error) *error = Utilities::Stringify("Could not map ", path, ": ", Utilities::GetLastErrorString());
+		Close();
+		return false;
+	}
+
+	m_Data = static_cast<const char*>(MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!m_Data) {
+		if (error) *error = Utilities::Stringify("Could not map ", path, ": ", Utilities::GetLastErrorString());
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_Data) {
+		UnmapViewOfFile(m_Data);
+		m_Data = nullptr;
+	}
+	if (m_Mapping) {
+		CloseHandle(m_Mapping);
+		m_Mapping = nullptr;
+	}
+	if (m_File != INVALID_HANDLE_VALUE) {
+		CloseHandle(m_File);
+		m_File = INVALID_HANDLE_VALUE;
+	}
+	m_Size = 0;
+}
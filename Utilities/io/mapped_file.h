@@ -0,0 +1,33 @@
+#pragma once
+#include <Windows.h>
+#include <string>
+#include <string_view>
+
+// Read-only view of a whole file through a Win32 file mapping. The pages are shared with
+// every other process mapping the same file and are only faulted in when touched.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+
+	// Empty files open successfully and expose an empty view
+	bool Open(const std::string& path, std::string* error = nullptr);
+	void Close();
+
+	bool IsOpen() const { return m_File != INVALID_HANDLE_VALUE; }
+	const char* Data() const { return m_Data; }
+	size_t Size() const { return m_Size; }
+	std::string_view View() const { return std::string_view(m_Data, m_Size); }
+
+private:
+	HANDLE m_File = INVALID_HANDLE_VALUE;
+	HANDLE m_Mapping = nullptr;
+	const char* m_Data = nullptr;
+	size_t m_Size = 0;
+};
@@ -0,0 +1,196 @@
+#include "arena_json.h"
+
+#include <cstdlib>
+#include <map>
+#include <mutex>
+
+namespace
+{
+	thread_local JsonArena* g_CurrentArena = nullptr;
+
+	// Address ranges of every live chunk, start -> end
+	std::mutex g_ChunkMutex;
+	std::map<uintptr_t, uintptr_t> g_Chunks;
+
+	void* AllocateChunk(size_t size)
+	{
+		void* chunk = std::malloc(size);
+		if (!chunk) {
+			throw std::bad_alloc();
+		}
+		std::lock_guard<std::mutex> lock(g_ChunkMutex);
+		g_Chunks.emplace(reinterpret_cast<uintptr_t>(chunk), reinterpret_cast<uintptr_t>(chunk) + size);
+		return chunk;
+	}
+
+	class BinarySax
+	{
+	public:
+		explicit BinarySax(ArenaJson& root)
+			: m_Builder(root)
+		{
+		}
+
+		bool null() { return m_Builder.null(); }
+		bool boolean(bool value) { return m_Builder.boolean(value); }
+		bool number_integer(std::int64_t value) { return m_Builder.number_integer(value); }
+		bool number_unsigned(std::uint64_t value) { return m_Builder.number_unsigned(value); }
+		bool number_float(double value, const std::string&) { return m_Builder.number_float(value, ArenaString()); }
+		bool start_object(std::size_t length) { return m_Builder.start_object(length); }
+		bool end_object() { return m_Builder.end_object(); }
+		bool start_array(std::size_t length) { return m_Builder.start_array(length); }
+		bool end_array() { return m_Builder.end_array(); }
+
+		bool string(std::string& value)
+		{
+			ArenaString copy(value.data(), value.size());
+			return m_Builder.string(copy);
+		}
+
+		bool key(std::string& value)
+		{
+			ArenaString copy(value.data(), value.size());
+			return m_Builder.key(copy);
+		}
+
+		bool binary(nlohmann::json::binary_t& value)
+		{
+			ArenaJson::binary_t copy(ArenaJson::binary_t::container_type(value.begin(), value.end()));
+			if (value.has_subtype()) {
+				copy.set_subtype(value.subtype());
+			}
+			return m_Builder.binary(copy);
+		}
+
+		bool parse_error(std::size_t position, const std::string& token, const nlohmann::detail::exception& e)
+		{
+			return m_Builder.parse_error(position, token, e);
+		}
+
+	private:
+		nlohmann::detail::json_sax_dom_parser<ArenaJson> m_Builder;
+	};
+
+	void FreeChunk(void* chunk)
+	{
+		{
+			std::lock_guard<std::mutex> lock(g_ChunkMutex);
+			g_Chunks.erase(reinterpret_cast<uintptr_t>(chunk));
+		}
+		std::free(chunk);
+	}
+}
+
+JsonArena::JsonArena(size_t chunkSize)
+	: m_ChunkSize(chunkSize > 0 ? chunkSize : 1)
+{
+}
+
+JsonArena::~JsonArena()
+{
+	for (void* chunk : m_Chunks) {
+		FreeChunk(chunk);
+	}
+}
+
+void* JsonArena::Allocate(size_t size, size_t alignment)
+{
+	const uintptr_t cursor = reinterpret_cast<uintptr_t>(m_Cursor);
+	const uintptr_t aligned = (cursor + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+	if (m_Cursor && aligned + size <= reinterpret_cast<uintptr_t>(m_End)) {
+		m_Cursor = reinterpret_cast<char*>(aligned + size);
+		return reinterpret_cast<void*>(aligned);
+	}
+	return AllocateSlow(size, alignment);
+}
+
+void* JsonArena::AllocateSlow(size_t size, size_t alignment)
+{
+	// Oversized requests get a chunk of their own so the current chunk keeps its tail
+	const size_t needed = size + alignment;
+	if (needed > m_ChunkSize / 4) {
+		void* chunk = AllocateChunk(needed);
+		m_Chunks.push_back(chunk);
+		m_Reserved += needed;
+		const uintptr_t aligned = (reinterpret_cast<uintptr_t>(chunk) + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+		return reinterpret_cast<void*>(aligned);
+	}
+
+	void* chunk = AllocateChunk(m_ChunkSize);
+	m_Chunks.push_back(chunk);
+	m_Reserved += m_ChunkSize;
+	m_Cursor = static_cast<char*>(chunk);
+	m_End = m_Cursor + m_ChunkSize;
+	return Allocate(size, alignment);
+}
+
+JsonArena* JsonArena::Current()
+{
+	return g_CurrentArena;
+}
+
+bool JsonArena::Owns(const void* p)
+{
+	const uintptr_t address = reinterpret_cast<uintptr_t>(p);
+	std::lock_guard<std::mutex> lock(g_ChunkMutex);
+	auto next = g_Chunks.upper_bound(address);
+	if (next == g_Chunks.begin()) {
+		return false;
+	}
+	--next;
+	return address < next->second;
+}
+
+JsonArena::Scope::Scope(JsonArena& arena)
+	: m_Previous(g_CurrentArena)
+{
+	g_CurrentArena = &arena;
+}
+
+JsonArena::Scope::~Scope()
+{
+	g_CurrentArena = m_Previous;
+}
+
+ArenaJsonDocument::ArenaJsonDocument(size_t chunkSize)
+	: m_ChunkSize(chunkSize)
+{
+	Reset();
+}
+
+void ArenaJsonDocument::Reset()
+{
+	// The old tree is abandoned, not destroyed, its memory leaves with the old arena
+	m_Arena = std::make_unique<JsonArena>(m_ChunkSize);
+	void* storage = m_Arena->Allocate(sizeof(ArenaJson), alignof(ArenaJson));
+	m_Root = new (storage) ArenaJson();
+}
+
+void ArenaJsonDocument::Parse(const char* begin, const char* end, nlohmann::json::input_format_t format)
+{
+	Reset();
+
+	if (format == nlohmann::json::input_format_t::json) {
+		// Throws before the root is assigned, so a failure leaves it empty
+		JsonArena::Scope scope(*m_Arena);
+		*m_Root = ArenaJson::parse(begin, end);
+		return;
+	}
+
+	// nlohmann's binary readers only work with std::string, so they run against the stock
+	// json type and every event is re-targeted at the arena tree
+	bool parsed = false;
+	try {
+		JsonArena::Scope scope(*m_Arena);
+		BinarySax sax(*m_Root);
+		parsed = nlohmann::json::sax_parse(begin, end, &sax, format);
+	}
+	catch (...) {
+		// The DOM builder reports bad input by throwing, with the tree half built
+		Reset();
+		throw;
+	}
+	if (!parsed) {
+		Reset();
+	}
+}
@@ -0,0 +1,134 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "../dependencies/json.hpp"
+
+// Bump allocator backing ArenaJson. Allocations are carved out of large chunks and are
+// never freed one by one, the chunks go away together with the arena.
+class JsonArena
+{
+public:
+	explicit JsonArena(size_t chunkSize = 1 << 20);
+	~JsonArena();
+
+	JsonArena(const JsonArena&) = delete;
+	JsonArena& operator=(const JsonArena&) = delete;
+
+	void* Allocate(size_t size, size_t alignment);
+	size_t BytesReserved() const { return m_Reserved; }
+
+	// ArenaAllocator draws from the arena installed on the calling thread
+	static JsonArena* Current();
+	// Whether p lies in a chunk of any live arena. Takes a lock, only the heap fallback uses it.
+	static bool Owns(const void* p);
+
+	class Scope
+	{
+	public:
+		explicit Scope(JsonArena& arena);
+		~Scope();
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+		JsonArena* m_Previous;
+	};
+
+private:
+	void* AllocateSlow(size_t size, size_t alignment);
+
+	std::vector<void*> m_Chunks;
+	char* m_Cursor = nullptr;
+	char* m_End = nullptr;
+	size_t m_ChunkSize;
+	size_t m_Reserved = 0;
+};
+
+// Allocator that binds to JsonArena::Current() when it is constructed. Containers keep
+// their allocator, so a tree built inside a JsonArena::Scope keeps growing in its arena
+// afterwards. Without an arena it falls back to the heap, which lets const reads and
+// temporaries work anywhere. Arena memory is never freed individually.
+template <typename T>
+class ArenaAllocator
+{
+public:
+	using value_type = T;
+
+	ArenaAllocator() noexcept
+		: m_Arena(JsonArena::Current())
+	{
+	}
+
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) noexcept
+		: m_Arena(other.m_Arena)
+	{
+	}
+
+	T* allocate(size_t count)
+	{
+		if (m_Arena) {
+			return static_cast<T*>(m_Arena->Allocate(count * sizeof(T), alignof(T)));
+		}
+		return static_cast<T*>(::operator new(count * sizeof(T)));
+	}
+
+	void deallocate(T* p, size_t) noexcept
+	{
+		// nlohmann destroys nodes through a fresh allocator, which may be a heap one
+		// even though the node came from an arena
+		if (!m_Arena && !JsonArena::Owns(p)) {
+			::operator delete(p);
+		}
+	}
+
+	template <typename U>
+	bool operator==(const ArenaAllocator<U>& other) const noexcept { return m_Arena == other.m_Arena; }
+	template <typename U>
+	bool operator!=(const ArenaAllocator<U>& other) const noexcept { return m_Arena != other.m_Arena; }
+
+private:
+	template <typename U>
+	friend class ArenaAllocator;
+
+	JsonArena* m_Arena;
+};
+
+using ArenaString = std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>;
+using ArenaJson = nlohmann::basic_json<std::map, std::vector, ArenaString, bool, std::int64_t, std::uint64_t, double,
+	ArenaAllocator, nlohmann::adl_serializer, std::vector<std::uint8_t, ArenaAllocator<std::uint8_t>>>;
+
+// An ArenaJson tree together with the arena that owns it. Destroying the document frees
+// the chunks without visiting the tree, so values built outside a JsonArena::Scope for
+// Arena() and then moved into the tree are leaked. Make larger edits inside a scope.
+class ArenaJsonDocument
+{
+public:
+	explicit ArenaJsonDocument(size_t chunkSize = 1 << 20);
+	~ArenaJsonDocument() = default;
+
+	ArenaJsonDocument(ArenaJsonDocument&&) noexcept = default;
+	ArenaJsonDocument& operator=(ArenaJsonDocument&&) noexcept = default;
+
+	ArenaJson& Root() { return *m_Root; }
+	const ArenaJson& Root() const { return *m_Root; }
+	JsonArena& Arena() { return *m_Arena; }
+
+	// Drops the current tree and starts over with a fresh arena
+	void Reset();
+
+	// Parses into Root(), replacing what was there. Throws nlohmann::json::exception on bad
+	// input and leaves the document empty.
+	void Parse(const char* begin, const char* end, nlohmann::json::input_format_t format = nlohmann::json::input_format_t::json);
+
+private:
+	std::unique_ptr<JsonArena> m_Arena;
+	ArenaJson* m_Root;
+	size_t m_ChunkSize;
+};
@@ -0,0 +1,321 @@
+#include "config_handle.h"
+
+#include <algorithm>
+#include <limits>
+
+// Epoch-based reclamation shared by every ConfigHandle. A reader publishes the global epoch
+// in its thread's slot while it holds a View. The epoch and the number of Views pinning it
+// share one word, epoch << kDepthBits | depth, so a View released on another thread updates
+// both at once; 0 means no View is held. A thread can nest up to 65535 Views.
+struct alignas(64) ConfigReaderSlot
+{
+	std::atomic<uint64_t> state{ 0 };
+	std::atomic<bool> inUse{ false };
+	ConfigReaderSlot* next = nullptr;
+};
+
+namespace
+{
+	using ReaderSlot = ConfigReaderSlot;
+
+	constexpr unsigned kDepthBits = 16;
+	constexpr uint64_t kDepthMask = (uint64_t(1) << kDepthBits) - 1;
+
+	std::atomic<uint64_t> g_Epoch{ 1 };
+	std::atomic<ReaderSlot*> g_Slots{ nullptr };
+
+	// Slots are never freed, a thread that exits hands its slot to the next new thread
+	ReaderSlot* ClaimSlot()
+	{
+		for (ReaderSlot* slot = g_Slots.load(std::memory_order_acquire); slot; slot = slot->next) {
+			bool expected = false;
+			if (!slot->inUse.load(std::memory_order_relaxed) && slot->inUse.compare_exchange_strong(expected, true)) {
+				return slot;
+			}
+		}
+
+		ReaderSlot* slot = new ReaderSlot;
+		slot->inUse.store(true, std::memory_order_relaxed);
+		slot->next = g_Slots.load(std::memory_order_relaxed);
+		while (!g_Slots.compare_exchange_weak(slot->next, slot, std::memory_order_release, std::memory_order_relaxed)) {
+		}
+		return slot;
+	}
+
+	struct SlotOwner
+	{
+		ReaderSlot* slot = ClaimSlot();
+		~SlotOwner() { slot->inUse.store(false, std::memory_order_release); }
+	};
+
+	ReaderSlot& ThreadSlot()
+	{
+		thread_local SlotOwner owner;
+		return *owner.slot;
+	}
+
+	// The first View announces the current epoch, nested ones only count
+	void Pin(ReaderSlot& slot)
+	{
+		uint64_t state = slot.state.load();
+		for (;;) {
+			const uint64_t next = (state & kDepthMask) == 0 ? (g_Epoch.load() << kDepthBits) | 1 : state + 1;
+			if (slot.state.compare_exchange_weak(state, next)) {
+				return;
+			}
+		}
+	}
+
+	void Unpin(ReaderSlot& slot)
+	{
+		uint64_t state = slot.state.load();
+		for (;;) {
+			const uint64_t next = (state & kDepthMask) == 1 ? 0 : state - 1;
+			if (slot.state.compare_exchange_weak(state, next)) {
+				return;
+			}
+		}
+	}
+
+	// The oldest epoch any reader may still be looking at
+	uint64_t OldestActiveEpoch()
+	{
+		uint64_t oldest = (std::numeric_limits<uint64_t>::max)();
+		for (ReaderSlot* slot = g_Slots.load(std::memory_order_acquire); slot; slot = slot->next) {
+			const uint64_t epoch = slot->state.load() >> kDepthBits;
+			if (epoch != 0) {
+				oldest = (std::min)(oldest, epoch);
+			}
+		}
+		return oldest;
+	}
+
+	bool QueryStamp(const std::string& filename, uint64_t& lastWrite, uint64_t& size)
+	{
+		WIN32_FILE_ATTRIBUTE_DATA data;
+		if (!GetFileAttributesExW(fs::path(filename).c_str(), GetFileExInfoStandard, &data)) {
+			return false;
+		}
+		lastWrite = (static_cast<uint64_t>(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+		size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+		return true;
+	}
+}
+
+ConfigHandle::View::~View()
+{
+	if (m_Slot) {
+		Unpin(*m_Slot);
+	}
+}
+
+const nlohmann::json& ConfigHandle::View::operator*() const
+{
+	return m_Snapshot->data;
+}
+
+uint64_t ConfigHandle::View::Version() const
+{
+	return m_Snapshot->version;
+}
+
+ConfigHandle::~ConfigHandle()
+{
+	Close();
+}
+
+bool ConfigHandle::Open(const std::string& filename, const ConfigHandleOptions& options, std::string* error)
+{
+	Close();
+
+	m_Filename = filename;
+	m_Options = options;
+	{
+		std::lock_guard<std::mutex> lock(m_ReloadMutex);
+		if (!LoadLocked(error)) {
+			return false;
+		}
+	}
+
+	// Saves usually replace the file by renaming over it, so the directory is what gets watched
+	fs::path directory = fs::absolute(fs::path(filename)).parent_path();
+	HANDLE change = FindFirstChangeNotificationW(directory.c_str(), FALSE,
+		FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE);
+	if (change == INVALID_HANDLE_VALUE) {
+		const std::string message = Utilities::Stringify("Could not watch ", directory.string(), ": ", Utilities::GetLastErrorString());
+		Close();
+		if (error) *error = message;
+		else Logger::Error(message);
+		return false;
+	}
+
+	m_StopEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+	m_Watcher = std::thread(&ConfigHandle::WatchLoop, this, change);
+	return true;
+}
+
+void ConfigHandle::Close()
+{
+	if (m_StopEvent) {
+		SetEvent(m_StopEvent);
+	}
+	if (m_Watcher.joinable()) {
+		m_Watcher.join();
+	}
+	if (m_StopEvent) {
+		CloseHandle(m_StopEvent);
+		m_StopEvent = nullptr;
+	}
+
+	std::lock_guard<std::mutex> lock(m_ReloadMutex);
+	if (const Snapshot* current = m_Current.exchange(nullptr)) {
+		m_Retired.emplace_back(current, g_Epoch.fetch_add(1));
+	}
+	Reclaim(true);
+	m_Stamp = FileStamp();
+	m_Version = 0;
+}
+
+ConfigHandle::View ConfigHandle::Acquire() const
+{
+	// Announce first, then load. Any snapshot retired after the announcement is kept until
+	// the slot is cleared, and anything retired before it is no longer reachable from here.
+	ReaderSlot& slot = ThreadSlot();
+	Pin(slot);
+
+	const Snapshot* snapshot = m_Current.load();
+	if (!snapshot) {
+		Unpin(slot);
+		return View(nullptr, nullptr);
+	}
+	return View(snapshot, &slot);
+}
+
+bool ConfigHandle::Reload(std::string* error)
+{
+	std::lock_guard<std::mutex> lock(m_ReloadMutex);
+	if (!m_Current.load(std::memory_order_relaxed)) {
+		if (error) *error = "the config handle is not open";
+		return false;
+	}
+	return LoadLocked(error);
+}
+
+uint64_t ConfigHandle::Version() const
+{
+	std::lock_guard<std::mutex> lock(m_ReloadMutex);
+	return m_Version;
+}
+
+bool ConfigHandle::LoadLocked(std::string* error)
+{
+	// Stamp before parsing, a write that lands mid-parse then still counts as a change
+	FileStamp stamp;
+	QueryStamp(m_Filename, stamp.lastWrite, stamp.size);
+
+	nlohmann::json data;
+	if (!Utilities::LoadFromJson(m_Filename, data, m_Options.load, error)) {
+		return false;
+	}
+	m_Stamp = stamp;
+	Publish(std::move(data));
+	return true;
+}
+
+void ConfigHandle::Publish(nlohmann::json data)
+{
+	Snapshot* snapshot = new Snapshot;
+	snapshot->data = std::move(data);
+	snapshot->version = ++m_Version;
+
+	// Readers that loaded the old pointer announced an epoch no later than the one read here
+	const Snapshot* replaced = m_Current.exchange(snapshot);
+	const uint64_t epoch = g_Epoch.fetch_add(1);
+	if (replaced) {
+		m_Retired.emplace_back(replaced, epoch);
+	}
+	Reclaim(false);
+}
+
+void ConfigHandle::Reclaim(bool wait)
+{
+	while (!m_Retired.empty()) {
+		const uint64_t oldest = OldestActiveEpoch();
+		const auto freed = std::remove_if(m_Retired.begin(), m_Retired.end(), [&](const std::pair<const Snapshot*, uint64_t>& retired) {
+			if (retired.second >= oldest) {
+				return false;
+			}
+			delete retired.first;
+			return true;
+		});
+		m_Retired.erase(freed, m_Retired.end());
+
+		if (!wait || m_Retired.empty()) {
+			break;
+		}
+		std::this_thread::yield();
+	}
+}
+
+void ConfigHandle::WatchLoop(HANDLE change)
+{
+	const HANDLE handles[] = { m_StopEvent, change };
+	for (;;) {
+		// Retired snapshots pinned by a slow reader get another chance every 100ms
+		DWORD timeout = INFINITE;
+		{
+			std::lock_guard<std::mutex> lock(m_ReloadMutex);
+			if (!m_Retired.empty()) {
+				timeout = 100;
+			}
+		}
+
+		const DWORD signaled = WaitForMultipleObjects(2, handles, FALSE, timeout);
+		if (signaled == WAIT_TIMEOUT) {
+			std::lock_guard<std::mutex> lock(m_ReloadMutex);
+			Reclaim(false);
+			continue;
+		}
+		if (signaled != WAIT_OBJECT_0 + 1) {
+			break;
+		}
+
+		// Wait until the directory has been quiet for the debounce period
+		bool stopping = false;
+		do {
+			if (!FindNextChangeNotification(change) || WaitForSingleObject(m_StopEvent, m_Options.debounceMs) == WAIT_OBJECT_0) {
+				stopping = true;
+				break;
+			}
+		} while (WaitForSingleObject(change, 0) == WAIT_OBJECT_0);
+		if (stopping) {
+			break;
+		}
+
+		std::string message;
+		bool reloaded = false;
+		{
+			std::lock_guard<std::mutex> lock(m_ReloadMutex);
+			FileStamp stamp;
+			// Other files in the directory changed, or the file is mid-replace and missing
+			if (!QueryStamp(m_Filename, stamp.lastWrite, stamp.size) || stamp == m_Stamp) {
+				continue;
+			}
+			reloaded = LoadLocked(&message);
+			if (!reloaded) {
+				// Do not retry the same broken bytes until the file changes again
+				m_Stamp = stamp;
+			}
+		}
+
+		if (reloaded && m_Options.onReload) {
+			View view = Acquire();
+			m_Options.onReload(*view);
+		}
+		else if (!reloaded) {
+			if (m_Options.onError) m_Options.onError(message);
+			else Logger::Error("Failed reloading ", m_Filename, ": ", message);
+		}
+	}
+	FindCloseChangeNotification(change);
+}
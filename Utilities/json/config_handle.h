@@ -0,0 +1,130 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "../utils/utilities.h"
+
+// A reader thread's epoch announcement, defined in config_handle.cpp
+struct ConfigReaderSlot;
+
+struct ConfigHandleOptions
+{
+	JsonLoadOptions load;
+	// Quiet period after the last change notification before the file is parsed, editors
+	// and atomic saves touch the directory several times per save
+	unsigned debounceMs = 50;
+	// Called on the watcher thread after a new snapshot is published
+	std::function<void(const nlohmann::json&)> onReload;
+	// Called on the watcher thread when a changed file fails to load, the old snapshot stays.
+	// Without it the failure is logged.
+	std::function<void(const std::string&)> onError;
+};
+
+// A JSON config file that reloads itself when it changes on disk. A watcher thread waits on
+// a directory change notification, parses the new version off the reader path and publishes
+// it with one atomic pointer swap.
+//
+// Readers never take a lock: Acquire() announces the current epoch in a per-thread slot,
+// loads the pointer and clears the slot again when the View goes away. Replaced snapshots
+// are freed once every announced epoch has moved past the swap, so a reader keeps its
+// snapshot intact for as long as it holds the View, even across reloads.
+class ConfigHandle
+{
+	struct Snapshot;
+
+public:
+	// A pinned snapshot. Keep it short lived, it delays freeing every replaced snapshot of
+	// every handle. Views must not outlive their handle. A View may be moved to and destroyed
+	// on another thread, it unpins the slot of the thread that acquired it.
+	class View
+	{
+	public:
+		View(View&& other) noexcept
+			: m_Snapshot(std::exchange(other.m_Snapshot, nullptr)), m_Slot(std::exchange(other.m_Slot, nullptr)) {}
+		View& operator=(View&&) = delete;
+		View(const View&) = delete;
+		View& operator=(const View&) = delete;
+		~View();
+
+		// False when the handle was not open
+		explicit operator bool() const { return m_Snapshot != nullptr; }
+		const nlohmann::json& operator*() const;
+		const nlohmann::json* operator->() const { return &**this; }
+		// Starts at 1 and grows by one per published reload
+		uint64_t Version() const;
+
+	private:
+		friend class ConfigHandle;
+		View(const Snapshot* snapshot, ConfigReaderSlot* slot) : m_Snapshot(snapshot), m_Slot(slot) {}
+
+		const Snapshot* m_Snapshot;
+		ConfigReaderSlot* m_Slot;
+	};
+
+	ConfigHandle() = default;
+	~ConfigHandle();
+
+	ConfigHandle(const ConfigHandle&) = delete;
+	ConfigHandle& operator=(const ConfigHandle&) = delete;
+
+	// Loads the file synchronously and starts watching it. Fails when the first load fails.
+	bool Open(const std::string& filename, const ConfigHandleOptions& options = {}, std::string* error = nullptr);
+	// Stops the watcher and waits for outstanding Views before freeing the snapshots, so it
+	// must not be called by a thread that still holds one
+	void Close();
+	bool IsOpen() const { return m_Current.load(std::memory_order_acquire) != nullptr; }
+
+	View Acquire() const;
+	template <typename Fn>
+	auto Read(Fn&& fn) const
+	{
+		View view = Acquire();
+		return fn(*view);
+	}
+
+	// Parses the file now, whether or not it changed
+	bool Reload(std::string* error = nullptr);
+	uint64_t Version() const;
+
+private:
+	struct Snapshot
+	{
+		nlohmann::json data;
+		uint64_t version = 0;
+	};
+
+	struct FileStamp
+	{
+		uint64_t lastWrite = 0;
+		uint64_t size = 0;
+
+		bool operator==(const FileStamp& other) const { return lastWrite == other.lastWrite && size == other.size; }
+	};
+
+	// Caller holds m_ReloadMutex
+	bool LoadLocked(std::string* error);
+	void Publish(nlohmann::json data);
+	void Reclaim(bool wait);
+	void WatchLoop(HANDLE change);
+
+	std::string m_Filename;
+	ConfigHandleOptions m_Options;
+
+	std::atomic<const Snapshot*> m_Current{ nullptr };
+
+	// Serializes reloads and guards everything below
+	mutable std::mutex m_ReloadMutex;
+	FileStamp m_Stamp;
+	uint64_t m_Version = 0;
+	// Replaced snapshots with the epoch they were retired in
+	std::vector<std::pair<const Snapshot*, uint64_t>> m_Retired;
+
+	HANDLE m_StopEvent = nullptr;
+	std::thread m_Watcher;
+};
@@ -0,0 +1,57 @@
+#include "embedded_json.h"
+
+bool EmbeddedJson::GenerateHeader(const nlohmann::json& value, const std::string& symbol, bool frozen, std::string& header,
+	std::string* error)
+{
+	std::string bytes;
+	if (frozen) {
+		if (!FrozenDocument::Freeze(value, bytes, error)) {
+			return false;
+		}
+	}
+	else {
+		try {
+			bytes = value.dump();
+		}
+		catch (const nlohmann::json::exception& e) {
+			if (error) *error = e.what();
+			else Logger::Error("Failed embedding json: ", e.what());
+			return false;
+		}
+	}
+
+	// Brace lists rather than string literals, which MSVC caps at 64 KiB
+	static constexpr char kHex[] = "0123456789abcdef";
+	header = "// Generated by embed_json, do not edit\n#pragma once\n\n";
+	header += frozen ? "alignas(8) inline constexpr unsigned char " : "inline constexpr char ";
+	header += symbol;
+	header += "[] = {";
+	for (size_t i = 0; i < bytes.size(); ++i) {
+		header += i % 16 == 0 ? "\n\t" : " ";
+		const unsigned char c = static_cast<unsigned char>(bytes[i]);
+		if (frozen) {
+			header += "0x";
+			header.push_back(kHex[c >> 4]);
+			header.push_back(kHex[c & 0xF]);
+		}
+		else {
+			header += "'\\x";
+			header.push_back(kHex[c >> 4]);
+			header.push_back(kHex[c & 0xF]);
+			header.push_back('\'');
+		}
+		header.push_back(',');
+	}
+	header += "\n};\n";
+	return true;
+}
+
+FrozenValue EmbeddedFrozenJson::Root() const
+{
+	// The values point into the static image, not into the document
+	FrozenDocument document;
+	if (!document.FromMemoryTrusted(m_Data, m_Size)) {
+		return FrozenValue();
+	}
+	return document.Root();
+}
@@ -0,0 +1,321 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "frozen_json.h"
+
+// JSON compiled into the executable, for defaults that should cost no I/O at startup.
+//
+// EmbeddedJson holds JSON text and checks its syntax while compiling: a typo in an embedded
+// document fails the build with a call to NotValidJson() in the error. Parse() still has to
+// build the DOM at runtime.
+//
+//     constexpr EmbeddedJson kDefaults(R"json({ "port": 8080, "hosts": ["a", "b"] })json");
+//
+// EmbeddedFrozenJson holds a FrozenDocument image instead and costs no parsing either: Root()
+// reads the static bytes in place. The image comes from tools/embed_json.cpp, run as a
+// pre-build step, which validates the source file and writes a header with the bytes:
+//
+//     embed_json defaults.json defaults.frozen.h kDefaultsImage
+//
+//     #include "defaults.frozen.h"
+//     constexpr EmbeddedFrozenJson kDefaults(kDefaultsImage);
+//     int port = kDefaults.Root().value("port", 80);
+//
+// The constructor checks the image header at compile time. Compile-time text validation runs
+// into the compiler's constexpr step limit (/constexpr:steps) for large documents, which is
+// one more reason to freeze those.
+class EmbeddedJson
+{
+public:
+	template <size_t N>
+	consteval EmbeddedJson(const char (&text)[N])
+		: EmbeddedJson(std::string_view(text, N > 0 && text[N - 1] == '\0' ? N - 1 : N))
+	{
+	}
+
+	consteval explicit EmbeddedJson(std::string_view text)
+		: m_Text(text)
+	{
+		if (!IsValid(text)) {
+			NotValidJson();
+		}
+	}
+
+	constexpr std::string_view Text() const { return m_Text; }
+	nlohmann::json Parse() const { return nlohmann::json::parse(m_Text); }
+
+	// RFC 8259 syntax, UTF-8 and surrogate pairs included, nested at most kMaxDepth deep
+	static constexpr bool IsValid(std::string_view text)
+	{
+		size_t position = 0;
+		if (!ParseValue(text, position, 0)) {
+			return false;
+		}
+		SkipSpace(text, position);
+		return position == text.size();
+	}
+
+	// Writes a header defining symbol as the bytes of value: a char array for EmbeddedJson,
+	// or with frozen an unsigned char FrozenDocument image for EmbeddedFrozenJson
+	static bool GenerateHeader(const nlohmann::json& value, const std::string& symbol, bool frozen, std::string& header,
+		std::string* error = nullptr);
+
+	static constexpr size_t kMaxDepth = 128;
+
+private:
+	// Deliberately not constexpr, reaching it while compiling is the error
+	static void NotValidJson() {}
+
+	static constexpr void SkipSpace(std::string_view text, size_t& position)
+	{
+		while (position < text.size()
+			&& (text[position] == ' ' || text[position] == '\t' || text[position] == '\n' || text[position] == '\r')) {
+			++position;
+		}
+	}
+
+	static constexpr bool Literal(std::string_view text, size_t& position, std::string_view literal)
+	{
+		if (text.substr(position, literal.size()) != literal) {
+			return false;
+		}
+		position += literal.size();
+		return true;
+	}
+
+	static constexpr bool ParseValue(std::string_view text, size_t& position, size_t depth)
+	{
+		SkipSpace(text, position);
+		if (position >= text.size() || depth >= kMaxDepth) {
+			return false;
+		}
+		switch (text[position]) {
+		case '{':
+		case '[': {
+			const bool object = text[position++] == '{';
+			const char close = object ? '}' : ']';
+			SkipSpace(text, position);
+			if (position < text.size() && text[position] == close) {
+				++position;
+				return true;
+			}
+			for (;;) {
+				if (object) {
+					SkipSpace(text, position);
+					if (!ParseString(text, position)) {
+						return false;
+					}
+					SkipSpace(text, position);
+					if (position >= text.size() || text[position++] != ':') {
+						return false;
+					}
+				}
+				if (!ParseValue(text, position, depth + 1)) {
+					return false;
+				}
+				SkipSpace(text, position);
+				if (position >= text.size()) {
+					return false;
+				}
+				const char next = text[position++];
+				if (next == close) {
+					return true;
+				}
+				if (next != ',') {
+					return false;
+				}
+			}
+		}
+		case '"': return ParseString(text, position);
+		case 't': return Literal(text, position, "true");
+		case 'f': return Literal(text, position, "false");
+		case 'n': return Literal(text, position, "null");
+		default: return ParseNumber(text, position);
+		}
+	}
+
+	static constexpr bool ParseNumber(std::string_view text, size_t& position)
+	{
+		auto digits = [&]() {
+			const size_t start = position;
+			while (position < text.size() && text[position] >= '0' && text[position] <= '9') {
+				++position;
+			}
+			return position - start;
+		};
+
+		if (position < text.size() && text[position] == '-') {
+			++position;
+		}
+		if (position < text.size() && text[position] == '0') {
+			++position;
+		}
+		else if (digits() == 0) {
+			return false;
+		}
+		if (position < text.size() && text[position] == '.') {
+			++position;
+			if (digits() == 0) {
+				return false;
+			}
+		}
+		if (position < text.size() && (text[position] == 'e' || text[position] == 'E')) {
+			++position;
+			if (position < text.size() && (text[position] == '+' || text[position] == '-')) {
+				++position;
+			}
+			if (digits() == 0) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static constexpr int Hex(char c)
+	{
+		if (c >= '0' && c <= '9') return c - '0';
+		if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+		if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+		return -1;
+	}
+
+	// Reads the four digits of a \u escape, -1 when they are not hex
+	static constexpr int32_t Escape(std::string_view text, size_t& position)
+	{
+		if (text.substr(position, 2) != "\\u" || position + 6 > text.size()) {
+			return -1;
+		}
+		int32_t code = 0;
+		for (size_t i = position + 2; i < position + 6; ++i) {
+			const int digit = Hex(text[i]);
+			if (digit < 0) {
+				return -1;
+			}
+			code = code * 16 + digit;
+		}
+		position += 6;
+		return code;
+	}
+
+	static constexpr bool ParseString(std::string_view text, size_t& position)
+	{
+		if (position >= text.size() || text[position] != '"') {
+			return false;
+		}
+		++position;
+		while (position < text.size()) {
+			const unsigned char c = static_cast<unsigned char>(text[position]);
+			if (c == '"') {
+				++position;
+				return true;
+			}
+			if (c < 0x20) {
+				return false;
+			}
+			if (c == '\\') {
+				if (position + 1 >= text.size()) {
+					return false;
+				}
+				if (text[position + 1] != 'u') {
+					if (std::string_view("\"\\/bfnrt").find(text[position + 1]) == std::string_view::npos) {
+						return false;
+					}
+					position += 2;
+					continue;
+				}
+				// A high surrogate needs its low half right after, a low one alone is invalid
+				const int32_t code = Escape(text, position);
+				if (code < 0 || (code >= 0xDC00 && code <= 0xDFFF)) {
+					return false;
+				}
+				if (code >= 0xD800 && code <= 0xDBFF) {
+					const int32_t low = Escape(text, position);
+					if (low < 0xDC00 || low > 0xDFFF) {
+						return false;
+					}
+				}
+				continue;
+			}
+			if (c < 0x80) {
+				++position;
+				continue;
+			}
+
+			// Shortest-form UTF-8 without surrogates, as in Encoding::ValidateUtf8
+			size_t continuation = 0;
+			unsigned char low = 0x80, high = 0xBF;
+			if (c >= 0xC2 && c <= 0xDF) continuation = 1;
+			else if (c == 0xE0) { continuation = 2; low = 0xA0; }
+			else if (c == 0xED) { continuation = 2; high = 0x9F; }
+			else if (c >= 0xE1 && c <= 0xEF) continuation = 2;
+			else if (c == 0xF0) { continuation = 3; low = 0x90; }
+			else if (c == 0xF4) { continuation = 3; high = 0x8F; }
+			else if (c >= 0xF1 && c <= 0xF3) continuation = 3;
+			else return false;
+
+			if (position + continuation >= text.size()) {
+				return false;
+			}
+			for (size_t i = 1; i <= continuation; ++i) {
+				const unsigned char byte = static_cast<unsigned char>(text[position + i]);
+				if (byte < (i == 1 ? low : 0x80) || byte > (i == 1 ? high : 0xBF)) {
+					return false;
+				}
+			}
+			position += continuation + 1;
+		}
+		return false;
+	}
+
+	std::string_view m_Text;
+};
+
+class EmbeddedFrozenJson
+{
+public:
+	template <size_t N>
+	consteval EmbeddedFrozenJson(const unsigned char (&image)[N])
+		: m_Data(image), m_Size(N)
+	{
+		if (!IsImage(image, N)) {
+			NotAFrozenImage();
+		}
+	}
+
+	// Reads the image in place, the values stay valid for the life of the program
+	FrozenValue Root() const;
+	nlohmann::json ToJson() const { return Root().ToJson(); }
+	const unsigned char* Data() const { return m_Data; }
+	size_t Size() const { return m_Size; }
+
+private:
+	static void NotAFrozenImage() {}
+
+	static constexpr uint64_t Read(const unsigned char* data, size_t offset, size_t bytes)
+	{
+		uint64_t value = 0;
+		for (size_t i = bytes; i-- > 0;) {
+			value = (value << 8) | data[offset + i];
+		}
+		return value;
+	}
+
+	// The same header checks FrozenDocument::FromMemoryTrusted makes at runtime
+	static constexpr bool IsImage(const unsigned char* data, size_t size)
+	{
+		constexpr size_t kHeaderSize = 24;
+		if (size < kHeaderSize || size > UINT32_MAX) {
+			return false;
+		}
+		const uint64_t root = Read(data, 16, 4);
+		return data[0] == 'F' && data[1] == 'R' && data[2] == 'Z' && data[3] == 'J'
+			&& Read(data, 4, 2) == FrozenDocument::kVersion && Read(data, 6, 2) == kHeaderSize
+			&& Read(data, 8, 8) == size && root >= kHeaderSize && root % 4 == 0 && root + 4 <= size;
+	}
+
+	const unsigned char* m_Data;
+	size_t m_Size;
+};
@@ -0,0 +1,642 @@
+#include "frozen_json.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+	using json = nlohmann::json;
+
+	enum class Tag : uint32_t
+	{
+		Null = 1,
+		False,
+		True,
+		Integer,
+		Unsigned,
+		Float,
+		String,
+		Array,
+		Object
+	};
+
+	struct Header
+	{
+		char magic[4];
+		uint16_t version;
+		uint16_t headerSize;
+		uint64_t size;
+		uint32_t root;
+		uint32_t reserved;
+	};
+	static_assert(sizeof(Header) == 24, "the frozen header layout is part of the file format");
+
+	constexpr char kMagic[4] = { 'F', 'R', 'Z', 'J' };
+	// A manifest is "FRZM\n" and the file name of the current image next to it
+	constexpr char kManifestMagic[5] = { 'F', 'R', 'Z', 'M', '\n' };
+	constexpr size_t kManifestMaxSize = 4096;
+
+	// Reads at most maxSize bytes without mapping, so the file stays replaceable
+	bool ReadPrefix(const fs::path& path, size_t maxSize, std::string& content, std::string& error)
+	{
+		HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			error = Utilities::Stringify("Could not open ", path.string(), ": ", Utilities::GetLastErrorString());
+			return false;
+		}
+		content.resize(maxSize);
+		DWORD read = 0;
+		const bool ok = ReadFile(file, content.data(), static_cast<DWORD>(maxSize), &read, nullptr) != 0;
+		if (!ok) {
+			error = Utilities::Stringify("Could not read ", path.string(), ": ", Utilities::GetLastErrorString());
+		}
+		CloseHandle(file);
+		content.resize(ok ? read : 0);
+		return ok;
+	}
+
+	// The image a path refers to: the path itself for a bare image, otherwise the one its
+	// manifest names
+	bool ResolveImage(const std::string& path, fs::path& image, std::string& error)
+	{
+		std::string content;
+		if (!ReadPrefix(fs::path(path), kManifestMaxSize, content, error)) {
+			return false;
+		}
+		if (content.size() >= sizeof(kMagic) && std::memcmp(content.data(), kMagic, sizeof(kMagic)) == 0) {
+			image = fs::path(path);
+			return true;
+		}
+		if (content.size() <= sizeof(kManifestMagic) || std::memcmp(content.data(), kManifestMagic, sizeof(kManifestMagic)) != 0) {
+			error = Utilities::Stringify(path, " is neither a frozen json image nor a manifest");
+			return false;
+		}
+
+		std::string name = content.substr(sizeof(kManifestMagic));
+		name.erase(name.find_last_not_of("\r\n") + 1);
+		if (name.empty() || name.find_first_of("/\\") != std::string::npos) {
+			error = Utilities::Stringify("the manifest ", path, " names no image");
+			return false;
+		}
+		image = fs::path(path).parent_path() / Utilities::StringToWString(name);
+		return true;
+	}
+
+	// Images come from files and may sit at any address, every read goes through memcpy
+	template <typename T>
+	T Load(const char* data, uint64_t offset)
+	{
+		T value;
+		std::memcpy(&value, data + offset, sizeof(T));
+		return value;
+	}
+
+	Tag NodeTag(const char* data, uint32_t offset)
+	{
+		return static_cast<Tag>(Load<uint32_t>(data, offset));
+	}
+
+	std::string_view StringAt(const char* data, uint32_t offset)
+	{
+		return std::string_view(data + offset + 8, Load<uint32_t>(data, offset + 4));
+	}
+
+	class Freezer
+	{
+	public:
+		explicit Freezer(std::string& image) : m_Image(image) {}
+
+		bool Run(const json& root, std::string& error)
+		{
+			m_Image.assign(sizeof(Header), '\0');
+			const uint32_t rootOffset = Emit(root);
+			if (!m_Error.empty()) {
+				error = m_Error;
+				return false;
+			}
+			if (m_Image.size() > UINT32_MAX) {
+				error = "the frozen image would be larger than 4 GiB";
+				return false;
+			}
+
+			Header header = {};
+			std::memcpy(header.magic, kMagic, sizeof(kMagic));
+			header.version = FrozenDocument::kVersion;
+			header.headerSize = sizeof(Header);
+			header.size = m_Image.size();
+			header.root = rootOffset;
+			std::memcpy(m_Image.data(), &header, sizeof(header));
+			return true;
+		}
+
+	private:
+		template <typename T>
+		void Append(const T& value)
+		{
+			m_Image.append(reinterpret_cast<const char*>(&value), sizeof(T));
+		}
+
+		// Starts a node on a 4 byte boundary and returns its offset
+		uint32_t Begin(Tag tag)
+		{
+			m_Image.resize((m_Image.size() + 3) & ~size_t(3), '\0');
+			const uint32_t offset = static_cast<uint32_t>(m_Image.size());
+			Append(static_cast<uint32_t>(tag));
+			return offset;
+		}
+
+		uint32_t Constant(Tag tag, uint32_t& cached)
+		{
+			if (cached == 0) {
+				cached = Begin(tag);
+			}
+			return cached;
+		}
+
+		uint32_t String(const std::string& text)
+		{
+			const auto found = m_Strings.find(text);
+			if (found != m_Strings.end()) {
+				return found->second;
+			}
+			if (text.size() > UINT32_MAX) {
+				m_Error = "a string is longer than 4 GiB";
+				return 0;
+			}
+			const uint32_t offset = Begin(Tag::String);
+			Append(static_cast<uint32_t>(text.size()));
+			m_Image.append(text);
+			m_Image.push_back('\0');
+			m_Strings.emplace(text, offset);
+			return offset;
+		}
+
+		// Children go out first, so every offset a node stores points backwards
+		uint32_t Emit(const json& value)
+		{
+			if (!m_Error.empty() || m_Image.size() > UINT32_MAX) {
+				return 0;
+			}
+
+			switch (value.type()) {
+			case json::value_t::null:
+				return Constant(Tag::Null, m_Null);
+			case json::value_t::boolean:
+				return value.get<bool>() ? Constant(Tag::True, m_True) : Constant(Tag::False, m_False);
+			case json::value_t::number_integer: {
+				const uint32_t offset = Begin(Tag::Integer);
+				Append(value.get<int64_t>());
+				return offset;
+			}
+			case json::value_t::number_unsigned: {
+				const uint32_t offset = Begin(Tag::Unsigned);
+				Append(value.get<uint64_t>());
+				return offset;
+			}
+			case json::value_t::number_float: {
+				const uint32_t offset = Begin(Tag::Float);
+				Append(value.get<double>());
+				return offset;
+			}
+			case json::value_t::string:
+				return String(value.get_ref<const std::string&>());
+			case json::value_t::array: {
+				std::vector<uint32_t> children;
+				children.reserve(value.size());
+				for (const json& element : value) {
+					children.push_back(Emit(element));
+				}
+				const uint32_t offset = Begin(Tag::Array);
+				Append(static_cast<uint32_t>(children.size()));
+				m_Image.append(reinterpret_cast<const char*>(children.data()), children.size() * sizeof(uint32_t));
+				return offset;
+			}
+			case json::value_t::object: {
+				// nlohmann::json keeps members in a std::map, they arrive sorted by key bytes
+				std::vector<uint32_t> members;
+				members.reserve(value.size() * 2);
+				for (const auto& [key, member] : value.items()) {
+					members.push_back(String(key));
+					members.push_back(Emit(member));
+				}
+				const uint32_t offset = Begin(Tag::Object);
+				Append(static_cast<uint32_t>(value.size()));
+				m_Image.append(reinterpret_cast<const char*>(members.data()), members.size() * sizeof(uint32_t));
+				return offset;
+			}
+			default:
+				m_Error = Utilities::Stringify(value.type_name(), " values cannot be frozen");
+				return 0;
+			}
+		}
+
+		std::string& m_Image;
+		std::string m_Error;
+		std::unordered_map<std::string, uint32_t> m_Strings;
+		uint32_t m_Null = 0;
+		uint32_t m_False = 0;
+		uint32_t m_True = 0;
+	};
+}
+
+nlohmann::json::value_t FrozenValue::type() const
+{
+	if (!m_Data) {
+		return json::value_t::discarded;
+	}
+	switch (NodeTag(m_Data, m_Offset)) {
+	case Tag::Null: return json::value_t::null;
+	case Tag::False:
+	case Tag::True: return json::value_t::boolean;
+	case Tag::Integer: return json::value_t::number_integer;
+	case Tag::Unsigned: return json::value_t::number_unsigned;
+	case Tag::Float: return json::value_t::number_float;
+	case Tag::String: return json::value_t::string;
+	case Tag::Array: return json::value_t::array;
+	case Tag::Object: return json::value_t::object;
+	default: return json::value_t::discarded;
+	}
+}
+
+size_t FrozenValue::size() const
+{
+	const json::value_t t = type();
+	return t == json::value_t::array || t == json::value_t::object ? Load<uint32_t>(m_Data, m_Offset + 4) : 0;
+}
+
+FrozenValue FrozenValue::operator[](std::string_view key) const
+{
+	if (!is_object()) {
+		return FrozenValue();
+	}
+
+	size_t low = 0;
+	size_t high = size();
+	while (low < high) {
+		const size_t middle = low + (high - low) / 2;
+		const int order = MemberKey(middle).compare(key);
+		if (order == 0) {
+			return MemberValue(middle);
+		}
+		if (order < 0) low = middle + 1;
+		else high = middle;
+	}
+	return FrozenValue();
+}
+
+FrozenValue FrozenValue::operator[](size_t index) const
+{
+	if (!is_array() || index >= size()) {
+		return FrozenValue();
+	}
+	return FrozenValue(m_Data, Load<uint32_t>(m_Data, m_Offset + 8 + uint64_t(index) * 4));
+}
+
+FrozenValue FrozenValue::at(std::string_view key) const
+{
+	FrozenValue found = (*this)[key];
+	if (found.is_discarded()) {
+		throw std::out_of_range(Utilities::Stringify("key '", key, "' not found"));
+	}
+	return found;
+}
+
+FrozenValue FrozenValue::at(size_t index) const
+{
+	FrozenValue found = (*this)[index];
+	if (found.is_discarded()) {
+		throw std::out_of_range(Utilities::Stringify("index ", index, " is out of range"));
+	}
+	return found;
+}
+
+nlohmann::json FrozenValue::ToJson() const
+{
+	switch (type()) {
+	case json::value_t::null: return nullptr;
+	case json::value_t::boolean: return Boolean();
+	case json::value_t::number_integer: return Integer();
+	case json::value_t::number_unsigned: return Unsigned();
+	case json::value_t::number_float: return Float();
+	case json::value_t::string: return std::string(String());
+	case json::value_t::array: {
+		json array = json::array();
+		array.get_ref<json::array_t&>().reserve(size());
+		elements([&](const FrozenValue& element) { array.push_back(element.ToJson()); });
+		return array;
+	}
+	case json::value_t::object: {
+		json object = json::object();
+		items([&](std::string_view key, const FrozenValue& member) { object.emplace(std::string(key), member.ToJson()); });
+		return object;
+	}
+	default:
+		return json(json::value_t::discarded);
+	}
+}
+
+bool FrozenValue::Boolean() const
+{
+	return NodeTag(m_Data, m_Offset) == Tag::True;
+}
+
+int64_t FrozenValue::Integer() const
+{
+	return Load<int64_t>(m_Data, m_Offset + 4);
+}
+
+uint64_t FrozenValue::Unsigned() const
+{
+	return Load<uint64_t>(m_Data, m_Offset + 4);
+}
+
+double FrozenValue::Float() const
+{
+	return Load<double>(m_Data, m_Offset + 4);
+}
+
+std::string_view FrozenValue::String() const
+{
+	return StringAt(m_Data, m_Offset);
+}
+
+std::string_view FrozenValue::MemberKey(size_t index) const
+{
+	return StringAt(m_Data, Load<uint32_t>(m_Data, m_Offset + 8 + uint64_t(index) * 8));
+}
+
+FrozenValue FrozenValue::MemberValue(size_t index) const
+{
+	return FrozenValue(m_Data, Load<uint32_t>(m_Data, m_Offset + 12 + uint64_t(index) * 8));
+}
+
+bool FrozenDocument::Open(const std::string& path, std::string* error)
+{
+	return OpenFile(path, true, error);
+}
+
+bool FrozenDocument::OpenTrusted(const std::string& path, std::string* error)
+{
+	return OpenFile(path, false, error);
+}
+
+bool FrozenDocument::FromMemory(const void* data, size_t size, std::string* error)
+{
+	Close();
+	return Attach(static_cast<const char*>(data), size, true, error);
+}
+
+bool FrozenDocument::FromMemoryTrusted(const void* data, size_t size, std::string* error)
+{
+	Close();
+	return Attach(static_cast<const char*>(data), size, false, error);
+}
+
+void FrozenDocument::Close()
+{
+	m_File.Close();
+	m_Data = nullptr;
+	m_Size = 0;
+	m_Root = 0;
+}
+
+FrozenValue FrozenDocument::Root() const
+{
+	return m_Data ? FrozenValue(m_Data, m_Root) : FrozenValue();
+}
+
+bool FrozenDocument::Freeze(const nlohmann::json& value, std::string& image, std::string* error)
+{
+	std::string message;
+	Freezer freezer(image);
+	if (!freezer.Run(value, message)) {
+		image.clear();
+		if (error) *error = message;
+		else Logger::Error("Failed freezing json: ", message);
+		return false;
+	}
+	return true;
+}
+
+bool FrozenDocument::Save(const nlohmann::json& value, const std::string& path, FsyncPolicy fsync, std::string* error)
+{
+	auto fail = [&](const std::string& message) {
+		if (error) *error = message;
+		else Logger::Error("Failed saving ", path, ": ", message);
+		return false;
+	};
+
+	std::string image;
+	std::string message;
+	if (!Freeze(value, image, &message)) {
+		return fail(message);
+	}
+
+	// Every save gets a fresh image name, so no file that a reader may have mapped is ever
+	// replaced. Only the small manifest, which readers never map, is renamed over.
+	const fs::path target(path);
+	const std::wstring prefix = target.filename().wstring() + L".v";
+	FILETIME now;
+	GetSystemTimeAsFileTime(&now);
+	const uint64_t stamp = (static_cast<uint64_t>(now.dwHighDateTime) << 32) | now.dwLowDateTime;
+	const std::wstring name = prefix + std::to_wstring(stamp) + L"-" + std::to_wstring(GetCurrentProcessId());
+	const fs::path imagePath = target.parent_path() / name;
+
+	if (!Utilities::AtomicWriteFile(imagePath.string(), image, fsync, &message)) {
+		return fail(message);
+	}
+	std::string manifest(kManifestMagic, sizeof(kManifestMagic));
+	manifest += Utilities::WStringToString(name);
+	manifest.push_back('\n');
+	if (!Utilities::AtomicWriteFile(path, manifest, fsync, &message)) {
+		DeleteFileW(imagePath.c_str());
+		return fail(message);
+	}
+
+	// Older images go once nothing maps them. One still open in some process either refuses
+	// the delete or lingers until it is closed, and a later save sweeps it up.
+	std::error_code ec;
+	const fs::path directory = target.has_parent_path() ? target.parent_path() : fs::path(".");
+	for (fs::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec)) {
+		const std::wstring entry = it->path().filename().wstring();
+		if (entry != name && entry.compare(0, prefix.size(), prefix) == 0 && entry.find(L".tmp") == std::wstring::npos) {
+			DeleteFileW(it->path().c_str());
+		}
+	}
+	return true;
+}
+
+bool FrozenDocument::OpenFile(const std::string& path, bool validate, std::string* error)
+{
+	Close();
+
+	// A save may sweep the image between reading the manifest and opening it, the manifest
+	// then already names a newer one
+	std::string message;
+	for (int attempt = 0; attempt < 3; ++attempt) {
+		fs::path image;
+		if (!ResolveImage(path, image, message)) {
+			break;
+		}
+		if (m_File.Open(image.string(), &message)) {
+			if (!Attach(m_File.Data(), m_File.Size(), validate, error)) {
+				Close();
+				return false;
+			}
+			return true;
+		}
+	}
+
+	if (error) *error = message;
+	else Logger::Error("Failed opening frozen json: ", message);
+	return false;
+}
+
+bool FrozenDocument::Attach(const char* data, size_t size, bool validate, std::string* error)
+{
+	auto fail = [&](const std::string& message) {
+		if (error) *error = message;
+		else Logger::Error("Failed opening frozen json: ", message);
+		return false;
+	};
+
+	if (size < sizeof(Header)) {
+		return fail("the image is smaller than its header");
+	}
+	const Header header = Load<Header>(data, 0);
+	if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+		return fail("the image does not start with the frozen json magic");
+	}
+	if (header.version != kVersion) {
+		return fail(Utilities::Stringify("unsupported frozen json version ", header.version, ", expected ", kVersion));
+	}
+	if (header.headerSize != sizeof(Header) || header.size != size || size > UINT32_MAX) {
+		return fail(Utilities::Stringify("the image is ", size, " bytes but its header says ", header.size));
+	}
+	if (header.root < sizeof(Header) || header.root % 4 != 0 || uint64_t(header.root) + 4 > size) {
+		return fail("the root offset is out of range");
+	}
+
+	m_Data = data;
+	m_Size = size;
+	m_Root = header.root;
+
+	std::string message;
+	if (validate && !ValidateNodes(message)) {
+		m_Data = nullptr;
+		m_Size = 0;
+		m_Root = 0;
+		return fail(message);
+	}
+	return true;
+}
+
+bool FrozenDocument::ValidateNodes(std::string& error) const
+{
+	// One bit per 4 byte slot, shared strings and constants are checked once
+	std::vector<uint64_t> checked((m_Size / 4 + 63) / 64, 0);
+	auto markChecked = [&](uint32_t offset) {
+		const size_t slot = offset / 4;
+		const uint64_t bit = uint64_t(1) << (slot % 64);
+		const bool seen = (checked[slot / 64] & bit) != 0;
+		checked[slot / 64] |= bit;
+		return seen;
+	};
+
+	auto fail = [&](uint32_t offset, const char* message) {
+		error = Utilities::Stringify("node at offset ", offset, " ", message);
+		return false;
+	};
+	auto inBounds = [&](uint32_t offset) { return offset >= sizeof(Header) && offset % 4 == 0 && uint64_t(offset) + 8 <= m_Size; };
+	auto checkString = [&](uint32_t offset) {
+		const uint64_t length = Load<uint32_t>(m_Data, offset + 4);
+		if (offset + 8 + length + 1 > m_Size || m_Data[offset + 8 + length] != '\0') {
+			return fail(offset, "has a string running past the end of the image");
+		}
+		if (!Utilities::ValidateUtf8(std::string_view(m_Data + offset + 8, static_cast<size_t>(length)))) {
+			return fail(offset, "holds invalid UTF-8");
+		}
+		return true;
+	};
+
+	std::vector<uint32_t> pending{ m_Root };
+	while (!pending.empty()) {
+		const uint32_t offset = pending.back();
+		pending.pop_back();
+		// Constants are only 4 bytes, everything else has at least a second word
+		if (offset < sizeof(Header) || offset % 4 != 0 || uint64_t(offset) + 4 > m_Size) {
+			return fail(offset, "is out of bounds");
+		}
+		if (markChecked(offset)) {
+			continue;
+		}
+
+		const Tag tag = NodeTag(m_Data, offset);
+		switch (tag) {
+		case Tag::Null:
+		case Tag::False:
+		case Tag::True:
+			break;
+		case Tag::Integer:
+		case Tag::Unsigned:
+		case Tag::Float:
+			if (uint64_t(offset) + 12 > m_Size) {
+				return fail(offset, "has a number running past the end of the image");
+			}
+			break;
+		case Tag::String:
+			if (!inBounds(offset)) {
+				return fail(offset, "is out of bounds");
+			}
+			if (!checkString(offset)) {
+				return false;
+			}
+			break;
+		case Tag::Array:
+		case Tag::Object: {
+			if (!inBounds(offset)) {
+				return fail(offset, "is out of bounds");
+			}
+			const uint64_t count = Load<uint32_t>(m_Data, offset + 4);
+			const uint64_t width = tag == Tag::Array ? 4 : 8;
+			if (offset + 8 + count * width > m_Size) {
+				return fail(offset, "has children running past the end of the image");
+			}
+
+			std::string_view previousKey;
+			for (uint64_t i = 0; i < count; ++i) {
+				const uint64_t entry = offset + 8 + i * width;
+				if (tag == Tag::Object) {
+					// Keys are checked right here, the binary search depends on their order
+					const uint32_t key = Load<uint32_t>(m_Data, entry);
+					if (key >= offset || !inBounds(key) || NodeTag(m_Data, key) != Tag::String) {
+						return fail(offset, "has a key that is not an earlier string node");
+					}
+					if (!markChecked(key) && !checkString(key)) {
+						return false;
+					}
+					const std::string_view name = StringAt(m_Data, key);
+					if (i > 0 && !(previousKey < name)) {
+						return fail(offset, "has keys out of order");
+					}
+					previousKey = name;
+				}
+
+				// Children always come first, which rules out cycles
+				const uint32_t child = Load<uint32_t>(m_Data, entry + width - 4);
+				if (child >= offset) {
+					return fail(offset, "has a child that does not precede it");
+				}
+				pending.push_back(child);
+			}
+			break;
+		}
+		default:
+			return fail(offset, "has an unknown type tag");
+		}
+	}
+	return true;
+}
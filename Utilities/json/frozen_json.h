@@ -0,0 +1,184 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "../utils/utilities.h"
+#include "../io/mapped_file.h"
+
+class FrozenDocument;
+
+// Read-only handle to one value of a FrozenDocument, decoded in place from the image. Missing
+// keys and indices yield a discarded value instead of throwing, the same as LazyJsonValue.
+// The document must outlive its values.
+class FrozenValue
+{
+public:
+	FrozenValue() = default;
+
+	nlohmann::json::value_t type() const;
+	bool is_discarded() const { return m_Data == nullptr; }
+	bool is_object() const { return type() == nlohmann::json::value_t::object; }
+	bool is_array() const { return type() == nlohmann::json::value_t::array; }
+	bool is_string() const { return type() == nlohmann::json::value_t::string; }
+	bool is_boolean() const { return type() == nlohmann::json::value_t::boolean; }
+	bool is_null() const { return type() == nlohmann::json::value_t::null; }
+	bool is_number() const
+	{
+		const nlohmann::json::value_t t = type();
+		return t == nlohmann::json::value_t::number_integer || t == nlohmann::json::value_t::number_unsigned ||
+			t == nlohmann::json::value_t::number_float;
+	}
+
+	// Number of members or elements, 0 for scalars
+	size_t size() const;
+	bool contains(std::string_view key) const { return !(*this)[key].is_discarded(); }
+
+	// Binary search over the sorted keys
+	FrozenValue operator[](std::string_view key) const;
+	FrozenValue operator[](size_t index) const;
+	FrozenValue operator[](const char* key) const { return (*this)[std::string_view(key)]; }
+	FrozenValue operator[](int index) const { return (*this)[static_cast<size_t>(index)]; }
+
+	// Like operator[] but throws std::out_of_range when the value is missing
+	FrozenValue at(std::string_view key) const;
+	FrozenValue at(size_t index) const;
+
+	// Calls fn(key, value) for every member of an object, in key order
+	template <typename Fn>
+	void items(Fn&& fn) const
+	{
+		if (is_object()) {
+			for (size_t i = 0, count = size(); i < count; ++i) {
+				fn(MemberKey(i), MemberValue(i));
+			}
+		}
+	}
+
+	// Calls fn(value) for every element of an array
+	template <typename Fn>
+	void elements(Fn&& fn) const
+	{
+		if (is_array()) {
+			for (size_t i = 0, count = size(); i < count; ++i) {
+				fn((*this)[i]);
+			}
+		}
+	}
+
+	// Copies this value and everything below it into a DOM
+	nlohmann::json ToJson() const;
+
+	// Scalars are read straight from the image, std::string_view points into it and lives as
+	// long as the document. Other types go through ToJson(), mismatches throw nlohmann's
+	// type_error.
+	template <typename T>
+	T get() const
+	{
+		const nlohmann::json::value_t t = type();
+		if constexpr (std::is_same_v<T, std::string_view>) {
+			if (t != nlohmann::json::value_t::string) {
+				throw nlohmann::json::type_error::create(302, Utilities::Stringify("type must be string, but is ", nlohmann::json(t).type_name()), nullptr);
+			}
+			return String();
+		}
+		else {
+			if constexpr (std::is_same_v<T, bool>) {
+				if (t == nlohmann::json::value_t::boolean) return Boolean();
+			}
+			else if constexpr (std::is_arithmetic_v<T>) {
+				if (t == nlohmann::json::value_t::number_integer) return static_cast<T>(Integer());
+				if (t == nlohmann::json::value_t::number_unsigned) return static_cast<T>(Unsigned());
+				if (t == nlohmann::json::value_t::number_float) return static_cast<T>(Float());
+			}
+			else if constexpr (std::is_same_v<T, std::string>) {
+				if (t == nlohmann::json::value_t::string) return std::string(String());
+			}
+			return ToJson().template get<T>();
+		}
+	}
+
+	template <typename T>
+	T value(std::string_view key, const T& defaultValue) const
+	{
+		FrozenValue member = (*this)[key];
+		return member.is_discarded() ? defaultValue : member.get<T>();
+	}
+
+	std::string value(std::string_view key, const char* defaultValue) const { return value<std::string>(key, defaultValue); }
+
+private:
+	friend class FrozenDocument;
+
+	FrozenValue(const char* data, uint32_t offset) : m_Data(data), m_Offset(offset) {}
+
+	bool Boolean() const;
+	int64_t Integer() const;
+	uint64_t Unsigned() const;
+	double Float() const;
+	std::string_view String() const;
+	std::string_view MemberKey(size_t index) const;
+	FrozenValue MemberValue(size_t index) const;
+
+	// Start of the image and the offset of this value's node in it
+	const char* m_Data = nullptr;
+	uint32_t m_Offset = 0;
+};
+
+// A JSON document compiled into a flat, offset-based image that is read in place: no parsing,
+// no allocation, and a mapped file's pages are shared by every process that opens it.
+//
+// The image is a 24 byte header (magic "FRZJ", version, total size, root offset) followed by
+// nodes in post order, every child before its parent. A node is a 32 bit type tag followed by
+// its payload: 8 bytes for numbers, length, bytes and a NUL for strings, a count and child
+// offsets for arrays, and a count and sorted (key, value) offset pairs for objects. Strings are
+// interned, so a key used by a thousand objects is stored once. Images are little endian and
+// limited to 4 GiB.
+class FrozenDocument
+{
+public:
+	static constexpr uint16_t kVersion = 1;
+
+	FrozenDocument() = default;
+
+	FrozenDocument(const FrozenDocument&) = delete;
+	FrozenDocument& operator=(const FrozenDocument&) = delete;
+	FrozenDocument(FrozenDocument&&) noexcept = default;
+	FrozenDocument& operator=(FrozenDocument&&) noexcept = default;
+
+	// Maps the image and validates every node, O(size). A document that opened cannot read out
+	// of bounds, loop, or hand out invalid UTF-8 whatever bytes the file holds. path is either
+	// a manifest written by Save or a bare image.
+	bool Open(const std::string& path, std::string* error = nullptr);
+	// Maps the image and checks only the header, O(1). For images this program wrote itself.
+	bool OpenTrusted(const std::string& path, std::string* error = nullptr);
+	// Use an image owned by the caller, which has to stay alive as long as the document
+	bool FromMemory(const void* data, size_t size, std::string* error = nullptr);
+	bool FromMemoryTrusted(const void* data, size_t size, std::string* error = nullptr);
+	void Close();
+
+	bool IsOpen() const { return m_Data != nullptr; }
+	// Discarded when nothing is open
+	FrozenValue Root() const;
+	size_t Size() const { return m_Size; }
+
+	// Compiles value into an image. Fails on binary values and on images over 4 GiB.
+	static bool Freeze(const nlohmann::json& value, std::string& image, std::string* error = nullptr);
+	// Freezes value into a new image file next to path, "<name>.v<stamp>-<pid>", then switches
+	// path, a small manifest naming the current image, over to it and deletes older images
+	// that are no longer mapped. Windows refuses to replace a file while any process maps it,
+	// so the image an open document reads is never overwritten: open documents keep their
+	// version and see a new one by opening path again. One writer per path at a time.
+	static bool Save(const nlohmann::json& value, const std::string& path, FsyncPolicy fsync = FsyncPolicy::Data, std::string* error = nullptr);
+
+private:
+	bool OpenFile(const std::string& path, bool validate, std::string* error);
+	bool Attach(const char* data, size_t size, bool validate, std::string* error);
+	bool ValidateNodes(std::string& error) const;
+
+	MappedFile m_File;
+	const char* m_Data = nullptr;
+	size_t m_Size = 0;
+	uint32_t m_Root = 0;
+};
@@ -0,0 +1,190 @@
+#include "json_cache.h"
+#include "json_schema.h"
+
+JsonCache& JsonCache::Instance()
+{
+	static JsonCache cache;
+	return cache;
+}
+
+JsonCache::JsonCache(size_t byteBudget)
+	: m_ByteBudget(byteBudget)
+{
+}
+
+std::shared_ptr<const nlohmann::json> JsonCache::Get(const std::string& filename, std::string* error, const JsonLoadOptions& options)
+{
+	std::shared_ptr<const nlohmann::json> document = Load(filename, error, options);
+	if (!document || !options.schema) {
+		return document;
+	}
+
+	// Validated on every lookup rather than cached, a schema is cheap to run next to a parse
+	// and this keeps one entry per file no matter how many schemas it is checked against
+	std::string message;
+	if (!options.schema->Validate(*document, &message)) {
+		if (error) *error = message;
+		else Logger::Error("Failed loading ", filename, " from json: ", message);
+		return nullptr;
+	}
+	return document;
+}
+
+std::shared_ptr<const nlohmann::json> JsonCache::Load(const std::string& filename, std::string* error, const JsonLoadOptions& options)
+{
+	FileStamp stamp;
+	const bool exists = QueryStamp(filename, stamp);
+
+	JsonLoadOptions loadOptions = options;
+	loadOptions.schema = nullptr;
+
+	std::string path;
+	std::string key;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		path = CanonicalPath(filename);
+		key = EntryKey(path, options);
+
+		auto found = m_Entries.find(key);
+		if (found != m_Entries.end()) {
+			if (exists && found->second->stamp == stamp) {
+				++m_Stats.hits;
+				m_Lru.splice(m_Lru.begin(), m_Lru, found->second);
+				return found->second->document;
+			}
+
+			// Stale or gone, drop it before reloading
+			m_Stats.bytes -= static_cast<size_t>(found->second->stamp.size);
+			m_Lru.erase(found->second);
+			m_Entries.erase(found);
+		}
+		++m_Stats.misses;
+	}
+
+	// Parse without holding the lock so other files stay servable meanwhile
+	auto document = std::make_shared<nlohmann::json>();
+	if (!Utilities::LoadFromJson(filename, *document, loadOptions, error)) {
+		return nullptr;
+	}
+	if (!exists) {
+		// The file appeared between the query and the load, stamp it on the next lookup
+		return document;
+	}
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	auto found = m_Entries.find(key);
+	if (found != m_Entries.end()) {
+		// Another thread loaded it concurrently, keep whichever saw the newer file
+		if (found->second->stamp.lastWrite >= stamp.lastWrite) {
+			return document;
+		}
+		m_Stats.bytes -= static_cast<size_t>(found->second->stamp.size);
+		m_Lru.erase(found->second);
+		m_Entries.erase(found);
+	}
+
+	m_Lru.push_front(Entry{ key, path, stamp, document });
+	m_Entries.emplace(key, m_Lru.begin());
+	m_Stats.bytes += static_cast<size_t>(stamp.size);
+	EvictLocked();
+	return document;
+}
+
+void JsonCache::Invalidate(const std::string& filename)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	const std::string path = CanonicalPath(filename);
+	for (auto entry = m_Lru.begin(); entry != m_Lru.end();) {
+		if (entry->path == path) {
+			m_Stats.bytes -= static_cast<size_t>(entry->stamp.size);
+			m_Entries.erase(entry->key);
+			entry = m_Lru.erase(entry);
+		}
+		else {
+			++entry;
+		}
+	}
+}
+
+void JsonCache::Clear()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Lru.clear();
+	m_Entries.clear();
+	m_CanonicalPaths.clear();
+	m_Stats.bytes = 0;
+}
+
+void JsonCache::SetByteBudget(size_t byteBudget)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_ByteBudget = byteBudget;
+	EvictLocked();
+}
+
+JsonCache::Stats JsonCache::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	Stats stats = m_Stats;
+	stats.entries = m_Entries.size();
+	return stats;
+}
+
+bool JsonCache::QueryStamp(const std::string& filename, FileStamp& stamp)
+{
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExW(fs::path(filename).c_str(), GetFileExInfoStandard, &data)) {
+		return false;
+	}
+	stamp.lastWrite = (static_cast<uint64_t>(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+	stamp.size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+	return true;
+}
+
+std::string JsonCache::CanonicalPath(const std::string& filename)
+{
+	// Resolving a path costs several system calls, do it once per absolute spelling. Relative
+	// spellings depend on the working directory and are resolved every time
+	const fs::path path(filename);
+	const bool memoize = path.is_absolute();
+	if (memoize) {
+		auto found = m_CanonicalPaths.find(filename);
+		if (found != m_CanonicalPaths.end()) {
+			return found->second;
+		}
+	}
+
+	std::error_code ec;
+	fs::path canonical = fs::weakly_canonical(path, ec);
+	if (ec) {
+		canonical = fs::absolute(path, ec);
+	}
+	std::string resolved = ec ? filename : canonical.string();
+
+	if (memoize) {
+		// Bounded alongside the entries, a few spellings per cached file are plenty
+		if (m_CanonicalPaths.size() >= 4 * m_Entries.size() + 64) {
+			m_CanonicalPaths.clear();
+		}
+		m_CanonicalPaths.emplace(filename, resolved);
+	}
+	return resolved;
+}
+
+std::string JsonCache::EntryKey(const std::string& path, const JsonLoadOptions& options)
+{
+	// The options that can change the loaded document are part of the key, the schema is not
+	// since Get validates the cached document itself
+	return Utilities::Stringify(path, '|', static_cast<int>(options.format), '|', options.validateUtf8);
+}
+
+void JsonCache::EvictLocked()
+{
+	while (m_Stats.bytes > m_ByteBudget && !m_Lru.empty()) {
+		const Entry& victim = m_Lru.back();
+		m_Stats.bytes -= static_cast<size_t>(victim.stamp.size);
+		m_Entries.erase(victim.key);
+		m_Lru.pop_back();
+		++m_Stats.evictions;
+	}
+}
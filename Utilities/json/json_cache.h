@@ -0,0 +1,72 @@
+#pragma once
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "../utils/utilities.h"
+
+// Process-wide cache of parsed JSON files keyed by canonical path and the load options that
+// shape the document. Every lookup checks the file's last write time and size with one
+// attribute query and re-parses only when they moved. A schema in the options is run against
+// the cached document on every lookup, so a hit never skips validation. Entries are evicted
+// least recently used first once the byte budget, counted in file bytes, is exceeded.
+// Snapshots stay valid after eviction or reload.
+class JsonCache
+{
+public:
+	struct Stats
+	{
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+		size_t entries = 0;
+		size_t bytes = 0;
+	};
+
+	static JsonCache& Instance();
+
+	explicit JsonCache(size_t byteBudget = 256 * 1024 * 1024);
+
+	// nullptr when the file cannot be loaded, the reason goes to *error or the log
+	std::shared_ptr<const nlohmann::json> Get(const std::string& filename, std::string* error = nullptr, const JsonLoadOptions& options = {});
+
+	// Drops the file under every set of load options
+	void Invalidate(const std::string& filename);
+	void Clear();
+
+	void SetByteBudget(size_t byteBudget);
+	Stats GetStats() const;
+
+private:
+	struct FileStamp
+	{
+		uint64_t lastWrite = 0;
+		uint64_t size = 0;
+
+		bool operator==(const FileStamp& other) const { return lastWrite == other.lastWrite && size == other.size; }
+	};
+
+	struct Entry
+	{
+		std::string key;
+		std::string path;
+		FileStamp stamp;
+		std::shared_ptr<const nlohmann::json> document;
+	};
+
+	static bool QueryStamp(const std::string& filename, FileStamp& stamp);
+	std::shared_ptr<const nlohmann::json> Load(const std::string& filename, std::string* error, const JsonLoadOptions& options);
+	std::string CanonicalPath(const std::string& filename);
+	static std::string EntryKey(const std::string& path, const JsonLoadOptions& options);
+	void EvictLocked();
+
+	mutable std::mutex m_Mutex;
+	std::list<Entry> m_Lru;
+	std::unordered_map<std::string, std::list<Entry>::iterator> m_Entries;
+	std::unordered_map<std::string, std::string> m_CanonicalPaths;
+	size_t m_ByteBudget;
+	Stats m_Stats;
+};
@@ -0,0 +1,290 @@
+#include "json_extract.h"
+#include "../io/chunked_reader.h"
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+
+namespace
+{
+	class ExtractSax
+	{
+	public:
+		using json = nlohmann::json;
+
+		ExtractSax(const std::vector<json::json_pointer>& pointers, std::map<std::string, json>& results)
+			: m_Results(results)
+		{
+			std::vector<size_t> all;
+			for (const json::json_pointer& pointer : pointers) {
+				std::vector<std::string> tokens;
+				for (json::json_pointer rest = pointer; !rest.empty(); rest.pop_back()) {
+					tokens.insert(tokens.begin(), rest.back());
+				}
+				all.push_back(m_Targets.size());
+				m_Targets.push_back(Target{ pointer.to_string(), std::move(tokens), false });
+			}
+			m_Remaining = m_Targets.size();
+			m_Candidates.push_back(std::move(all));
+		}
+
+		bool Finished() const { return m_Remaining == 0; }
+		const std::string& Error() const { return m_Error; }
+
+		bool null() { return Scalar(nullptr); }
+		bool boolean(bool value) { return Scalar(value); }
+		bool number_integer(json::number_integer_t value) { return Scalar(value); }
+		bool number_unsigned(json::number_unsigned_t value) { return Scalar(value); }
+		bool number_float(json::number_float_t value, const json::string_t&) { return Scalar(value); }
+		bool string(json::string_t& value) { return Scalar(value); }
+		bool binary(json::binary_t& value) { return Scalar(value); }
+
+		bool start_object(std::size_t length)
+		{
+			if (m_Capture) {
+				++m_CaptureDepth;
+				return m_Capture->start_object(length);
+			}
+			if (BeginCapture()) {
+				m_CaptureDepth = 1;
+				return m_Capture->start_object(length);
+			}
+			PushLevel(false);
+			return true;
+		}
+
+		bool key(json::string_t& value)
+		{
+			if (m_Capture) {
+				return m_Capture->key(value);
+			}
+			SetToken(value);
+			return true;
+		}
+
+		bool end_object()
+		{
+			if (m_Capture) {
+				return m_Capture->end_object() && EndNested();
+			}
+			PopLevel();
+			return true;
+		}
+
+		bool start_array(std::size_t length)
+		{
+			if (m_Capture) {
+				++m_CaptureDepth;
+				return m_Capture->start_array(length);
+			}
+			if (BeginCapture()) {
+				m_CaptureDepth = 1;
+				return m_Capture->start_array(length);
+			}
+			PushLevel(true);
+			return true;
+		}
+
+		bool end_array()
+		{
+			if (m_Capture) {
+				return m_Capture->end_array() && EndNested();
+			}
+			PopLevel();
+			return true;
+		}
+
+		bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception& e)
+		{
+			m_Error = e.what();
+			return false;
+		}
+
+	private:
+		struct Target
+		{
+			std::string pointer;
+			std::vector<std::string> tokens;
+			bool found;
+		};
+
+		struct Level
+		{
+			bool isArray;
+			size_t nextIndex;
+		};
+
+		template <typename T>
+		bool Scalar(T&& value)
+		{
+			if (m_Capture) {
+				return ForwardScalar(std::forward<T>(value));
+			}
+			const size_t target = MatchCurrent();
+			if (target != SIZE_MAX) {
+				m_Results[m_Targets[target].pointer] = json(std::forward<T>(value));
+				return Found(target);
+			}
+			return true;
+		}
+
+		template <typename T>
+		bool ForwardScalar(T&& value)
+		{
+			if constexpr (std::is_same_v<std::decay_t<T>, std::nullptr_t>) return m_Capture->null();
+			else if constexpr (std::is_same_v<std::decay_t<T>, bool>) return m_Capture->boolean(value);
+			else if constexpr (std::is_same_v<std::decay_t<T>, json::number_integer_t>) return m_Capture->number_integer(value);
+			else if constexpr (std::is_same_v<std::decay_t<T>, json::number_unsigned_t>) return m_Capture->number_unsigned(value);
+			else if constexpr (std::is_same_v<std::decay_t<T>, json::number_float_t>) return m_Capture->number_float(value, json::string_t());
+			else if constexpr (std::is_same_v<std::decay_t<T>, json::string_t>) return m_Capture->string(value);
+			else return m_Capture->binary(value);
+		}
+
+		// Advances the array index of the enclosing level before each element
+		void NextElement()
+		{
+			if (!m_Levels.empty() && m_Levels.back().isArray) {
+				SetToken(std::to_string(m_Levels.back().nextIndex++));
+			}
+		}
+
+		size_t MatchCurrent()
+		{
+			NextElement();
+			const size_t depth = m_Path.size();
+			for (size_t candidate : m_Candidates[depth]) {
+				if (!m_Targets[candidate].found && m_Targets[candidate].tokens.size() == depth) {
+					return candidate;
+				}
+			}
+			return SIZE_MAX;
+		}
+
+		bool BeginCapture()
+		{
+			const size_t target = MatchCurrent();
+			if (target == SIZE_MAX) {
+				return false;
+			}
+			m_CaptureTarget = target;
+			m_Capture = std::make_unique<nlohmann::detail::json_sax_dom_parser<json>>(m_Results[m_Targets[target].pointer], false);
+			return true;
+		}
+
+		bool EndNested()
+		{
+			if (--m_CaptureDepth > 0) {
+				return true;
+			}
+			m_Capture.reset();
+			return Found(m_CaptureTarget);
+		}
+
+		bool Found(size_t target)
+		{
+			m_Targets[target].found = true;
+			--m_Remaining;
+
+			// Targets nested below this one were not matched while it was captured, they are
+			// looked up inside the extracted value instead
+			const size_t depth = m_Path.size();
+			const json& value = m_Results[m_Targets[target].pointer];
+			for (size_t candidate : m_Candidates[depth]) {
+				Target& nested = m_Targets[candidate];
+				if (nested.found) {
+					continue;
+				}
+				json::json_pointer relative;
+				for (size_t i = depth; i < nested.tokens.size(); ++i) {
+					relative.push_back(nested.tokens[i]);
+				}
+				if (value.contains(relative)) {
+					m_Results[nested.pointer] = value.at(relative);
+					nested.found = true;
+					--m_Remaining;
+				}
+			}
+
+			// Returning false aborts the parse, nothing else is needed
+			return m_Remaining > 0;
+		}
+
+		void PushLevel(bool isArray)
+		{
+			m_Levels.push_back(Level{ isArray, 0 });
+			m_Path.emplace_back();
+			m_Candidates.emplace_back();
+		}
+
+		void PopLevel()
+		{
+			m_Levels.pop_back();
+			m_Path.pop_back();
+			m_Candidates.pop_back();
+		}
+
+		// Sets the innermost path token and narrows the targets that can still match below it
+		void SetToken(const std::string& token)
+		{
+			const size_t level = m_Path.size();
+			m_Path.back() = token;
+
+			std::vector<size_t>& narrowed = m_Candidates[level];
+			narrowed.clear();
+			for (size_t candidate : m_Candidates[level - 1]) {
+				const Target& target = m_Targets[candidate];
+				if (target.tokens.size() >= level && target.tokens[level - 1] == token) {
+					narrowed.push_back(candidate);
+				}
+			}
+		}
+
+		std::map<std::string, json>& m_Results;
+		std::vector<Target> m_Targets;
+		size_t m_Remaining = 0;
+
+		std::vector<Level> m_Levels;
+		std::vector<std::string> m_Path;
+		// m_Candidates[n] holds the targets whose first n tokens equal the first n path tokens
+		std::vector<std::vector<size_t>> m_Candidates;
+
+		std::unique_ptr<nlohmann::detail::json_sax_dom_parser<json>> m_Capture;
+		size_t m_CaptureTarget = 0;
+		size_t m_CaptureDepth = 0;
+
+		std::string m_Error;
+	};
+}
+
+bool JsonExtractor::Extract(const std::string& filename, const std::vector<nlohmann::json::json_pointer>& pointers,
+	std::map<std::string, nlohmann::json>& results, size_t chunkSize, std::string* error)
+{
+	auto fail = [&](const std::string& message) {
+		if (error) *error = message;
+		else Logger::Error("Failed extracting from ", filename, ": ", message);
+		return false;
+	};
+
+	results.clear();
+	if (pointers.empty()) {
+		return true;
+	}
+
+	std::string message;
+	ChunkedReader reader(chunkSize);
+	if (!reader.Open(filename, &message)) {
+		return fail(message);
+	}
+
+	std::istream stream(&reader);
+	ExtractSax sax(pointers, results);
+	const bool completed = nlohmann::json::sax_parse(stream, &sax);
+
+	if (reader.Failed()) {
+		return fail(Utilities::Stringify("Could not read ", filename, "."));
+	}
+	if (!completed && !sax.Finished()) {
+		return fail(sax.Error().empty() ? std::string("parse aborted.") : sax.Error());
+	}
+	return true;
+}
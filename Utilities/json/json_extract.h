@@ -0,0 +1,19 @@
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../utils/utilities.h"
+
+// Pulls a handful of values out of arbitrarily large JSON files without building the DOM.
+// The file is read in fixed-size chunks and fed to nlohmann's SAX parser, and only values
+// sitting exactly at one of the requested JSON pointers are materialized. Memory stays at
+// one chunk plus the nesting depth plus the extracted subtrees. Parsing stops as soon as
+// every pointer has been found.
+class JsonExtractor
+{
+public:
+	// results maps pointer.to_string() to the value for every pointer that was found
+	static bool Extract(const std::string& filename, const std::vector<nlohmann::json::json_pointer>& pointers,
+		std::map<std::string, nlohmann::json>& results, size_t chunkSize = 1 << 20, std::string* error = nullptr);
+};
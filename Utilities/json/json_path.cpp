@@ -0,0 +1,785 @@
+#include "json_path.h"
+#include "../utils/utilities.h"
+
+#include <algorithm>
+#include <charconv>
+#include <limits>
+
+namespace
+{
+	using json = nlohmann::json;
+
+	// Filters and queries nest through recursion, deeper than this is refused
+	constexpr int kMaxNesting = 64;
+
+	bool IsNameFirst(char c)
+	{
+		const unsigned char u = static_cast<unsigned char>(c);
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || u >= 0x80;
+	}
+
+	bool IsNameChar(char c)
+	{
+		return IsNameFirst(c) || (c >= '0' && c <= '9');
+	}
+
+	// Resolves a possibly negative index against an array, false when out of range
+	bool ArrayIndex(const json& array, int64_t index, size_t& position)
+	{
+		const int64_t size = static_cast<int64_t>(array.size());
+		if (index < 0) {
+			index += size;
+		}
+		if (index < 0 || index >= size) {
+			return false;
+		}
+		position = static_cast<size_t>(index);
+		return true;
+	}
+
+	// A missing value only equals another missing value
+	bool Equal(const json* a, const json* b)
+	{
+		if (!a || !b) {
+			return !a && !b;
+		}
+		return *a == *b;
+	}
+
+	// Only numbers with numbers and strings with strings are ordered
+	bool Less(const json* a, const json* b)
+	{
+		if (!a || !b) {
+			return false;
+		}
+		if ((a->is_number() && b->is_number()) || (a->is_string() && b->is_string())) {
+			return *a < *b;
+		}
+		return false;
+	}
+}
+
+class JsonPathParser
+{
+public:
+	JsonPathParser(JsonPath& path, std::string_view text)
+		: m_Path(path), m_Text(text)
+	{
+	}
+
+	bool Parse(std::string& error)
+	{
+		const bool parsed = m_Text.empty() || m_Text[0] == '/' ? Pointer() : Path();
+		error = m_Error;
+		return parsed;
+	}
+
+private:
+	using Segment = JsonPath::Segment;
+	using Selector = JsonPath::Selector;
+	using SelectorKind = JsonPath::SelectorKind;
+	using FilterNode = JsonPath::FilterNode;
+	using FilterOp = JsonPath::FilterOp;
+	using Operand = JsonPath::Operand;
+
+	bool Pointer()
+	{
+		size_t position = 0;
+		while (position < m_Text.size()) {
+			const size_t end = (std::min)(m_Text.find('/', position + 1), m_Text.size());
+			Selector selector;
+			selector.kind = SelectorKind::Token;
+			selector.index = -1;
+			for (size_t i = position + 1; i < end; ++i) {
+				if (m_Text[i] != '~') {
+					selector.name.push_back(m_Text[i]);
+				}
+				else if (i + 1 < end && (m_Text[i + 1] == '0' || m_Text[i + 1] == '1')) {
+					selector.name.push_back(m_Text[++i] == '0' ? '~' : '/');
+				}
+				else {
+					m_Pos = i;
+					return Fail("'~' must be followed by 0 or 1");
+				}
+			}
+
+			// Array indexes are plain decimals without leading zeros, "-" is past the end
+			const std::string& token = selector.name;
+			if (!token.empty() && (token.size() == 1 || token[0] != '0')
+				&& std::all_of(token.begin(), token.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+				std::from_chars(token.data(), token.data() + token.size(), selector.index);
+			}
+
+			Segment segment;
+			segment.selectors.push_back(std::move(selector));
+			m_Path.m_Segments.push_back(std::move(segment));
+			position = end;
+		}
+		return true;
+	}
+
+	bool Path()
+	{
+		if (m_Text[0] != '$') {
+			return Fail("a JSONPath starts with '$'");
+		}
+		m_Pos = 1;
+		if (!Segments(m_Path.m_Segments)) {
+			return false;
+		}
+		SkipSpace();
+		if (m_Pos != m_Text.size()) {
+			return Fail("unexpected character");
+		}
+		return true;
+	}
+
+	// Reads segments until something that cannot start one
+	bool Segments(std::vector<Segment>& segments)
+	{
+		for (;;) {
+			const size_t save = m_Pos;
+			SkipSpace();
+			if (!At('.') && !At('[')) {
+				m_Pos = save;
+				return true;
+			}
+
+			Segment segment;
+			if (Consume("..")) {
+				segment.descendant = true;
+				if (!At('[') && !DotSelector(segment)) {
+					return false;
+				}
+			}
+			else if (Consume(".")) {
+				if (!DotSelector(segment)) {
+					return false;
+				}
+			}
+			if (At('[') && segment.selectors.empty() && !Bracket(segment)) {
+				return false;
+			}
+			segments.push_back(std::move(segment));
+		}
+	}
+
+	bool DotSelector(Segment& segment)
+	{
+		Selector selector;
+		if (Consume("*")) {
+			selector.kind = SelectorKind::Wildcard;
+		}
+		else {
+			if (m_Pos >= m_Text.size() || !IsNameFirst(m_Text[m_Pos])) {
+				return Fail("expected a member name or '*'");
+			}
+			const size_t start = m_Pos;
+			while (m_Pos < m_Text.size() && IsNameChar(m_Text[m_Pos])) {
+				++m_Pos;
+			}
+			selector.name = std::string(m_Text.substr(start, m_Pos - start));
+		}
+		segment.selectors.push_back(std::move(selector));
+		return true;
+	}
+
+	bool Bracket(Segment& segment)
+	{
+		++m_Pos;
+		for (;;) {
+			SkipSpace();
+			Selector selector;
+			if (!BracketSelector(selector)) {
+				return false;
+			}
+			segment.selectors.push_back(std::move(selector));
+			SkipSpace();
+			if (Consume("]")) {
+				return true;
+			}
+			if (!Consume(",")) {
+				return Fail("expected ',' or ']'");
+			}
+		}
+	}
+
+	bool BracketSelector(Selector& selector)
+	{
+		if (At('\'') || At('"')) {
+			return Quoted(selector.name);
+		}
+		if (Consume("*")) {
+			selector.kind = SelectorKind::Wildcard;
+			return true;
+		}
+		if (Consume("?")) {
+			selector.kind = SelectorKind::Filter;
+			selector.filter = Or();
+			return selector.filter >= 0;
+		}
+
+		bool present = false;
+		if (!Integer(selector.start, present)) {
+			return false;
+		}
+		SkipSpace();
+		if (!Consume(":")) {
+			if (!present) {
+				return Fail("expected a selector");
+			}
+			selector.kind = SelectorKind::Index;
+			selector.index = selector.start;
+			return true;
+		}
+
+		selector.kind = SelectorKind::Slice;
+		selector.hasStart = present;
+		SkipSpace();
+		if (!Integer(selector.end, selector.hasEnd)) {
+			return false;
+		}
+		SkipSpace();
+		if (Consume(":")) {
+			SkipSpace();
+			bool hasStep = false;
+			if (!Integer(selector.step, hasStep)) {
+				return false;
+			}
+			if (!hasStep) {
+				selector.step = 1;
+			}
+		}
+		return true;
+	}
+
+	bool Integer(int64_t& value, bool& present)
+	{
+		const size_t start = m_Pos;
+		if (At('-')) {
+			++m_Pos;
+		}
+		while (m_Pos < m_Text.size() && m_Text[m_Pos] >= '0' && m_Text[m_Pos] <= '9') {
+			++m_Pos;
+		}
+		present = m_Pos > start;
+		if (!present) {
+			return true;
+		}
+		const auto result = std::from_chars(m_Text.data() + start, m_Text.data() + m_Pos, value);
+		if (result.ec != std::errc() || result.ptr != m_Text.data() + m_Pos) {
+			m_Pos = start;
+			return Fail("invalid integer");
+		}
+		return true;
+	}
+
+	// Single or double quoted, with JSON escapes plus \' in both
+	bool Quoted(std::string& value)
+	{
+		const char quote = m_Text[m_Pos++];
+		std::string text = "\"";
+		for (;; ++m_Pos) {
+			if (m_Pos >= m_Text.size()) {
+				return Fail("unterminated string");
+			}
+			const char c = m_Text[m_Pos];
+			if (c == quote) {
+				break;
+			}
+			if (c == '\\' && m_Pos + 1 < m_Text.size()) {
+				if (m_Text[++m_Pos] != '\'') {
+					text.push_back('\\');
+				}
+				text.push_back(m_Text[m_Pos]);
+			}
+			else if (c == '"') {
+				text.append("\\\"");
+			}
+			else {
+				text.push_back(c);
+			}
+		}
+		const size_t start = m_Pos;
+		++m_Pos;
+		text.push_back('"');
+
+		try {
+			value = json::parse(text).get<std::string>();
+		}
+		catch (const json::exception&) {
+			m_Pos = start;
+			return Fail("invalid string");
+		}
+		return true;
+	}
+
+	int Or()
+	{
+		int left = And();
+		for (;;) {
+			SkipSpace();
+			if (left < 0 || !Consume("||")) {
+				return left;
+			}
+			const int right = And();
+			left = right < 0 ? -1 : Add(FilterOp::Or, left, right);
+		}
+	}
+
+	int And()
+	{
+		int left = Unary();
+		for (;;) {
+			SkipSpace();
+			if (left < 0 || !Consume("&&")) {
+				return left;
+			}
+			const int right = Unary();
+			left = right < 0 ? -1 : Add(FilterOp::And, left, right);
+		}
+	}
+
+	int Unary()
+	{
+		// Every nested filter, query or parenthesis comes back through here
+		if (m_Nesting >= kMaxNesting) {
+			Fail("filter is nested too deeply");
+			return -1;
+		}
+		++m_Nesting;
+		const int node = UnaryInner();
+		--m_Nesting;
+		return node;
+	}
+
+	int UnaryInner()
+	{
+		SkipSpace();
+		if (At('!') && !(m_Pos + 1 < m_Text.size() && m_Text[m_Pos + 1] == '=')) {
+			++m_Pos;
+			const int operand = Unary();
+			return operand < 0 ? -1 : Add(FilterOp::Not, operand);
+		}
+		if (Consume("(")) {
+			const int inner = Or();
+			SkipSpace();
+			if (inner >= 0 && !Consume(")")) {
+				Fail("expected ')'");
+				return -1;
+			}
+			return inner;
+		}
+		return Comparison();
+	}
+
+	int Comparison()
+	{
+		FilterNode node;
+		if (!ParseOperand(node.a)) {
+			return -1;
+		}
+		SkipSpace();
+
+		static constexpr std::pair<const char*, FilterOp> kOperators[] = {
+			{ "==", FilterOp::Equal }, { "!=", FilterOp::NotEqual }, { "<=", FilterOp::LessEqual },
+			{ ">=", FilterOp::GreaterEqual }, { "<", FilterOp::Less }, { ">", FilterOp::Greater }
+		};
+		bool compared = false;
+		for (const auto& [token, op] : kOperators) {
+			if (Consume(token)) {
+				node.op = op;
+				compared = true;
+				break;
+			}
+		}
+
+		if (!compared) {
+			if (node.a.query < 0) {
+				Fail("a literal cannot be a test on its own");
+				return -1;
+			}
+			node.op = FilterOp::Exists;
+			return Add(std::move(node));
+		}
+
+		const size_t right = m_Pos;
+		if (!ParseOperand(node.b)) {
+			return -1;
+		}
+		for (const Operand* operand : { &node.a, &node.b }) {
+			if (operand->query >= 0 && !m_Path.m_Queries[operand->query].singular) {
+				m_Pos = right;
+				Fail("only singular queries (names and indexes) can be compared");
+				return -1;
+			}
+		}
+		return Add(std::move(node));
+	}
+
+	bool ParseOperand(Operand& operand)
+	{
+		SkipSpace();
+		if (At('@') || At('$')) {
+			JsonPath::Query query;
+			query.relative = m_Text[m_Pos++] == '@';
+			if (!Segments(query.segments)) {
+				return false;
+			}
+			query.singular = JsonPath::IsSingular(query.segments);
+			operand.query = static_cast<int>(m_Path.m_Queries.size());
+			m_Path.m_Queries.push_back(std::move(query));
+			return true;
+		}
+
+		if (At('\'') || At('"')) {
+			std::string value;
+			if (!Quoted(value)) {
+				return false;
+			}
+			operand.literal = std::move(value);
+			return true;
+		}
+		if (Consume("true")) {
+			operand.literal = true;
+			return true;
+		}
+		if (Consume("false")) {
+			operand.literal = false;
+			return true;
+		}
+		if (Consume("null")) {
+			operand.literal = nullptr;
+			return true;
+		}
+
+		const size_t start = m_Pos;
+		while (m_Pos < m_Text.size() && std::string_view("0123456789+-.eE").find(m_Text[m_Pos]) != std::string_view::npos) {
+			++m_Pos;
+		}
+		if (m_Pos > start) {
+			try {
+				operand.literal = json::parse(m_Text.substr(start, m_Pos - start));
+				return true;
+			}
+			catch (const json::exception&) {
+			}
+		}
+		m_Pos = start;
+		return Fail("expected a query or a literal");
+	}
+
+	int Add(FilterOp op, int left, int right = -1)
+	{
+		FilterNode node;
+		node.op = op;
+		node.left = left;
+		node.right = right;
+		return Add(std::move(node));
+	}
+
+	int Add(FilterNode node)
+	{
+		m_Path.m_Filters.push_back(std::move(node));
+		return static_cast<int>(m_Path.m_Filters.size() - 1);
+	}
+
+	void SkipSpace()
+	{
+		while (m_Pos < m_Text.size() && (m_Text[m_Pos] == ' ' || m_Text[m_Pos] == '\t' || m_Text[m_Pos] == '\n' || m_Text[m_Pos] == '\r')) {
+			++m_Pos;
+		}
+	}
+
+	bool At(char c) const
+	{
+		return m_Pos < m_Text.size() && m_Text[m_Pos] == c;
+	}
+
+	bool Consume(std::string_view token)
+	{
+		if (m_Text.substr(m_Pos, token.size()) != token) {
+			return false;
+		}
+		m_Pos += token.size();
+		return true;
+	}
+
+	bool Fail(const std::string& message)
+	{
+		if (m_Error.empty()) {
+			m_Error = Utilities::Stringify("offset ", m_Pos, ": ", message);
+		}
+		return false;
+	}
+
+	JsonPath& m_Path;
+	std::string_view m_Text;
+	size_t m_Pos = 0;
+	int m_Nesting = 0;
+	std::string m_Error;
+};
+
+bool JsonPath::Compile(std::string_view expression, std::string* error)
+{
+	m_Expression = std::string(expression);
+	m_Compiled = false;
+	m_Segments.clear();
+	m_Filters.clear();
+	m_Queries.clear();
+
+	std::string message;
+	if (!JsonPathParser(*this, expression).Parse(message)) {
+		m_Segments.clear();
+		m_Filters.clear();
+		m_Queries.clear();
+		if (error) *error = message;
+		return false;
+	}
+	m_Compiled = true;
+	return true;
+}
+
+bool JsonPath::IsSingular() const
+{
+	return m_Compiled && IsSingular(m_Segments);
+}
+
+void JsonPath::Evaluate(const json& document, std::vector<const json*>& results) const
+{
+	if (!m_Compiled) {
+		return;
+	}
+	if (IsSingular(m_Segments)) {
+		if (const json* match = Singular(m_Segments, document)) {
+			results.push_back(match);
+		}
+		return;
+	}
+	Walk(m_Segments, 0, document, document, results, (std::numeric_limits<size_t>::max)());
+}
+
+std::vector<const json*> JsonPath::Evaluate(const json& document) const
+{
+	std::vector<const json*> results;
+	Evaluate(document, results);
+	return results;
+}
+
+std::vector<json*> JsonPath::Evaluate(json& document) const
+{
+	// The matches point into document, which the caller may modify
+	std::vector<json*> results;
+	for (const json* match : Evaluate(static_cast<const json&>(document))) {
+		results.push_back(const_cast<json*>(match));
+	}
+	return results;
+}
+
+const json* JsonPath::First(const json& document) const
+{
+	if (!m_Compiled) {
+		return nullptr;
+	}
+	if (IsSingular(m_Segments)) {
+		return Singular(m_Segments, document);
+	}
+	Results results;
+	Walk(m_Segments, 0, document, document, results, 1);
+	return results.empty() ? nullptr : results[0];
+}
+
+json* JsonPath::First(json& document) const
+{
+	return const_cast<json*>(First(static_cast<const json&>(document)));
+}
+
+bool JsonPath::Walk(const std::vector<Segment>& segments, size_t segment, const json& node, const json& root,
+	Results& out, size_t limit) const
+{
+	if (segment == segments.size()) {
+		out.push_back(&node);
+		return out.size() < limit;
+	}
+	if (segments[segment].descendant) {
+		return Descend(segments, segment, node, root, out, limit);
+	}
+	for (const Selector& selector : segments[segment].selectors) {
+		if (!Select(selector, segments, segment, node, root, out, limit)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool JsonPath::Descend(const std::vector<Segment>& segments, size_t segment, const json& node, const json& root,
+	Results& out, size_t limit) const
+{
+	// The node itself first, then its descendants in document order
+	for (const Selector& selector : segments[segment].selectors) {
+		if (!Select(selector, segments, segment, node, root, out, limit)) {
+			return false;
+		}
+	}
+	if (node.is_structured()) {
+		for (const json& child : node) {
+			if (!Descend(segments, segment, child, root, out, limit)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+bool JsonPath::Select(const Selector& selector, const std::vector<Segment>& segments, size_t segment, const json& node,
+	const json& root, Results& out, size_t limit) const
+{
+	const size_t next = segment + 1;
+	switch (selector.kind) {
+	case SelectorKind::Name:
+	case SelectorKind::Token: {
+		if (node.is_object()) {
+			const auto it = node.find(selector.name);
+			return it == node.end() || Walk(segments, next, *it, root, out, limit);
+		}
+		size_t position = 0;
+		if (selector.kind == SelectorKind::Token && node.is_array() && selector.index >= 0
+			&& ArrayIndex(node, selector.index, position)) {
+			return Walk(segments, next, node[position], root, out, limit);
+		}
+		return true;
+	}
+	case SelectorKind::Index: {
+		size_t position = 0;
+		if (node.is_array() && ArrayIndex(node, selector.index, position)) {
+			return Walk(segments, next, node[position], root, out, limit);
+		}
+		return true;
+	}
+	case SelectorKind::Wildcard:
+		if (node.is_structured()) {
+			for (const json& child : node) {
+				if (!Walk(segments, next, child, root, out, limit)) {
+					return false;
+				}
+			}
+		}
+		return true;
+	case SelectorKind::Slice: {
+		if (!node.is_array() || selector.step == 0) {
+			return true;
+		}
+		const int64_t size = static_cast<int64_t>(node.size());
+		auto normalize = [size](int64_t index) { return index >= 0 ? index : size + index; };
+		if (selector.step > 0) {
+			const int64_t lower = std::clamp<int64_t>(selector.hasStart ? normalize(selector.start) : 0, 0, size);
+			const int64_t upper = std::clamp<int64_t>(selector.hasEnd ? normalize(selector.end) : size, 0, size);
+			for (int64_t i = lower; i < upper; i += selector.step) {
+				if (!Walk(segments, next, node[static_cast<size_t>(i)], root, out, limit)) {
+					return false;
+				}
+			}
+		}
+		else {
+			const int64_t upper = std::clamp<int64_t>(selector.hasStart ? normalize(selector.start) : size - 1, -1, size - 1);
+			const int64_t lower = std::clamp<int64_t>(selector.hasEnd ? normalize(selector.end) : -1, -1, size - 1);
+			for (int64_t i = upper; i > lower; i += selector.step) {
+				if (!Walk(segments, next, node[static_cast<size_t>(i)], root, out, limit)) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+	case SelectorKind::Filter:
+		if (node.is_structured()) {
+			for (const json& child : node) {
+				if (Test(selector.filter, child, root) && !Walk(segments, next, child, root, out, limit)) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+	return true;
+}
+
+bool JsonPath::Test(int filter, const json& current, const json& root) const
+{
+	const FilterNode& node = m_Filters[filter];
+	switch (node.op) {
+	case FilterOp::Or: return Test(node.left, current, root) || Test(node.right, current, root);
+	case FilterOp::And: return Test(node.left, current, root) && Test(node.right, current, root);
+	case FilterOp::Not: return !Test(node.left, current, root);
+	case FilterOp::Exists: {
+		const Query& query = m_Queries[node.a.query];
+		const json& start = query.relative ? current : root;
+		if (query.singular) {
+			return Singular(query.segments, start) != nullptr;
+		}
+		Results results;
+		return !Walk(query.segments, 0, start, root, results, 1);
+	}
+	default:
+		break;
+	}
+
+	const json* a = Resolve(node.a, current, root);
+	const json* b = Resolve(node.b, current, root);
+	switch (node.op) {
+	case FilterOp::Equal: return Equal(a, b);
+	case FilterOp::NotEqual: return !Equal(a, b);
+	case FilterOp::Less: return Less(a, b);
+	case FilterOp::LessEqual: return Less(a, b) || Equal(a, b);
+	case FilterOp::Greater: return Less(b, a);
+	case FilterOp::GreaterEqual: return Less(b, a) || Equal(a, b);
+	default: return false;
+	}
+}
+
+const json* JsonPath::Resolve(const Operand& operand, const json& current, const json& root) const
+{
+	if (operand.query < 0) {
+		return &operand.literal;
+	}
+	const Query& query = m_Queries[operand.query];
+	return Singular(query.segments, query.relative ? current : root);
+}
+
+bool JsonPath::IsSingular(const std::vector<Segment>& segments)
+{
+	for (const Segment& segment : segments) {
+		if (segment.descendant || segment.selectors.size() != 1) {
+			return false;
+		}
+		const SelectorKind kind = segment.selectors[0].kind;
+		if (kind != SelectorKind::Name && kind != SelectorKind::Index && kind != SelectorKind::Token) {
+			return false;
+		}
+	}
+	return true;
+}
+
+const json* JsonPath::Singular(const std::vector<Segment>& segments, const json& node)
+{
+	const json* current = &node;
+	for (const Segment& segment : segments) {
+		const Selector& selector = segment.selectors[0];
+		size_t position = 0;
+		if (current->is_object() && selector.kind != SelectorKind::Index) {
+			const auto it = current->find(selector.name);
+			if (it == current->end()) {
+				return nullptr;
+			}
+			current = &*it;
+		}
+		else if (current->is_array() && selector.kind != SelectorKind::Name
+			&& !(selector.kind == SelectorKind::Token && selector.index < 0) && ArrayIndex(*current, selector.index, position)) {
+			current = &(*current)[position];
+		}
+		else {
+			return nullptr;
+		}
+	}
+	return current;
+}
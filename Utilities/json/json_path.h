@@ -0,0 +1,124 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../dependencies/json.hpp"
+
+// A JSONPath query (RFC 9535 subset) or JSON pointer compiled once into a list of segments
+// and evaluated over any number of documents. Results point into the document, nothing is
+// copied, so they stay valid as long as the document is not modified.
+//
+// Supported: $, .name, ['name'], [index] (negative from the end), [start:end:step], *, unions
+// such as [0,'a',1:3], recursive descent (..name, ..*, ..[...]) and filters [?expr]. A filter
+// combines ||, &&, ! and parentheses over comparisons (== != < <= > >=) of singular queries
+// (@... relative to the candidate, $... to the root) and literals, or over bare queries that
+// test for existence. Function extensions such as length() and match() are not supported.
+//
+// An expression that starts with '/' or is empty is a JSON pointer instead. A compiled query
+// is read-only while evaluating, so one instance can serve many threads.
+class JsonPath
+{
+public:
+	bool Compile(std::string_view expression, std::string* error = nullptr);
+	bool IsCompiled() const { return m_Compiled; }
+	const std::string& Expression() const { return m_Expression; }
+	// Only names and indexes: at most one match, found without any allocation
+	bool IsSingular() const;
+
+	// Appends every match in document order, objects in key order
+	void Evaluate(const nlohmann::json& document, std::vector<const nlohmann::json*>& results) const;
+	std::vector<const nlohmann::json*> Evaluate(const nlohmann::json& document) const;
+	std::vector<nlohmann::json*> Evaluate(nlohmann::json& document) const;
+	// The first match, or nullptr. Stops walking as soon as it is found.
+	const nlohmann::json* First(const nlohmann::json& document) const;
+	nlohmann::json* First(nlohmann::json& document) const;
+
+private:
+	friend class JsonPathParser;
+
+	enum class SelectorKind
+	{
+		Name,
+		Index,
+		// A JSON pointer token: an object member, or an array index when it is one
+		Token,
+		Wildcard,
+		Slice,
+		Filter
+	};
+
+	struct Selector
+	{
+		SelectorKind kind = SelectorKind::Name;
+		std::string name;
+		int64_t index = 0;
+		int64_t start = 0, end = 0, step = 1;
+		bool hasStart = false, hasEnd = false;
+		int filter = -1;
+	};
+
+	struct Segment
+	{
+		bool descendant = false;
+		std::vector<Selector> selectors;
+	};
+
+	enum class FilterOp
+	{
+		Or,
+		And,
+		Not,
+		Exists,
+		Equal,
+		NotEqual,
+		Less,
+		LessEqual,
+		Greater,
+		GreaterEqual
+	};
+
+	struct Operand
+	{
+		// Index into m_Queries, or -1 for a literal
+		int query = -1;
+		nlohmann::json literal;
+	};
+
+	struct FilterNode
+	{
+		FilterOp op = FilterOp::Exists;
+		int left = -1, right = -1;
+		Operand a, b;
+	};
+
+	struct Query
+	{
+		bool relative = true;
+		bool singular = false;
+		std::vector<Segment> segments;
+	};
+
+	using Results = std::vector<const nlohmann::json*>;
+
+	// Each returns false once out holds limit results
+	bool Walk(const std::vector<Segment>& segments, size_t segment, const nlohmann::json& node, const nlohmann::json& root,
+		Results& out, size_t limit) const;
+	bool Descend(const std::vector<Segment>& segments, size_t segment, const nlohmann::json& node, const nlohmann::json& root,
+		Results& out, size_t limit) const;
+	bool Select(const Selector& selector, const std::vector<Segment>& segments, size_t segment, const nlohmann::json& node,
+		const nlohmann::json& root, Results& out, size_t limit) const;
+
+	bool Test(int filter, const nlohmann::json& current, const nlohmann::json& root) const;
+	const nlohmann::json* Resolve(const Operand& operand, const nlohmann::json& current, const nlohmann::json& root) const;
+	static bool IsSingular(const std::vector<Segment>& segments);
+	static const nlohmann::json* Singular(const std::vector<Segment>& segments, const nlohmann::json& node);
+
+	std::string m_Expression;
+	bool m_Compiled = false;
+	std::vector<Segment> m_Segments;
+	// Filters and the queries inside them, shared by every nesting level
+	std::vector<FilterNode> m_Filters;
+	std::vector<Query> m_Queries;
+};
@@ -0,0 +1,210 @@
+#include "json_push_parser.h"
+#include "../utils/utilities.h"
+
+#include <vector>
+
+namespace
+{
+	bool IsSeparator(char c)
+	{
+		return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\x1E';
+	}
+
+	// Numbers and literals have no closing character, the next separator or structural ends them
+	bool EndsScalar(char c)
+	{
+		return IsSeparator(c) || c == '{' || c == '[' || c == '}' || c == ']' || c == '"' || c == ',';
+	}
+}
+
+JsonPushParser::JsonPushParser(Callback onValue, size_t maxValueSize)
+	: m_OnValue(std::move(onValue)), m_MaxValueSize(maxValueSize)
+{
+}
+
+bool JsonPushParser::Feed(std::string_view data)
+{
+	if (Failed() || m_Stopped) {
+		return false;
+	}
+
+	const char* bytes = data.data();
+	const size_t size = data.size();
+	// Where the current value starts in this chunk, 0 when it began in an earlier one
+	size_t start = 0;
+	size_t i = 0;
+	while (i < size) {
+		switch (m_State) {
+		case State::Between: {
+			const char c = bytes[i];
+			if (IsSeparator(c)) {
+				++i;
+				continue;
+			}
+			start = i++;
+			if (c == '{' || c == '[') {
+				m_State = State::Container;
+				m_Depth = 1;
+			}
+			else if (c == '"') {
+				m_State = State::String;
+			}
+			else {
+				m_State = State::Scalar;
+			}
+			break;
+		}
+		case State::Scalar:
+			while (i < size && !EndsScalar(bytes[i])) {
+				++i;
+			}
+			if (i < size && !Complete(data.substr(start, i - start))) {
+				return false;
+			}
+			break;
+		case State::String:
+			for (; i < size; ++i) {
+				if (m_Escaped) m_Escaped = false;
+				else if (bytes[i] == '\\') m_Escaped = true;
+				else if (bytes[i] == '"') break;
+			}
+			if (i < size && !Complete(data.substr(start, ++i - start))) {
+				return false;
+			}
+			break;
+		case State::Container:
+			for (; i < size; ++i) {
+				const char c = bytes[i];
+				if (m_InString) {
+					if (m_Escaped) m_Escaped = false;
+					else if (c == '\\') m_Escaped = true;
+					else if (c == '"') m_InString = false;
+				}
+				else if (c == '"') {
+					m_InString = true;
+				}
+				else if (c == '{' || c == '[') {
+					++m_Depth;
+				}
+				else if ((c == '}' || c == ']') && --m_Depth == 0) {
+					break;
+				}
+			}
+			if (i < size && !Complete(data.substr(start, ++i - start))) {
+				return false;
+			}
+			break;
+		}
+	}
+
+	if (m_State != State::Between && !Hold(data.substr(start))) {
+		return false;
+	}
+	m_Offset += size;
+	return true;
+}
+
+bool JsonPushParser::Finish()
+{
+	if (Failed()) {
+		return false;
+	}
+	if (m_State == State::Scalar) {
+		return Complete(std::string_view());
+	}
+	if (m_State != State::Between) {
+		return Fail(Utilities::Stringify("the stream ended inside a value after ", m_Offset, " bytes"));
+	}
+	return true;
+}
+
+void JsonPushParser::Reset()
+{
+	m_State = State::Between;
+	m_Depth = 0;
+	m_InString = false;
+	m_Escaped = false;
+	m_Pending.clear();
+	m_Values = 0;
+	m_Offset = 0;
+	m_Stopped = false;
+	m_Error.clear();
+}
+
+bool JsonPushParser::ReadFrom(HANDLE input, std::string* error)
+{
+	auto report = [&](const std::string& message) {
+		if (error) *error = message;
+		else Logger::Error("Failed reading json stream: ", message);
+		return false;
+	};
+
+	std::vector<char> buffer(64 << 10);
+	for (;;) {
+		DWORD read = 0;
+		if (!ReadFile(input, buffer.data(), static_cast<DWORD>(buffer.size()), &read, nullptr)) {
+			const DWORD code = GetLastError();
+			// The writing end of a pipe went away, that is how pipes end
+			if (code == ERROR_BROKEN_PIPE || code == ERROR_HANDLE_EOF) {
+				break;
+			}
+			return report(Utilities::Stringify("Could not read: ", Utilities::GetLastErrorString(code)));
+		}
+		if (read == 0) {
+			break;
+		}
+		if (!Feed(buffer.data(), read)) {
+			return m_Stopped ? true : report(m_Error);
+		}
+	}
+	return Finish() ? true : report(m_Error);
+}
+
+bool JsonPushParser::Complete(std::string_view tail)
+{
+	std::string_view text = tail;
+	if (!m_Pending.empty()) {
+		if (!Hold(tail)) {
+			return false;
+		}
+		text = m_Pending;
+	}
+
+	nlohmann::json value;
+	try {
+		value = nlohmann::json::parse(text.begin(), text.end());
+	}
+	catch (const nlohmann::json::exception& e) {
+		return Fail(Utilities::Stringify("value ", m_Values + 1, ": ", e.what()));
+	}
+
+	m_State = State::Between;
+	m_Depth = 0;
+	m_InString = false;
+	m_Escaped = false;
+	m_Pending.clear();
+	++m_Values;
+
+	if (!m_OnValue(value)) {
+		m_Stopped = true;
+		return false;
+	}
+	return true;
+}
+
+bool JsonPushParser::Hold(std::string_view part)
+{
+	if (m_Pending.size() + part.size() > m_MaxValueSize) {
+		return Fail(Utilities::Stringify("value ", m_Values + 1, " is larger than ", m_MaxValueSize, " bytes"));
+	}
+	m_Pending.append(part);
+	return true;
+}
+
+bool JsonPushParser::Fail(const std::string& message)
+{
+	if (m_Error.empty()) {
+		m_Error = message;
+	}
+	return false;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <Windows.h>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+#include "../dependencies/json.hpp"
+
+// Incremental parser for a stream of concatenated JSON values (NDJSON, JSON text sequences,
+// or values simply written back to back) that arrives in arbitrary chunks, from a pipe, a
+// child process or a socket. A small framing state machine finds where each top-level value
+// ends; the value is then parsed and handed to the callback straight away. Only the value
+// that is still incomplete is buffered, and a value that fits inside one chunk is parsed in
+// place without being copied at all.
+//
+// Values are separated by whitespace or the RS (0x1E) byte of RFC 7464. The first error
+// sticks: the stream is out of sync after it, so every later Feed() returns false.
+class JsonPushParser
+{
+public:
+	// Return false to stop, Feed() then returns false without an error
+	using Callback = std::function<bool(nlohmann::json& value)>;
+
+	explicit JsonPushParser(Callback onValue, size_t maxValueSize = 64 << 20);
+
+	bool Feed(std::string_view data);
+	bool Feed(const char* data, size_t size) { return Feed(std::string_view(data, size)); }
+	// Ends the stream: a number or literal at the very end is completed, being inside any
+	// other value is an error
+	bool Finish();
+	// Drops any partial value and the error, ready for a new stream
+	void Reset();
+
+	// Feeds everything read from a pipe, file or socket handle until end of stream, then
+	// calls Finish(). A closed pipe counts as the end.
+	bool ReadFrom(HANDLE input, std::string* error = nullptr);
+
+	bool Failed() const { return !m_Error.empty(); }
+	bool Stopped() const { return m_Stopped; }
+	const std::string& Error() const { return m_Error; }
+	uint64_t ValuesParsed() const { return m_Values; }
+	// Bytes held for the value that is still incomplete
+	size_t BufferedBytes() const { return m_Pending.size(); }
+
+private:
+	enum class State
+	{
+		Between,
+		Container,
+		String,
+		Scalar
+	};
+
+	bool Complete(std::string_view tail);
+	bool Hold(std::string_view part);
+	bool Fail(const std::string& message);
+
+	Callback m_OnValue;
+	size_t m_MaxValueSize;
+
+	State m_State = State::Between;
+	size_t m_Depth = 0;
+	bool m_InString = false;
+	bool m_Escaped = false;
+	std::string m_Pending;
+
+	uint64_t m_Values = 0;
+	uint64_t m_Offset = 0;
+	bool m_Stopped = false;
+	std::string m_Error;
+};
@@ -0,0 +1,486 @@
+#include "json_reflect.h"
+#include "json_stream_writer.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	int HexDigit(char c)
+	{
+		if (c >= '0' && c <= '9') return c - '0';
+		if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+		if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+		return -1;
+	}
+
+	void AppendUtf8(std::string& out, char32_t cp)
+	{
+		if (cp < 0x80) {
+			out.push_back(static_cast<char>(cp));
+		}
+		else if (cp < 0x800) {
+			out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+			out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+		}
+		else if (cp < 0x10000) {
+			out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+			out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+			out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+		}
+		else {
+			out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+			out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+			out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+			out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+		}
+	}
+}
+
+char JsonTokenReader::Peek()
+{
+	SkipWhitespace();
+	return m_Position < m_Text.size() ? m_Text[m_Position] : 0;
+}
+
+bool JsonTokenReader::Consume(char c)
+{
+	if (Failed() || Peek() != c) {
+		return false;
+	}
+	++m_Position;
+	return true;
+}
+
+bool JsonTokenReader::Expect(char c)
+{
+	if (Consume(c)) {
+		return true;
+	}
+	return Fail(Utilities::Stringify("expected '", c, "'"));
+}
+
+bool JsonTokenReader::AtEnd()
+{
+	SkipWhitespace();
+	return m_Position >= m_Text.size();
+}
+
+bool JsonTokenReader::ReadNull()
+{
+	return ReadLiteral("null");
+}
+
+bool JsonTokenReader::ReadBool(bool& value)
+{
+	const char c = Peek();
+	if (c == 't' && ReadLiteral("true")) {
+		value = true;
+		return true;
+	}
+	if (c == 'f' && ReadLiteral("false")) {
+		value = false;
+		return true;
+	}
+	return Fail("expected a boolean");
+}
+
+bool JsonTokenReader::ReadString(std::string_view& value, std::string& scratch)
+{
+	if (!Consume('"')) {
+		return Fail("expected a string");
+	}
+
+	const size_t begin = m_Position;
+	size_t i = begin;
+	while (i < m_Text.size() && m_Text[i] != '"' && m_Text[i] != '\\' && static_cast<unsigned char>(m_Text[i]) >= 0x20) {
+		++i;
+	}
+	if (i < m_Text.size() && m_Text[i] == '"') {
+		value = m_Text.substr(begin, i - begin);
+		m_Position = i + 1;
+		return true;
+	}
+
+	// Slow path, the string has escapes
+	scratch.assign(m_Text.substr(begin, i - begin));
+	for (;;) {
+		if (i >= m_Text.size()) {
+			m_Position = i;
+			return Fail("unterminated string");
+		}
+		const char c = m_Text[i];
+		if (c == '"') {
+			break;
+		}
+		if (static_cast<unsigned char>(c) < 0x20) {
+			m_Position = i;
+			return Fail("control character in string");
+		}
+		if (c != '\\') {
+			scratch.push_back(c);
+			++i;
+			continue;
+		}
+
+		if (i + 1 >= m_Text.size()) {
+			m_Position = i;
+			return Fail("unterminated string");
+		}
+		const char escape = m_Text[i + 1];
+		i += 2;
+		switch (escape) {
+		case '"': scratch.push_back('"'); break;
+		case '\\': scratch.push_back('\\'); break;
+		case '/': scratch.push_back('/'); break;
+		case 'b': scratch.push_back('\b'); break;
+		case 'f': scratch.push_back('\f'); break;
+		case 'n': scratch.push_back('\n'); break;
+		case 'r': scratch.push_back('\r'); break;
+		case 't': scratch.push_back('\t'); break;
+		case 'u': {
+			auto readHex = [&](char32_t& unit) {
+				if (i + 4 > m_Text.size()) {
+					return false;
+				}
+				unit = 0;
+				for (size_t k = 0; k < 4; ++k) {
+					const int digit = HexDigit(m_Text[i + k]);
+					if (digit < 0) {
+						return false;
+					}
+					unit = (unit << 4) | static_cast<char32_t>(digit);
+				}
+				i += 4;
+				return true;
+			};
+
+			char32_t cp = 0;
+			if (!readHex(cp)) {
+				m_Position = i;
+				return Fail("invalid \\u escape");
+			}
+			if (cp >= 0xD800 && cp <= 0xDBFF) {
+				char32_t low = 0;
+				if (i + 2 > m_Text.size() || m_Text[i] != '\\' || m_Text[i + 1] != 'u' || (i += 2, !readHex(low)) || low < 0xDC00 || low > 0xDFFF) {
+					m_Position = i;
+					return Fail("unpaired surrogate in \\u escape");
+				}
+				cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+			}
+			else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+				m_Position = i;
+				return Fail("unpaired surrogate in \\u escape");
+			}
+			AppendUtf8(scratch, cp);
+			break;
+		}
+		default:
+			m_Position = i - 1;
+			return Fail("invalid escape");
+		}
+	}
+
+	value = scratch;
+	m_Position = i + 1;
+	return true;
+}
+
+bool JsonTokenReader::ReadString(std::string& value)
+{
+	std::string_view view;
+	if (!ReadString(view, value)) {
+		return false;
+	}
+	if (view.data() != value.data()) {
+		value.assign(view);
+	}
+	return true;
+}
+
+bool JsonTokenReader::ReadNumber(std::string_view& token)
+{
+	SkipWhitespace();
+	if (Failed()) {
+		return false;
+	}
+
+	// -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+	const size_t begin = m_Position;
+	size_t i = begin;
+	auto digits = [&] {
+		const size_t start = i;
+		while (i < m_Text.size() && m_Text[i] >= '0' && m_Text[i] <= '9') {
+			++i;
+		}
+		return i > start;
+	};
+
+	if (i < m_Text.size() && m_Text[i] == '-') {
+		++i;
+	}
+	if (i < m_Text.size() && m_Text[i] == '0') {
+		++i;
+	}
+	else if (!digits()) {
+		return Fail("expected a number");
+	}
+	if (i < m_Text.size() && m_Text[i] == '.') {
+		++i;
+		if (!digits()) {
+			m_Position = i;
+			return Fail("expected a digit after the decimal point");
+		}
+	}
+	if (i < m_Text.size() && (m_Text[i] == 'e' || m_Text[i] == 'E')) {
+		++i;
+		if (i < m_Text.size() && (m_Text[i] == '+' || m_Text[i] == '-')) {
+			++i;
+		}
+		if (!digits()) {
+			m_Position = i;
+			return Fail("expected a digit in the exponent");
+		}
+	}
+
+	token = m_Text.substr(begin, i - begin);
+	m_Position = i;
+	return true;
+}
+
+bool JsonTokenReader::SkipValue()
+{
+	std::string_view raw;
+	return RawValue(raw);
+}
+
+bool JsonTokenReader::RawValue(std::string_view& raw)
+{
+	const char c = Peek();
+	if (Failed()) {
+		return false;
+	}
+
+	const size_t begin = m_Position;
+	std::string scratch;
+	std::string_view ignored;
+	bool ok;
+	switch (c) {
+	case '"':
+		ok = ReadString(ignored, scratch);
+		break;
+	case 't':
+	case 'f': {
+		bool value;
+		ok = ReadBool(value);
+		break;
+	}
+	case 'n':
+		ok = ReadNull();
+		break;
+	case '{':
+	case '[': {
+		// Containers are walked without recursion, so hostile nesting cannot blow the stack
+		std::string closers;
+		do {
+			if (Consume('{')) {
+				closers.push_back('}');
+				if (Consume('}')) {
+					closers.pop_back();
+				}
+				else if (!ReadString(ignored, scratch) || !Expect(':')) {
+					return false;
+				}
+				else {
+					continue;
+				}
+			}
+			else if (Consume('[')) {
+				closers.push_back(']');
+				if (Consume(']')) {
+					closers.pop_back();
+				}
+				else {
+					continue;
+				}
+			}
+			else if (!RawValue(ignored)) {
+				return false;
+			}
+
+			// After a value: either a comma or the end of one or more containers
+			for (;;) {
+				if (closers.empty()) {
+					break;
+				}
+				if (Consume(',')) {
+					if (closers.back() == '}' && (!ReadString(ignored, scratch) || !Expect(':'))) {
+						return false;
+					}
+					break;
+				}
+				if (!Expect(closers.back())) {
+					return false;
+				}
+				closers.pop_back();
+			}
+		} while (!closers.empty());
+		ok = true;
+		break;
+	}
+	default: {
+		std::string_view token;
+		ok = ReadNumber(token);
+		break;
+	}
+	}
+
+	if (!ok) {
+		return false;
+	}
+	raw = m_Text.substr(begin, m_Position - begin);
+	return true;
+}
+
+bool JsonTokenReader::Fail(std::string_view message)
+{
+	if (m_Error.empty()) {
+		m_Error = Utilities::Stringify(message, " at offset ", m_Position);
+	}
+	return false;
+}
+
+void JsonTokenReader::SkipWhitespace()
+{
+	while (m_Position < m_Text.size()) {
+		const char c = m_Text[m_Position];
+		if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+			break;
+		}
+		++m_Position;
+	}
+}
+
+bool JsonTokenReader::ReadLiteral(std::string_view literal)
+{
+	SkipWhitespace();
+	if (m_Text.compare(m_Position, literal.size(), literal) != 0) {
+		return Fail(Utilities::Stringify("expected '", literal, "'"));
+	}
+	m_Position += literal.size();
+	return true;
+}
+
+bool JsonReflect::Report(std::string* error, const std::string& message)
+{
+	if (error) *error = message;
+	return false;
+}
+
+void JsonReflect::NewLine(TextSink& sink, unsigned depth)
+{
+	if (sink.indent >= 0) {
+		sink.out.push_back('\n');
+		sink.out.append(static_cast<size_t>(sink.indent) * depth, ' ');
+	}
+}
+
+bool JsonReflect::WriteTextString(TextSink& sink, std::string_view value)
+{
+	if (!JsonStreamWriter::AppendString(sink.out, value)) {
+		return Report(sink.error, "string is not valid UTF-8");
+	}
+	return true;
+}
+
+void JsonReflect::WriteTextDouble(std::string& out, double value)
+{
+	JsonStreamWriter::AppendDouble(out, value);
+}
+
+bool JsonReflect::WriteTextFallback(TextSink& sink, const nlohmann::json& value, unsigned depth)
+{
+	try {
+		nlohmann::detail::serializer<nlohmann::json> serializer(nlohmann::detail::output_adapter<char>(sink.out), ' ');
+		const unsigned indent = sink.indent >= 0 ? static_cast<unsigned>(sink.indent) : 0;
+		serializer.dump(value, sink.indent >= 0, false, indent, indent * depth);
+	}
+	catch (const nlohmann::json::exception& e) {
+		return Report(sink.error, e.what());
+	}
+	return true;
+}
+
+void JsonReflect::WriteCborHead(std::string& out, uint8_t major, uint64_t value)
+{
+	const char type = static_cast<char>(major << 5);
+	if (value <= 0x17) {
+		out.push_back(static_cast<char>(type | value));
+		return;
+	}
+
+	int bytes;
+	if (value <= 0xFF) {
+		out.push_back(static_cast<char>(type | 0x18));
+		bytes = 1;
+	}
+	else if (value <= 0xFFFF) {
+		out.push_back(static_cast<char>(type | 0x19));
+		bytes = 2;
+	}
+	else if (value <= 0xFFFFFFFF) {
+		out.push_back(static_cast<char>(type | 0x1A));
+		bytes = 4;
+	}
+	else {
+		out.push_back(static_cast<char>(type | 0x1B));
+		bytes = 8;
+	}
+	for (int shift = (bytes - 1) * 8; shift >= 0; shift -= 8) {
+		out.push_back(static_cast<char>((value >> shift) & 0xFF));
+	}
+}
+
+void JsonReflect::WriteCborDouble(std::string& out, double value)
+{
+	// Mirrors to_cbor: half-precision NaN and infinities, single precision when exact
+	if (std::isnan(value)) {
+		out.append("\xF9\x7E\x00", 3);
+		return;
+	}
+	if (std::isinf(value)) {
+		out.append(value > 0 ? "\xF9\x7C\x00" : "\xF9\xFC\x00", 3);
+		return;
+	}
+
+	const float narrow = static_cast<float>(value);
+	if (value >= static_cast<double>(std::numeric_limits<float>::lowest()) && value <= static_cast<double>((std::numeric_limits<float>::max)()) &&
+		static_cast<double>(narrow) == value) {
+		uint32_t bits;
+		memcpy(&bits, &narrow, sizeof(bits));
+		out.push_back(static_cast<char>(0xFA));
+		for (int shift = 24; shift >= 0; shift -= 8) {
+			out.push_back(static_cast<char>((bits >> shift) & 0xFF));
+		}
+		return;
+	}
+
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	out.push_back(static_cast<char>(0xFB));
+	for (int shift = 56; shift >= 0; shift -= 8) {
+		out.push_back(static_cast<char>((bits >> shift) & 0xFF));
+	}
+}
+
+bool JsonReflect::WriteCborFallback(std::string& out, const nlohmann::json& value, std::string* error)
+{
+	try {
+		nlohmann::json::to_cbor(value, nlohmann::detail::output_adapter<char>(out));
+	}
+	catch (const nlohmann::json::exception& e) {
+		return Report(error, e.what());
+	}
+	return true;
+}
+
@@ -0,0 +1,620 @@
+#pragma once
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "../utils/utilities.h"
+#include "../io/mapped_file.h"
+
+// Drop-in replacements for the NLOHMANN_DEFINE_TYPE_* macros. They expand to the nlohmann
+// macro of the same name, so to_json/from_json keep working, and additionally describe the
+// fields to JsonReflect, which then reads and writes the type without building a DOM.
+#define UTILITIES_DEFINE_TYPE_INTRUSIVE(Type, ...) \
+	NLOHMANN_DEFINE_TYPE_INTRUSIVE(Type, __VA_ARGS__) \
+	friend auto UtilitiesJsonFields(const Type*) UTILITIES_JSON_FIELDS(Type, __VA_ARGS__)
+
+#define UTILITIES_DEFINE_TYPE_INTRUSIVE_WITH_DEFAULT(Type, ...) \
+	NLOHMANN_DEFINE_TYPE_INTRUSIVE_WITH_DEFAULT(Type, __VA_ARGS__) \
+	friend auto UtilitiesJsonFields(const Type*) UTILITIES_JSON_FIELDS(Type, __VA_ARGS__) \
+	friend constexpr bool UtilitiesJsonWithDefault(const Type*) { return true; }
+
+#define UTILITIES_DEFINE_TYPE_NON_INTRUSIVE(Type, ...) \
+	NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(Type, __VA_ARGS__) \
+	inline auto UtilitiesJsonFields(const Type*) UTILITIES_JSON_FIELDS(Type, __VA_ARGS__)
+
+#define UTILITIES_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(Type, ...) \
+	NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(Type, __VA_ARGS__) \
+	inline auto UtilitiesJsonFields(const Type*) UTILITIES_JSON_FIELDS(Type, __VA_ARGS__) \
+	inline constexpr bool UtilitiesJsonWithDefault(const Type*) { return true; }
+
+#define UTILITIES_JSON_FIELD(v1) , std::make_tuple(MakeJsonField(#v1, &UtilitiesJsonSelf::v1))
+#define UTILITIES_JSON_FIELDS(Type, ...) \
+	{ \
+		using UtilitiesJsonSelf = Type; \
+		return std::tuple_cat(std::tuple<>() NLOHMANN_JSON_EXPAND(NLOHMANN_JSON_PASTE(UTILITIES_JSON_FIELD, __VA_ARGS__))); \
+	}
+
+template <typename Class, typename Member>
+struct JsonField
+{
+	const char* name;
+	Member Class::* member;
+};
+
+template <typename Class, typename Member>
+constexpr JsonField<Class, Member> MakeJsonField(const char* name, Member Class::* member)
+{
+	return { name, member };
+}
+
+// Pull tokenizer over JSON text. Every Read* skips leading whitespace, consumes one token
+// and returns false with Error() set on malformed input. The first error sticks.
+class JsonTokenReader
+{
+public:
+	explicit JsonTokenReader(std::string_view text)
+		: m_Text(text)
+	{
+	}
+
+	// Next significant character without consuming it, 0 at the end of the input
+	char Peek();
+	// Consumes c if it is the next significant character
+	bool Consume(char c);
+	bool Expect(char c);
+	bool AtEnd();
+
+	bool ReadNull();
+	bool ReadBool(bool& value);
+	// A view into the text when the string has no escapes, otherwise decoded into scratch
+	bool ReadString(std::string_view& value, std::string& scratch);
+	bool ReadString(std::string& value);
+	// The number token as written, checked against the JSON grammar
+	bool ReadNumber(std::string_view& token);
+
+	template <typename T>
+	bool ReadNumber(T& value);
+
+	bool SkipValue();
+	// Skips one value and returns its source text
+	bool RawValue(std::string_view& raw);
+
+	bool Fail(std::string_view message);
+	bool Failed() const { return !m_Error.empty(); }
+	const std::string& Error() const { return m_Error; }
+
+private:
+	void SkipWhitespace();
+	bool ReadLiteral(std::string_view literal);
+
+	std::string_view m_Text;
+	size_t m_Position = 0;
+	std::string m_Error;
+};
+
+template <typename T>
+bool JsonTokenReader::ReadNumber(T& value)
+{
+	std::string_view token;
+	if (!ReadNumber(token)) {
+		return false;
+	}
+
+	const char* begin = token.data();
+	const char* end = token.data() + token.size();
+	if constexpr (std::is_floating_point_v<T>) {
+		double parsed = 0;
+		if (std::from_chars(begin, end, parsed).ec != std::errc()) {
+			return Fail("number is out of range");
+		}
+		value = static_cast<T>(parsed);
+		return true;
+	}
+	else {
+		// Like nlohmann, a fractional number converts to an integer by truncation
+		if (token.find_first_of(".eE") != std::string_view::npos) {
+			double parsed = 0;
+			if (std::from_chars(begin, end, parsed).ec != std::errc() ||
+				!(parsed >= static_cast<double>((std::numeric_limits<T>::min)()) && parsed <= static_cast<double>((std::numeric_limits<T>::max)()))) {
+				return Fail("number is out of range");
+			}
+			value = static_cast<T>(parsed);
+			return true;
+		}
+		const auto result = std::from_chars(begin, end, value);
+		if (result.ec != std::errc() || result.ptr != end) {
+			return Fail("number is out of range");
+		}
+		return true;
+	}
+}
+
+// Reads and writes types declared with the UTILITIES_DEFINE_TYPE_* macros straight from and
+// to text or CBOR. Reflected structs, arithmetic types, std::string, std::optional,
+// std::vector, std::array and string-keyed maps are handled directly. Anything else goes
+// through nlohmann's own to_json/from_json for just that value, so enums declared with
+// NLOHMANN_JSON_SERIALIZE_ENUM or members of type nlohmann::json still work.
+//
+// Reading follows from_json: unknown keys are skipped, missing keys fail unless the type
+// was declared WITH_DEFAULT. Writing emits fields in declaration order, where dumping an
+// nlohmann::json would sort them.
+class JsonReflect
+{
+public:
+	template <typename T>
+	static bool Read(std::string_view text, T& value, std::string* error = nullptr);
+	// Maps the file and reads from it. On failure the reason goes to *error when given, to
+	// the log otherwise.
+	template <typename T>
+	static bool Load(const std::string& filename, T& value, std::string* error = nullptr);
+
+	// Appends the text form of value to out, indent works as in JsonSaveOptions
+	template <typename T>
+	static bool WriteText(const T& value, std::string& out, int indent = -1, std::string* error = nullptr);
+	// Appends the CBOR encoding nlohmann::json::to_cbor would produce, apart from key order
+	template <typename T>
+	static bool WriteCbor(const T& value, std::string& out, std::string* error = nullptr);
+	// Text and CBOR are written directly, the other formats fall back to SaveToJson
+	template <typename T>
+	static bool Save(const T& value, const std::string& filename, const JsonSaveOptions& options = {}, std::string* error = nullptr);
+
+private:
+	template <typename T>
+	static constexpr bool IsReflected = requires(const T* type) { UtilitiesJsonFields(type); };
+	template <typename T>
+	static constexpr bool HasDefaults = requires(const T* type) { UtilitiesJsonWithDefault(type); };
+
+	template <typename T>
+	struct Traits
+	{
+		static constexpr bool vector = false, array = false, map = false, optional = false;
+	};
+	template <typename U, typename A>
+	struct Traits<std::vector<U, A>>
+	{
+		static constexpr bool vector = true, array = false, map = false, optional = false;
+		using Element = U;
+	};
+	template <typename U, size_t N>
+	struct Traits<std::array<U, N>>
+	{
+		static constexpr bool vector = false, array = true, map = false, optional = false;
+		using Element = U;
+	};
+	template <typename V, typename C, typename A>
+	struct Traits<std::map<std::string, V, C, A>>
+	{
+		static constexpr bool vector = false, array = false, map = true, optional = false;
+		using Element = V;
+	};
+	template <typename V, typename H, typename E, typename A>
+	struct Traits<std::unordered_map<std::string, V, H, E, A>>
+	{
+		static constexpr bool vector = false, array = false, map = true, optional = false;
+		using Element = V;
+	};
+	template <typename U>
+	struct Traits<std::optional<U>>
+	{
+		static constexpr bool vector = false, array = false, map = false, optional = true;
+		using Element = U;
+	};
+
+	struct TextSink
+	{
+		std::string& out;
+		int indent;
+		std::string* error;
+	};
+
+	template <typename T>
+	static bool ReadValue(JsonTokenReader& reader, T& value);
+	template <typename T>
+	static bool ReadObject(JsonTokenReader& reader, T& value);
+
+	template <typename T>
+	static bool WriteTextValue(TextSink& sink, const T& value, unsigned depth);
+	template <typename T>
+	static bool WriteCborValue(std::string& out, const T& value, std::string* error);
+
+	static bool Report(std::string* error, const std::string& message);
+	static void NewLine(TextSink& sink, unsigned depth);
+	static bool WriteTextString(TextSink& sink, std::string_view value);
+	static void WriteTextDouble(std::string& out, double value);
+	static bool WriteTextFallback(TextSink& sink, const nlohmann::json& value, unsigned depth);
+	static void WriteCborHead(std::string& out, uint8_t major, uint64_t value);
+	static void WriteCborDouble(std::string& out, double value);
+	static bool WriteCborFallback(std::string& out, const nlohmann::json& value, std::string* error);
+};
+
+template <typename T>
+bool JsonReflect::Read(std::string_view text, T& value, std::string* error)
+{
+	// Validating the whole input up front is cheaper than checking every string on its own
+	if (!Encoding::ValidateUtf8(text)) {
+		return Report(error, "input is not valid UTF-8");
+	}
+
+	JsonTokenReader reader(text);
+	if (!ReadValue(reader, value) || (!reader.AtEnd() && !reader.Fail("unexpected data after the value"))) {
+		return Report(error, reader.Error());
+	}
+	return true;
+}
+
+template <typename T>
+bool JsonReflect::Load(const std::string& filename, T& value, std::string* error)
+{
+	MappedFile file;
+	std::string message;
+	if (!file.Open(filename, &message) || !Read(file.View(), value, &message)) {
+		if (error) *error = message;
+		else Logger::Error("Failed loading ", filename, " from json: ", message);
+		return false;
+	}
+	return true;
+}
+
+template <typename T>
+bool JsonReflect::WriteText(const T& value, std::string& out, int indent, std::string* error)
+{
+	TextSink sink{ out, indent, error };
+	return WriteTextValue(sink, value, 0);
+}
+
+template <typename T>
+bool JsonReflect::WriteCbor(const T& value, std::string& out, std::string* error)
+{
+	return WriteCborValue(out, value, error);
+}
+
+template <typename T>
+bool JsonReflect::Save(const T& value, const std::string& filename, const JsonSaveOptions& options, std::string* error)
+{
+	JsonFormat format = options.format;
+	if (format == JsonFormat::Auto) {
+		format = Utilities::DetectJsonFormat({}, filename);
+	}
+
+	std::string content;
+	std::string message;
+	bool written;
+	if (format == JsonFormat::Text) {
+		written = WriteText(value, content, options.indent, &message);
+	}
+	else if (format == JsonFormat::Cbor) {
+		// Same self-describe tag SaveToJson writes, so LoadFromJson recognizes the file
+		content = "\xD9\xD9\xF7";
+		written = WriteCbor(value, content, &message);
+	}
+	else {
+		return Utilities::SaveToJson(nlohmann::json(value), filename, options, error);
+	}
+
+	if (!written || !Utilities::WriteJsonFile(filename, content, options, &message)) {
+		if (error) *error = message;
+		else Logger::Error("Failed saving ", filename, " to json: ", message);
+		return false;
+	}
+	return true;
+}
+
+template <typename T>
+bool JsonReflect::ReadValue(JsonTokenReader& reader, T& value)
+{
+	if constexpr (IsReflected<T>) {
+		return ReadObject(reader, value);
+	}
+	else if constexpr (std::is_same_v<T, bool>) {
+		return reader.ReadBool(value);
+	}
+	else if constexpr (std::is_arithmetic_v<T>) {
+		return reader.ReadNumber(value);
+	}
+	else if constexpr (std::is_same_v<T, std::string>) {
+		return reader.ReadString(value);
+	}
+	else if constexpr (Traits<T>::optional) {
+		if (reader.Peek() == 'n') {
+			value.reset();
+			return reader.ReadNull();
+		}
+		return ReadValue(reader, value.emplace());
+	}
+	else if constexpr (Traits<T>::vector || Traits<T>::array) {
+		if (!reader.Expect('[')) {
+			return false;
+		}
+		if constexpr (Traits<T>::vector) {
+			value.clear();
+		}
+		size_t count = 0;
+		if (!reader.Consume(']')) {
+			do {
+				if constexpr (Traits<T>::vector) {
+					typename Traits<T>::Element element{};
+					if (!ReadValue(reader, element)) {
+						return false;
+					}
+					value.push_back(std::move(element));
+				}
+				else {
+					if (count >= value.size()) {
+						return reader.Fail("array has too many elements");
+					}
+					if (!ReadValue(reader, value[count])) {
+						return false;
+					}
+				}
+				++count;
+			} while (reader.Consume(','));
+			if (!reader.Expect(']')) {
+				return false;
+			}
+		}
+		if constexpr (Traits<T>::array) {
+			if (count != value.size()) {
+				return reader.Fail("array has too few elements");
+			}
+		}
+		return true;
+	}
+	else if constexpr (Traits<T>::map) {
+		if (!reader.Expect('{')) {
+			return false;
+		}
+		value.clear();
+		if (reader.Consume('}')) {
+			return true;
+		}
+		std::string key;
+		do {
+			if (!reader.ReadString(key) || !reader.Expect(':')) {
+				return false;
+			}
+			typename Traits<T>::Element element{};
+			if (!ReadValue(reader, element)) {
+				return false;
+			}
+			value.insert_or_assign(std::move(key), std::move(element));
+		} while (reader.Consume(','));
+		return reader.Expect('}');
+	}
+	else {
+		std::string_view raw;
+		if (!reader.RawValue(raw)) {
+			return false;
+		}
+		try {
+			nlohmann::json::parse(raw.begin(), raw.end()).get_to(value);
+		}
+		catch (const nlohmann::json::exception& e) {
+			return reader.Fail(e.what());
+		}
+		return true;
+	}
+}
+
+template <typename T>
+bool JsonReflect::ReadObject(JsonTokenReader& reader, T& value)
+{
+	const auto fields = UtilitiesJsonFields(static_cast<const T*>(nullptr));
+	constexpr size_t fieldCount = std::tuple_size_v<std::remove_const_t<decltype(fields)>>;
+	static_assert(fieldCount <= 64, "JsonReflect supports up to 64 fields per type");
+
+	if (!reader.Expect('{')) {
+		return false;
+	}
+
+	uint64_t seen = 0;
+	if (!reader.Consume('}')) {
+		std::string scratch;
+		do {
+			std::string_view key;
+			if (!reader.ReadString(key, scratch) || !reader.Expect(':')) {
+				return false;
+			}
+
+			bool matched = false;
+			bool ok = true;
+			std::apply([&](const auto&... field) {
+				size_t index = 0;
+				((!matched && key == field.name
+					? (matched = true, seen |= uint64_t(1) << index, ok = ReadValue(reader, value.*(field.member)))
+					: false, ++index), ...);
+			}, fields);
+
+			if (!ok || (!matched && !reader.SkipValue())) {
+				return false;
+			}
+		} while (reader.Consume(','));
+		if (!reader.Expect('}')) {
+			return false;
+		}
+	}
+
+	if constexpr (!HasDefaults<T>) {
+		const uint64_t all = fieldCount == 64 ? ~uint64_t(0) : (uint64_t(1) << fieldCount) - 1;
+		if (seen != all) {
+			std::string_view missing;
+			std::apply([&](const auto&... field) {
+				size_t index = 0;
+				((missing.empty() && !(seen & (uint64_t(1) << index)) ? (missing = field.name, 0) : 0, ++index), ...);
+			}, fields);
+			return reader.Fail(Utilities::Stringify("key '", missing, "' not found"));
+		}
+	}
+	return true;
+}
+
+template <typename T>
+bool JsonReflect::WriteTextValue(TextSink& sink, const T& value, unsigned depth)
+{
+	std::string& out = sink.out;
+	if constexpr (IsReflected<T>) {
+		const auto fields = UtilitiesJsonFields(static_cast<const T*>(nullptr));
+		bool ok = true;
+		bool first = true;
+		out.push_back('{');
+		std::apply([&](const auto&... field) {
+			((ok = ok && [&] {
+				if (!first) out.push_back(',');
+				first = false;
+				NewLine(sink, depth + 1);
+				if (!WriteTextString(sink, field.name)) return false;
+				out.append(sink.indent >= 0 ? ": " : ":");
+				return WriteTextValue(sink, value.*(field.member), depth + 1);
+			}()), ...);
+		}, fields);
+		NewLine(sink, depth);
+		out.push_back('}');
+		return ok;
+	}
+	else if constexpr (std::is_same_v<T, bool>) {
+		out.append(value ? "true" : "false");
+		return true;
+	}
+	else if constexpr (std::is_floating_point_v<T>) {
+		WriteTextDouble(out, static_cast<double>(value));
+		return true;
+	}
+	else if constexpr (std::is_arithmetic_v<T>) {
+		char buffer[24];
+		const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+		out.append(buffer, result.ptr);
+		return true;
+	}
+	else if constexpr (std::is_same_v<T, std::string>) {
+		return WriteTextString(sink, value);
+	}
+	else if constexpr (Traits<T>::optional) {
+		if (!value) {
+			out.append("null");
+			return true;
+		}
+		return WriteTextValue(sink, *value, depth);
+	}
+	else if constexpr (Traits<T>::vector || Traits<T>::array) {
+		if (value.empty()) {
+			out.append("[]");
+			return true;
+		}
+		out.push_back('[');
+		bool first = true;
+		for (const auto& element : value) {
+			if (!first) out.push_back(',');
+			first = false;
+			NewLine(sink, depth + 1);
+			if (!WriteTextValue(sink, static_cast<const typename Traits<T>::Element&>(element), depth + 1)) {
+				return false;
+			}
+		}
+		NewLine(sink, depth);
+		out.push_back(']');
+		return true;
+	}
+	else if constexpr (Traits<T>::map) {
+		if (value.empty()) {
+			out.append("{}");
+			return true;
+		}
+		out.push_back('{');
+		bool first = true;
+		for (const auto& [key, element] : value) {
+			if (!first) out.push_back(',');
+			first = false;
+			NewLine(sink, depth + 1);
+			if (!WriteTextString(sink, key)) {
+				return false;
+			}
+			out.append(sink.indent >= 0 ? ": " : ":");
+			if (!WriteTextValue(sink, element, depth + 1)) {
+				return false;
+			}
+		}
+		NewLine(sink, depth);
+		out.push_back('}');
+		return true;
+	}
+	else {
+		return WriteTextFallback(sink, nlohmann::json(value), depth);
+	}
+}
+
+template <typename T>
+bool JsonReflect::WriteCborValue(std::string& out, const T& value, std::string* error)
+{
+	if constexpr (IsReflected<T>) {
+		const auto fields = UtilitiesJsonFields(static_cast<const T*>(nullptr));
+		WriteCborHead(out, 5, std::tuple_size_v<std::remove_const_t<decltype(fields)>>);
+		bool ok = true;
+		std::apply([&](const auto&... field) {
+			((ok = ok && (WriteCborHead(out, 3, std::char_traits<char>::length(field.name)), out.append(field.name),
+				WriteCborValue(out, value.*(field.member), error))), ...);
+		}, fields);
+		return ok;
+	}
+	else if constexpr (std::is_same_v<T, bool>) {
+		out.push_back(static_cast<char>(value ? 0xF5 : 0xF4));
+		return true;
+	}
+	else if constexpr (std::is_floating_point_v<T>) {
+		WriteCborDouble(out, static_cast<double>(value));
+		return true;
+	}
+	else if constexpr (std::is_integral_v<T>) {
+		if constexpr (std::is_signed_v<T>) {
+			if (value < 0) {
+				WriteCborHead(out, 1, static_cast<uint64_t>(-1 - static_cast<int64_t>(value)));
+				return true;
+			}
+		}
+		WriteCborHead(out, 0, static_cast<uint64_t>(value));
+		return true;
+	}
+	else if constexpr (std::is_same_v<T, std::string>) {
+		WriteCborHead(out, 3, value.size());
+		out.append(value);
+		return true;
+	}
+	else if constexpr (Traits<T>::optional) {
+		if (!value) {
+			out.push_back(static_cast<char>(0xF6));
+			return true;
+		}
+		return WriteCborValue(out, *value, error);
+	}
+	else if constexpr (Traits<T>::vector || Traits<T>::array) {
+		WriteCborHead(out, 4, value.size());
+		for (const auto& element : value) {
+			if (!WriteCborValue(out, static_cast<const typename Traits<T>::Element&>(element), error)) {
+				return false;
+			}
+		}
+		return true;
+	}
+	else if constexpr (Traits<T>::map) {
+		WriteCborHead(out, 5, value.size());
+		for (const auto& [key, element] : value) {
+			WriteCborHead(out, 3, key.size());
+			out.append(key);
+			if (!WriteCborValue(out, element, error)) {
+				return false;
+			}
+		}
+		return true;
+	}
+	else {
+		return WriteCborFallback(out, nlohmann::json(value), error);
+	}
+}
@@ -0,0 +1,935 @@
+#include "json_schema.h"
+#include "../io/mapped_file.h"
+#include "../utils/utilities.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+namespace
+{
+	using json = nlohmann::json;
+
+	std::string EscapeToken(const std::string& token)
+	{
+		std::string escaped;
+		for (char c : token) {
+			if (c == '~') escaped += "~0";
+			else if (c == '/') escaped += "~1";
+			else escaped.push_back(c);
+		}
+		return escaped;
+	}
+
+	std::string PathString(const std::vector<std::string>& path)
+	{
+		if (path.empty()) {
+			return "root";
+		}
+		std::string pointer;
+		for (const std::string& token : path) {
+			pointer += '/';
+			pointer += EscapeToken(token);
+		}
+		return pointer;
+	}
+
+	uint8_t InstanceTypes(const json& instance)
+	{
+		switch (instance.type()) {
+		case json::value_t::null: return 1 << 0;
+		case json::value_t::boolean: return 1 << 1;
+		case json::value_t::number_integer:
+		case json::value_t::number_unsigned: return (1 << 2) | (1 << 3);
+		case json::value_t::number_float: {
+			// 1.0 counts as an integer, as in every draft since 6
+			const double value = instance.get<double>();
+			return std::isfinite(value) && std::floor(value) == value ? (1 << 2) | (1 << 3) : 1 << 3;
+		}
+		case json::value_t::string: return 1 << 4;
+		case json::value_t::array: return 1 << 5;
+		case json::value_t::object: return 1 << 6;
+		default: return 0;
+		}
+	}
+
+	std::string TypeNames(uint8_t types)
+	{
+		static const char* const kNames[] = { "null", "boolean", "integer", "number", "string", "array", "object" };
+		std::string names;
+		for (int i = 0; i < 7; ++i) {
+			if (types & (1 << i)) {
+				if (!names.empty()) names += " or ";
+				names += kNames[i];
+			}
+		}
+		return names;
+	}
+
+	size_t CodePoints(const std::string& text)
+	{
+		size_t count = 0;
+		for (unsigned char c : text) {
+			count += (c & 0xC0) != 0x80;
+		}
+		return count;
+	}
+
+	bool IsMultipleOf(const json& instance, double divisor)
+	{
+		if (instance.is_number_integer() && std::floor(divisor) == divisor && std::fabs(divisor) < 9.2e18) {
+			const long long d = static_cast<long long>(divisor);
+			if (instance.is_number_unsigned()) {
+				return instance.get<uint64_t>() % static_cast<uint64_t>(d) == 0;
+			}
+			return instance.get<long long>() % d == 0;
+		}
+		const double quotient = instance.get<double>() / divisor;
+		return std::isfinite(quotient) && std::fabs(quotient - std::round(quotient)) < 1e-9;
+	}
+}
+
+// Validates inside nlohmann's SAX parser. Containers whose schema can be checked one event
+// at a time get a frame, everything else is captured into a DOM and handed to the DOM
+// validator once complete.
+class JsonSchemaSax
+{
+public:
+	explicit JsonSchemaSax(const JsonSchema& schema)
+		: m_Schema(schema)
+	{
+	}
+
+	const std::string& Error() const { return m_Error; }
+
+	bool null() { return Scalar(nullptr); }
+	bool boolean(bool value) { return Scalar(value); }
+	bool number_integer(json::number_integer_t value) { return Scalar(value); }
+	bool number_unsigned(json::number_unsigned_t value) { return Scalar(value); }
+	bool number_float(json::number_float_t value, const json::string_t&) { return Scalar(value); }
+	bool string(json::string_t& value) { return Scalar(value); }
+	bool binary(json::binary_t& value) { return Scalar(value); }
+
+	bool start_object(std::size_t length)
+	{
+		if (m_Capture) {
+			++m_CaptureDepth;
+			return m_Capture->start_object(length);
+		}
+		BeginValue();
+		if (NeedsCapture()) {
+			return StartCapture() && m_Capture->start_object(length);
+		}
+
+		Frame frame;
+		frame.node = m_Nodes.empty() ? JsonSchema::kNone : m_Nodes.front();
+		frame.object = true;
+		if (frame.node != JsonSchema::kNone) {
+			const JsonSchema::Node& node = m_Schema.m_Nodes[frame.node];
+			if (!CheckStart(node, JsonSchema::TypeObject)) {
+				return false;
+			}
+			frame.seen.assign(node.required.size(), false);
+		}
+		m_Frames.push_back(std::move(frame));
+		return true;
+	}
+
+	bool key(json::string_t& value)
+	{
+		if (m_Capture) {
+			return m_Capture->key(value);
+		}
+
+		Frame& frame = m_Frames.back();
+		frame.key = value;
+		if (frame.node == JsonSchema::kNone) {
+			return true;
+		}
+
+		const JsonSchema::Node& node = m_Schema.m_Nodes[frame.node];
+		for (size_t i = 0; i < node.required.size(); ++i) {
+			if (node.required[i] == value) {
+				frame.seen[i] = true;
+			}
+		}
+		if (node.propertyNames != JsonSchema::kNone) {
+			m_Path.push_back(value);
+			const bool valid = m_Schema.ValidateNode(node.propertyNames, json(value), m_Path, &m_Error);
+			m_Path.pop_back();
+			return valid;
+		}
+		return true;
+	}
+
+	bool end_object()
+	{
+		if (m_Capture) {
+			return m_Capture->end_object() && EndCaptured();
+		}
+
+		Frame frame = std::move(m_Frames.back());
+		m_Frames.pop_back();
+		if (frame.node != JsonSchema::kNone) {
+			const JsonSchema::Node& node = m_Schema.m_Nodes[frame.node];
+			for (size_t i = 0; i < node.required.size(); ++i) {
+				if (!frame.seen[i]) {
+					return Fail(Utilities::Stringify("required property '", node.required[i], "' is missing"));
+				}
+			}
+			if (node.minProperties && frame.count < *node.minProperties) {
+				return Fail(Utilities::Stringify("has ", frame.count, " properties, fewer than ", *node.minProperties));
+			}
+			if (node.maxProperties && frame.count > *node.maxProperties) {
+				return Fail(Utilities::Stringify("has ", frame.count, " properties, more than ", *node.maxProperties));
+			}
+		}
+		EndValue();
+		return true;
+	}
+
+	bool start_array(std::size_t length)
+	{
+		if (m_Capture) {
+			++m_CaptureDepth;
+			return m_Capture->start_array(length);
+		}
+		BeginValue();
+		if (NeedsCapture()) {
+			return StartCapture() && m_Capture->start_array(length);
+		}
+
+		Frame frame;
+		frame.node = m_Nodes.empty() ? JsonSchema::kNone : m_Nodes.front();
+		if (frame.node != JsonSchema::kNone && !CheckStart(m_Schema.m_Nodes[frame.node], JsonSchema::TypeArray)) {
+			return false;
+		}
+		m_Frames.push_back(std::move(frame));
+		return true;
+	}
+
+	bool end_array()
+	{
+		if (m_Capture) {
+			return m_Capture->end_array() && EndCaptured();
+		}
+
+		Frame frame = std::move(m_Frames.back());
+		m_Frames.pop_back();
+		if (frame.node != JsonSchema::kNone) {
+			const JsonSchema::Node& node = m_Schema.m_Nodes[frame.node];
+			if (node.minItems && frame.count < *node.minItems) {
+				return Fail(Utilities::Stringify("has ", frame.count, " items, fewer than ", *node.minItems));
+			}
+			if (node.maxItems && frame.count > *node.maxItems) {
+				return Fail(Utilities::Stringify("has ", frame.count, " items, more than ", *node.maxItems));
+			}
+		}
+		EndValue();
+		return true;
+	}
+
+	bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception& e)
+	{
+		if (m_Error.empty()) {
+			m_Error = e.what();
+		}
+		return false;
+	}
+
+private:
+	struct Frame
+	{
+		int node = JsonSchema::kNone;
+		bool object = false;
+		size_t count = 0;
+		std::vector<bool> seen;
+		std::string key;
+	};
+
+	// Works out which schemas apply to the value that is starting and pushes its path token
+	void BeginValue()
+	{
+		m_Nodes.clear();
+		if (m_Frames.empty()) {
+			m_Nodes.push_back(m_Schema.Target(0));
+			return;
+		}
+
+		Frame& parent = m_Frames.back();
+		m_Path.push_back(parent.object ? parent.key : std::to_string(parent.count));
+		if (parent.node == JsonSchema::kNone) {
+			return;
+		}
+
+		const JsonSchema::Node& node = m_Schema.m_Nodes[parent.node];
+		if (!parent.object) {
+			m_Nodes.push_back(m_Schema.ItemNode(node, parent.count));
+		}
+		else {
+			// A key can fall under properties and any number of patternProperties at once
+			const auto it = std::lower_bound(node.properties.begin(), node.properties.end(), parent.key,
+				[](const std::pair<std::string, int>& entry, const std::string& key) { return entry.first < key; });
+			const bool named = it != node.properties.end() && it->first == parent.key;
+			if (named) {
+				m_Nodes.push_back(it->second);
+			}
+			bool patterned = false;
+			for (const auto& [pattern, child] : node.patternProperties) {
+				if (std::regex_search(parent.key, pattern)) {
+					m_Nodes.push_back(child);
+					patterned = true;
+				}
+			}
+			if (!named && !patterned) {
+				m_Nodes.push_back(node.additionalProperties);
+			}
+		}
+
+		m_Nodes.erase(std::remove(m_Nodes.begin(), m_Nodes.end(), JsonSchema::kNone), m_Nodes.end());
+		for (int& index : m_Nodes) {
+			index = m_Schema.Target(index);
+		}
+	}
+
+	void EndValue()
+	{
+		if (!m_Frames.empty()) {
+			++m_Frames.back().count;
+			m_Path.pop_back();
+		}
+	}
+
+	bool NeedsCapture() const
+	{
+		return m_Nodes.size() > 1 || (m_Nodes.size() == 1 && !m_Schema.m_Nodes[m_Nodes.front()].streamable);
+	}
+
+	bool CheckStart(const JsonSchema::Node& node, uint8_t type)
+	{
+		if (node.reject) {
+			return Fail("no value is allowed here");
+		}
+		if (!(node.types & type)) {
+			return Fail(Utilities::Stringify("expected ", TypeNames(node.types), ", got ", TypeNames(type)));
+		}
+		return true;
+	}
+
+	bool Scalar(const json& value)
+	{
+		if (m_Capture) {
+			json copy = value;
+			return ForwardScalar(copy);
+		}
+		BeginValue();
+		for (int node : m_Nodes) {
+			if (!m_Schema.ValidateNode(node, value, m_Path, &m_Error)) {
+				return false;
+			}
+		}
+		EndValue();
+		return true;
+	}
+
+	bool ForwardScalar(json& value)
+	{
+		switch (value.type()) {
+		case json::value_t::null: return m_Capture->null();
+		case json::value_t::boolean: return m_Capture->boolean(value.get<bool>());
+		case json::value_t::number_integer: return m_Capture->number_integer(value.get<json::number_integer_t>());
+		case json::value_t::number_unsigned: return m_Capture->number_unsigned(value.get<json::number_unsigned_t>());
+		case json::value_t::number_float: return m_Capture->number_float(value.get<double>(), {});
+		case json::value_t::string: return m_Capture->string(value.get_ref<json::string_t&>());
+		default: return m_Capture->binary(value.get_ref<json::binary_t&>());
+		}
+	}
+
+	bool StartCapture()
+	{
+		m_Captured = json();
+		m_Capture = std::make_unique<nlohmann::detail::json_sax_dom_parser<json>>(m_Captured, false);
+		m_CaptureNodes = m_Nodes;
+		m_CaptureDepth = 1;
+		return true;
+	}
+
+	bool EndCaptured()
+	{
+		if (--m_CaptureDepth > 0) {
+			return true;
+		}
+		m_Capture.reset();
+		for (int node : m_CaptureNodes) {
+			if (!m_Schema.ValidateNode(node, m_Captured, m_Path, &m_Error)) {
+				return false;
+			}
+		}
+		m_Captured = json();
+		EndValue();
+		return true;
+	}
+
+	bool Fail(const std::string& message)
+	{
+		JsonSchema::Report(&m_Error, m_Path, message);
+		return false;
+	}
+
+	const JsonSchema& m_Schema;
+	std::vector<Frame> m_Frames;
+	std::vector<std::string> m_Path;
+	std::vector<int> m_Nodes;
+
+	json m_Captured;
+	std::unique_ptr<nlohmann::detail::json_sax_dom_parser<json>> m_Capture;
+	std::vector<int> m_CaptureNodes;
+	size_t m_CaptureDepth = 0;
+
+	std::string m_Error;
+};
+
+bool JsonSchema::Compile(const nlohmann::json& schema, std::string* error)
+{
+	m_Root = schema;
+	m_Nodes.clear();
+	m_Compiled.clear();
+
+	std::string message;
+	if (CompileNode(m_Root, "", message) == kNone) {
+		m_Nodes.clear();
+		if (error) *error = message;
+		return false;
+	}
+
+	// A $ref chain that only leads back to itself would never reach a real node
+	for (size_t i = 0; i < m_Nodes.size(); ++i) {
+		int index = static_cast<int>(i);
+		for (size_t steps = 0; m_Nodes[index].ref != kNone; ++steps) {
+			if (steps > m_Nodes.size()) {
+				m_Nodes.clear();
+				if (error) *error = "$ref cycle that never reaches a schema";
+				return false;
+			}
+			index = m_Nodes[index].ref;
+		}
+	}
+	return true;
+}
+
+bool JsonSchema::Validate(const nlohmann::json& instance, std::string* error) const
+{
+	if (m_Nodes.empty()) {
+		if (error) *error = "the schema is not compiled";
+		return false;
+	}
+	std::vector<std::string> path;
+	return ValidateNode(0, instance, path, error);
+}
+
+bool JsonSchema::ValidateText(std::string_view text, std::string* error) const
+{
+	if (m_Nodes.empty()) {
+		if (error) *error = "the schema is not compiled";
+		return false;
+	}
+
+	JsonSchemaSax sax(*this);
+	const bool valid = json::sax_parse(text.data(), text.data() + text.size(), &sax);
+	if (!valid && error) {
+		*error = sax.Error();
+	}
+	return valid;
+}
+
+bool JsonSchema::ValidateFile(const std::string& filename, std::string* error) const
+{
+	MappedFile file;
+	std::string message;
+	if (!file.Open(filename, &message)) {
+		if (error) *error = message;
+		return false;
+	}
+	return ValidateText(file.View(), error);
+}
+
+int JsonSchema::CompileNode(const nlohmann::json& schema, const std::string& pointer, std::string& error)
+{
+	const int index = static_cast<int>(m_Nodes.size());
+	m_Nodes.emplace_back();
+	m_Compiled.emplace_back(pointer, index);
+
+	auto fail = [&](const std::string& message) {
+		error = Utilities::Stringify(pointer.empty() ? "#" : "#" + pointer, ": ", message);
+		return kNone;
+	};
+	auto child = [&](const json& value, const std::string& suffix) {
+		return CompileNode(value, pointer + suffix, error);
+	};
+	auto size = [&](const char* keyword, std::optional<size_t>& target) {
+		const auto it = schema.find(keyword);
+		if (it == schema.end()) {
+			return true;
+		}
+		if (!it->is_number_unsigned() && !(it->is_number_integer() && it->get<long long>() >= 0)) {
+			return false;
+		}
+		target = it->get<size_t>();
+		return true;
+	};
+	auto number = [&](const char* keyword, std::optional<double>& target) {
+		const auto it = schema.find(keyword);
+		if (it == schema.end()) {
+			return true;
+		}
+		if (!it->is_number()) {
+			return false;
+		}
+		target = it->get<double>();
+		return true;
+	};
+	auto schemaList = [&](const char* keyword, std::vector<int>& target) {
+		const auto it = schema.find(keyword);
+		if (it == schema.end()) {
+			return true;
+		}
+		if (!it->is_array() || it->empty()) {
+			return false;
+		}
+		for (size_t i = 0; i < it->size(); ++i) {
+			const int compiled = child((*it)[i], Utilities::Stringify("/", keyword, "/", i));
+			if (compiled == kNone) {
+				return false;
+			}
+			target.push_back(compiled);
+		}
+		return true;
+	};
+	auto single = [&](const char* keyword, int& target) {
+		const auto it = schema.find(keyword);
+		if (it == schema.end()) {
+			return true;
+		}
+		target = child(*it, Utilities::Stringify("/", keyword));
+		return target != kNone;
+	};
+
+	// Children are compiled into m_Nodes while this node is being filled in, so it is only
+	// stored once complete
+	Node node;
+	if (schema.is_boolean()) {
+		node.reject = !schema.get<bool>();
+		m_Nodes[index] = std::move(node);
+		return index;
+	}
+	if (!schema.is_object()) {
+		return fail("a schema must be an object or a boolean");
+	}
+
+	if (const auto it = schema.find("$ref"); it != schema.end()) {
+		// Like draft 7, a $ref replaces every keyword next to it
+		if (!it->is_string()) {
+			return fail("$ref must be a string");
+		}
+		node.ref = ResolveRef(it->get<std::string>(), error);
+		if (node.ref == kNone) {
+			return kNone;
+		}
+		m_Nodes[index] = std::move(node);
+		return index;
+	}
+
+	if (const auto it = schema.find("type"); it != schema.end()) {
+		static const std::pair<const char*, uint8_t> kTypes[] = {
+			{ "null", TypeNull }, { "boolean", TypeBoolean }, { "integer", TypeInteger }, { "number", TypeNumber },
+			{ "string", TypeString }, { "array", TypeArray }, { "object", TypeObject }
+		};
+		node.types = 0;
+		const json names = it->is_array() ? *it : json::array({ *it });
+		for (const json& name : names) {
+			const auto match = std::find_if(std::begin(kTypes), std::end(kTypes),
+				[&](const auto& type) { return name.is_string() && name.get_ref<const std::string&>() == type.first; });
+			if (match == std::end(kTypes)) {
+				return fail(Utilities::Stringify("unknown type ", name.dump()));
+			}
+			node.types |= match->second;
+		}
+	}
+
+	if (const auto it = schema.find("enum"); it != schema.end()) {
+		if (!it->is_array()) {
+			return fail("enum must be an array");
+		}
+		node.enumValues.assign(it->begin(), it->end());
+	}
+	if (const auto it = schema.find("const"); it != schema.end()) {
+		node.constValue = *it;
+	}
+
+	if (!number("minimum", node.minimum) || !number("maximum", node.maximum) || !number("exclusiveMinimum", node.exclusiveMinimum) ||
+		!number("exclusiveMaximum", node.exclusiveMaximum) || !number("multipleOf", node.multipleOf)) {
+		return fail("numeric keywords must be numbers");
+	}
+	if (node.multipleOf && *node.multipleOf <= 0) {
+		return fail("multipleOf must be greater than 0");
+	}
+
+	if (!size("minLength", node.minLength) || !size("maxLength", node.maxLength) || !size("minItems", node.minItems) ||
+		!size("maxItems", node.maxItems) || !size("minProperties", node.minProperties) || !size("maxProperties", node.maxProperties)) {
+		return fail("length and count keywords must be non-negative integers");
+	}
+
+	try {
+		if (const auto it = schema.find("pattern"); it != schema.end()) {
+			if (!it->is_string()) {
+				return fail("pattern must be a string");
+			}
+			node.patternSource = it->get<std::string>();
+			node.pattern.emplace(node.patternSource, std::regex::ECMAScript);
+		}
+		if (const auto it = schema.find("patternProperties"); it != schema.end()) {
+			if (!it->is_object()) {
+				return fail("patternProperties must be an object");
+			}
+			for (const auto& [pattern, value] : it->items()) {
+				const int compiled = child(value, "/patternProperties/" + EscapeToken(pattern));
+				if (compiled == kNone) {
+					return kNone;
+				}
+				node.patternProperties.emplace_back(std::regex(pattern, std::regex::ECMAScript), compiled);
+			}
+		}
+	}
+	catch (const std::regex_error& e) {
+		return fail(Utilities::Stringify("invalid regular expression: ", e.what()));
+	}
+
+	if (const auto it = schema.find("items"); it != schema.end()) {
+		if (it->is_array()) {
+			// Draft 4-7 tuple form, the same thing prefixItems says since 2020-12
+			for (size_t i = 0; i < it->size(); ++i) {
+				const int compiled = child((*it)[i], Utilities::Stringify("/items/", i));
+				if (compiled == kNone) {
+					return kNone;
+				}
+				node.prefixItems.push_back(compiled);
+			}
+			if (!single("additionalItems", node.items)) {
+				return kNone;
+			}
+		}
+		else if (!single("items", node.items)) {
+			return kNone;
+		}
+	}
+	if (!schemaList("prefixItems", node.prefixItems)) {
+		return error.empty() ? fail("prefixItems must be a non-empty array of schemas") : kNone;
+	}
+	if (const auto it = schema.find("uniqueItems"); it != schema.end()) {
+		node.uniqueItems = it->is_boolean() && it->get<bool>();
+	}
+	if (!single("contains", node.contains)) {
+		return kNone;
+	}
+
+	if (const auto it = schema.find("properties"); it != schema.end()) {
+		if (!it->is_object()) {
+			return fail("properties must be an object");
+		}
+		for (const auto& [name, value] : it->items()) {
+			const int compiled = child(value, "/properties/" + EscapeToken(name));
+			if (compiled == kNone) {
+				return kNone;
+			}
+			node.properties.emplace_back(name, compiled);
+		}
+		// nlohmann objects iterate in key order already, sorting keeps that a guarantee
+		std::sort(node.properties.begin(), node.properties.end());
+	}
+	if (!single("additionalProperties", node.additionalProperties) || !single("propertyNames", node.propertyNames)) {
+		return kNone;
+	}
+	if (const auto it = schema.find("required"); it != schema.end()) {
+		if (!it->is_array()) {
+			return fail("required must be an array");
+		}
+		for (const json& name : *it) {
+			if (!name.is_string()) {
+				return fail("required must list strings");
+			}
+			node.required.push_back(name.get<std::string>());
+		}
+	}
+
+	if (!schemaList("allOf", node.allOf) || !schemaList("anyOf", node.anyOf) || !schemaList("oneOf", node.oneOf)) {
+		return error.empty() ? fail("allOf, anyOf and oneOf must be non-empty arrays of schemas") : kNone;
+	}
+	if (!single("not", node.notNode) || !single("if", node.ifNode) || !single("then", node.thenNode) || !single("else", node.elseNode)) {
+		return kNone;
+	}
+
+	node.streamable = node.enumValues.empty() && !node.constValue && !node.uniqueItems && node.contains == kNone &&
+		node.allOf.empty() && node.anyOf.empty() && node.oneOf.empty() && node.notNode == kNone && node.ifNode == kNone;
+
+	m_Nodes[index] = std::move(node);
+	return index;
+}
+
+int JsonSchema::ResolveRef(const std::string& ref, std::string& error)
+{
+	if (ref.empty() || ref[0] != '#') {
+		error = Utilities::Stringify("only local $ref values are supported, got '", ref, "'");
+		return kNone;
+	}
+
+	const std::string pointer = ref.substr(1);
+	for (const auto& [compiled, index] : m_Compiled) {
+		if (compiled == pointer) {
+			return index;
+		}
+	}
+
+	try {
+		const json::json_pointer target(pointer);
+		if (!m_Root.contains(target)) {
+			error = Utilities::Stringify("$ref '", ref, "' points at nothing");
+			return kNone;
+		}
+		return CompileNode(m_Root.at(target), pointer, error);
+	}
+	catch (const json::exception& e) {
+		error = Utilities::Stringify("$ref '", ref, "' is not a JSON pointer: ", e.what());
+		return kNone;
+	}
+}
+
+bool JsonSchema::ValidateNode(int index, const nlohmann::json& instance, std::vector<std::string>& path, std::string* error) const
+{
+	// Failures return from deep inside containers, the caller's path has to survive that
+	// because combinators keep going after a quiet failure
+	const size_t depth = path.size();
+	const bool valid = ValidateValue(m_Nodes[Target(index)], instance, path, error);
+	path.resize(depth);
+	return valid;
+}
+
+bool JsonSchema::ValidateValue(const Node& node, const nlohmann::json& instance, std::vector<std::string>& path, std::string* error) const
+{
+	if (node.reject) {
+		return Report(error, path, "no value is allowed here");
+	}
+
+	const uint8_t types = InstanceTypes(instance);
+	if (!(types & node.types)) {
+		return Report(error, path, Utilities::Stringify("expected ", TypeNames(node.types), ", got ", instance.type_name()));
+	}
+
+	if (!node.enumValues.empty() && std::find(node.enumValues.begin(), node.enumValues.end(), instance) == node.enumValues.end()) {
+		return Report(error, path, "value is not one of the enum values");
+	}
+	if (node.constValue && *node.constValue != instance) {
+		return Report(error, path, Utilities::Stringify("value must be ", node.constValue->dump()));
+	}
+
+	if (instance.is_array()) {
+		if (!ValidateArray(node, instance, path, error)) {
+			return false;
+		}
+	}
+	else if (instance.is_object()) {
+		if (!ValidateObject(node, instance, path, error)) {
+			return false;
+		}
+	}
+	else if (!ValidateScalar(node, instance, path, error)) {
+		return false;
+	}
+	return ValidateCombinators(node, instance, path, error);
+}
+
+bool JsonSchema::ValidateScalar(const Node& node, const nlohmann::json& instance, std::vector<std::string>& path, std::string* error) const
+{
+	if (instance.is_number()) {
+		const double value = instance.get<double>();
+		if (node.minimum && value < *node.minimum) {
+			return Report(error, path, Utilities::Stringify(instance.dump(), " is less than the minimum of ", *node.minimum));
+		}
+		if (node.maximum && value > *node.maximum) {
+			return Report(error, path, Utilities::Stringify(instance.dump(), " is greater than the maximum of ", *node.maximum));
+		}
+		if (node.exclusiveMinimum && value <= *node.exclusiveMinimum) {
+			return Report(error, path, Utilities::Stringify(instance.dump(), " is not greater than ", *node.exclusiveMinimum));
+		}
+		if (node.exclusiveMaximum && value >= *node.exclusiveMaximum) {
+			return Report(error, path, Utilities::Stringify(instance.dump(), " is not less than ", *node.exclusiveMaximum));
+		}
+		if (node.multipleOf && !IsMultipleOf(instance, *node.multipleOf)) {
+			return Report(error, path, Utilities::Stringify(instance.dump(), " is not a multiple of ", *node.multipleOf));
+		}
+	}
+	else if (instance.is_string()) {
+		const std::string& text = instance.get_ref<const std::string&>();
+		if (node.minLength || node.maxLength) {
+			const size_t length = CodePoints(text);
+			if (node.minLength && length < *node.minLength) {
+				return Report(error, path, Utilities::Stringify("string is shorter than ", *node.minLength, " characters"));
+			}
+			if (node.maxLength && length > *node.maxLength) {
+				return Report(error, path, Utilities::Stringify("string is longer than ", *node.maxLength, " characters"));
+			}
+		}
+		if (node.pattern && !std::regex_search(text, *node.pattern)) {
+			return Report(error, path, Utilities::Stringify("string does not match '", node.patternSource, "'"));
+		}
+	}
+	return true;
+}
+
+bool JsonSchema::ValidateArray(const Node& node, const nlohmann::json& instance, std::vector<std::string>& path, std::string* error) const
+{
+	const size_t count = instance.size();
+	if (node.minItems && count < *node.minItems) {
+		return Report(error, path, Utilities::Stringify("has ", count, " items, fewer than ", *node.minItems));
+	}
+	if (node.maxItems && count > *node.maxItems) {
+		return Report(error, path, Utilities::Stringify("has ", count, " items, more than ", *node.maxItems));
+	}
+
+	bool contained = node.contains == kNone;
+	for (size_t i = 0; i < count; ++i) {
+		const int item = ItemNode(node, i);
+		path.push_back(std::to_string(i));
+		const bool valid = item == kNone || ValidateNode(item, instance[i], path, error);
+		if (valid && !contained) {
+			contained = ValidateNode(node.contains, instance[i], path, nullptr);
+		}
+		path.pop_back();
+		if (!valid) {
+			return false;
+		}
+	}
+	if (!contained) {
+		return Report(error, path, "no item matches the contains schema");
+	}
+
+	if (node.uniqueItems && count > 1) {
+		std::vector<const json*> sorted;
+		sorted.reserve(count);
+		for (const json& item : instance) {
+			sorted.push_back(&item);
+		}
+		std::sort(sorted.begin(), sorted.end(), [](const json* a, const json* b) { return *a < *b; });
+		for (size_t i = 1; i < sorted.size(); ++i) {
+			if (*sorted[i - 1] == *sorted[i]) {
+				return Report(error, path, "items are not unique");
+			}
+		}
+	}
+	return true;
+}
+
+bool JsonSchema::ValidateObject(const Node& node, const nlohmann::json& instance, std::vector<std::string>& path, std::string* error) const
+{
+	const size_t count = instance.size();
+	if (node.minProperties && count < *node.minProperties) {
+		return Report(error, path, Utilities::Stringify("has ", count, " properties, fewer than ", *node.minProperties));
+	}
+	if (node.maxProperties && count > *node.maxProperties) {
+		return Report(error, path, Utilities::Stringify("has ", count, " properties, more than ", *node.maxProperties));
+	}
+	for (const std::string& name : node.required) {
+		if (!instance.contains(name)) {
+			return Report(error, path, Utilities::Stringify("required property '", name, "' is missing"));
+		}
+	}
+
+	for (const auto& [key, value] : instance.items()) {
+		path.push_back(key);
+		if (node.propertyNames != kNone && !ValidateNode(node.propertyNames, json(key), path, error)) {
+			return false;
+		}
+
+		bool matched = false;
+		const int named = PropertyNode(node, key);
+		if (named != kNone) {
+			matched = true;
+			if (!ValidateNode(named, value, path, error)) {
+				return false;
+			}
+		}
+		for (const auto& [pattern, child] : node.patternProperties) {
+			if (std::regex_search(key, pattern)) {
+				matched = true;
+				if (!ValidateNode(child, value, path, error)) {
+					return false;
+				}
+			}
+		}
+		if (!matched && node.additionalProperties != kNone && !ValidateNode(node.additionalProperties, value, path, error)) {
+			return false;
+		}
+		path.pop_back();
+	}
+	return true;
+}
+
+bool JsonSchema::ValidateCombinators(const Node& node, const nlohmann::json& instance, std::vector<std::string>& path, std::string* error) const
+{
+	for (int child : node.allOf) {
+		if (!ValidateNode(child, instance, path, error)) {
+			return false;
+		}
+	}
+
+	if (!node.anyOf.empty() &&
+		std::none_of(node.anyOf.begin(), node.anyOf.end(), [&](int child) { return ValidateNode(child, instance, path, nullptr); })) {
+		return Report(error, path, "value matches none of the anyOf schemas");
+	}
+
+	if (!node.oneOf.empty()) {
+		const auto matches = std::count_if(node.oneOf.begin(), node.oneOf.end(), [&](int child) { return ValidateNode(child, instance, path, nullptr); });
+		if (matches != 1) {
+			return Report(error, path, Utilities::Stringify("value matches ", matches, " of the oneOf schemas instead of exactly one"));
+		}
+	}
+
+	if (node.notNode != kNone && ValidateNode(node.notNode, instance, path, nullptr)) {
+		return Report(error, path, "value matches the not schema");
+	}
+
+	if (node.ifNode != kNone) {
+		const int branch = ValidateNode(node.ifNode, instance, path, nullptr) ? node.thenNode : node.elseNode;
+		if (branch != kNone && !ValidateNode(branch, instance, path, error)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int JsonSchema::Target(int index) const
+{
+	while (m_Nodes[index].ref != kNone) {
+		index = m_Nodes[index].ref;
+	}
+	return index;
+}
+
+int JsonSchema::PropertyNode(const Node& node, const std::string& key) const
+{
+	const auto it = std::lower_bound(node.properties.begin(), node.properties.end(), key,
+		[](const std::pair<std::string, int>& entry, const std::string& name) { return entry.first < name; });
+	return it != node.properties.end() && it->first == key ? it->second : kNone;
+}
+
+int JsonSchema::ItemNode(const Node& node, size_t index) const
+{
+	return index < node.prefixItems.size() ? node.prefixItems[index] : node.items;
+}
+
+bool JsonSchema::Report(std::string* error, const std::vector<std::string>& path, const std::string& message)
+{
+	if (error) {
+		*error = Utilities::Stringify(PathString(path), ": ", message);
+	}
+	return false;
+}
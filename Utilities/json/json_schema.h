@@ -0,0 +1,108 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "../dependencies/json.hpp"
+
+// Compiles a JSON Schema into a flat table of nodes and validates documents against it.
+// Supported keywords: type, enum, const, minimum, maximum, exclusiveMinimum,
+// exclusiveMaximum, multipleOf, minLength, maxLength, pattern, items, prefixItems,
+// additionalItems, minItems, maxItems, uniqueItems, contains, properties,
+// patternProperties, additionalProperties, required, minProperties, maxProperties,
+// propertyNames, allOf, anyOf, oneOf, not, if/then/else and $ref to local pointers
+// ("#", "#/$defs/..."). Anything else, format included, is ignored as an annotation.
+//
+// The same program runs over a DOM or inside nlohmann's SAX parser. The SAX path streams
+// through everything it can check per event and only materializes the subtrees that sit
+// under allOf/anyOf/oneOf/not/if, enum, const, uniqueItems or contains.
+class JsonSchema
+{
+public:
+	bool Compile(const nlohmann::json& schema, std::string* error = nullptr);
+	bool IsCompiled() const { return !m_Nodes.empty(); }
+
+	// On failure error gets "<json pointer>: <reason>" for the first violation
+	bool Validate(const nlohmann::json& instance, std::string* error = nullptr) const;
+	// Validates while parsing, without ever holding the whole document
+	bool ValidateText(std::string_view text, std::string* error = nullptr) const;
+	bool ValidateFile(const std::string& filename, std::string* error = nullptr) const;
+
+private:
+	friend class JsonSchemaSax;
+
+	enum TypeMask : uint8_t
+	{
+		TypeNull = 1 << 0,
+		TypeBoolean = 1 << 1,
+		TypeInteger = 1 << 2,
+		TypeNumber = 1 << 3,
+		TypeString = 1 << 4,
+		TypeArray = 1 << 5,
+		TypeObject = 1 << 6,
+		TypeAny = 0x7F
+	};
+
+	static constexpr int kNone = -1;
+
+	struct Node
+	{
+		// A literal false schema, nothing validates
+		bool reject = false;
+		uint8_t types = TypeAny;
+		int ref = kNone;
+
+		std::vector<nlohmann::json> enumValues;
+		std::optional<nlohmann::json> constValue;
+
+		std::optional<double> minimum, maximum, exclusiveMinimum, exclusiveMaximum, multipleOf;
+
+		std::optional<size_t> minLength, maxLength;
+		std::optional<std::regex> pattern;
+		std::string patternSource;
+
+		int items = kNone;
+		std::vector<int> prefixItems;
+		std::optional<size_t> minItems, maxItems;
+		bool uniqueItems = false;
+		int contains = kNone;
+
+		// Sorted by name for binary search
+		std::vector<std::pair<std::string, int>> properties;
+		std::vector<std::pair<std::regex, int>> patternProperties;
+		int additionalProperties = kNone;
+		std::vector<std::string> required;
+		std::optional<size_t> minProperties, maxProperties;
+		int propertyNames = kNone;
+
+		std::vector<int> allOf, anyOf, oneOf;
+		int notNode = kNone, ifNode = kNone, thenNode = kNone, elseNode = kNone;
+
+		// Set when the node can be checked event by event in the SAX path
+		bool streamable = true;
+	};
+
+	int CompileNode(const nlohmann::json& schema, const std::string& pointer, std::string& error);
+	int ResolveRef(const std::string& ref, std::string& error);
+
+	bool ValidateNode(int index, const nlohmann::json& instance, std::vector<std::string>& path, std::string* error) const;
+	bool ValidateValue(const Node& node, const nlohmann::json& instance, std::vector<std::string>& path, std::string* error) const;
+	bool ValidateScalar(const Node& node, const nlohmann::json& instance, std::vector<std::string>& path, std::string* error) const;
+	bool ValidateArray(const Node& node, const nlohmann::json& instance, std::vector<std::string>& path, std::string* error) const;
+	bool ValidateObject(const Node& node, const nlohmann::json& instance, std::vector<std::string>& path, std::string* error) const;
+	bool ValidateCombinators(const Node& node, const nlohmann::json& instance, std::vector<std::string>& path, std::string* error) const;
+
+	// Follows plain $ref chains to the node that does the work
+	int Target(int index) const;
+	int PropertyNode(const Node& node, const std::string& key) const;
+	int ItemNode(const Node& node, size_t index) const;
+	static bool Report(std::string* error, const std::vector<std::string>& path, const std::string& message);
+
+	nlohmann::json m_Root;
+	std::vector<Node> m_Nodes;
+	std::vector<std::pair<std::string, int>> m_Compiled;
+};
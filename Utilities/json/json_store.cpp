@@ -0,0 +1,586 @@
+#include "json_store.h"
+#include "../io/mapped_file.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+
+namespace
+{
+	constexpr char kFileMagic[8] = { 'J', 'S', 'T', 'O', 'R', 'E', '0', '1' };
+	constexpr uint32_t kRecordMagic = 0x4352534A; // "JSRC"
+	// Value size of an erase record
+	constexpr uint32_t kErased = UINT32_MAX;
+
+	struct RecordHeader
+	{
+		uint32_t magic;
+		uint32_t keySize;
+		uint32_t valueSize;
+		uint32_t crc;
+	};
+	static_assert(sizeof(RecordHeader) == 16, "records are read and written byte for byte");
+
+	constexpr std::array<uint32_t, 256> kCrcTable = [] {
+		std::array<uint32_t, 256> table = {};
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t crc = i;
+			for (int bit = 0; bit < 8; ++bit) {
+				crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+			}
+			table[i] = crc;
+		}
+		return table;
+	}();
+
+	// CRC-32C (Castagnoli), chainable: Crc32c(Crc32c(0, a), b) is the CRC of a then b
+	uint32_t Crc32c(uint32_t crc, std::string_view data)
+	{
+		crc = ~crc;
+		for (const char c : data) {
+			crc = kCrcTable[(crc ^ static_cast<unsigned char>(c)) & 0xFF] ^ (crc >> 8);
+		}
+		return ~crc;
+	}
+
+	uint32_t RecordCrc(uint32_t keySize, uint32_t valueSize, std::string_view key, std::string_view value)
+	{
+		char sizes[8];
+		std::memcpy(sizes, &keySize, 4);
+		std::memcpy(sizes + 4, &valueSize, 4);
+		return Crc32c(Crc32c(Crc32c(0, std::string_view(sizes, sizeof(sizes))), key), value);
+	}
+
+	uint64_t RecordSize(uint64_t keySize, uint64_t valueSize)
+	{
+		return sizeof(RecordHeader) + keySize + (valueSize == kErased ? 0 : valueSize);
+	}
+
+	// Whether a complete record with a matching checksum starts anywhere in data
+	bool ContainsRecord(std::string_view data)
+	{
+		const std::string_view magic(reinterpret_cast<const char*>(&kRecordMagic), sizeof(kRecordMagic));
+		for (size_t position = data.find(magic); position != std::string_view::npos; position = data.find(magic, position + 1)) {
+			if (data.size() - position < sizeof(RecordHeader)) {
+				break;
+			}
+			RecordHeader header;
+			std::memcpy(&header, data.data() + position, sizeof(header));
+			const uint64_t size = RecordSize(header.keySize, header.valueSize);
+			if (size > data.size() - position) {
+				continue;
+			}
+			const bool erased = header.valueSize == kErased;
+			const std::string_view key = data.substr(position + sizeof(header), header.keySize);
+			const std::string_view value = erased ? std::string_view() : data.substr(position + sizeof(header) + header.keySize, header.valueSize);
+			if (RecordCrc(header.keySize, header.valueSize, key, value) == header.crc) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// A null value encodes an erase
+	void EncodeRecord(std::string& out, std::string_view key, const std::string* value)
+	{
+		RecordHeader header;
+		header.magic = kRecordMagic;
+		header.keySize = static_cast<uint32_t>(key.size());
+		header.valueSize = value ? static_cast<uint32_t>(value->size()) : kErased;
+		header.crc = RecordCrc(header.keySize, header.valueSize, key, value ? std::string_view(*value) : std::string_view());
+		out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.append(key);
+		if (value) {
+			out.append(*value);
+		}
+	}
+
+	bool Fail(std::string* error, const std::string& path, const std::string& message)
+	{
+		if (error) *error = message;
+		else Logger::Error("Failed using json store ", path, ": ", message);
+		return false;
+	}
+
+	// Positioned read that leaves the file pointer alone, safe from several threads at once
+	bool ReadAt(HANDLE file, uint64_t offset, char* buffer, size_t size, std::string& message)
+	{
+		while (size > 0) {
+			OVERLAPPED overlapped = {};
+			overlapped.Offset = static_cast<DWORD>(offset);
+			overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+			const DWORD chunk = static_cast<DWORD>(std::min<size_t>(size, 1u << 30));
+			DWORD read = 0;
+			if (!ReadFile(file, buffer, chunk, &read, &overlapped) || read == 0) {
+				message = Utilities::Stringify("Could not read ", size, " bytes at offset ", offset, ": ", Utilities::GetLastErrorString());
+				return false;
+			}
+			offset += read;
+			buffer += read;
+			size -= read;
+		}
+		return true;
+	}
+
+	HANDLE OpenForReading(const std::string& path, std::string& message)
+	{
+		const HANDLE file = CreateFileW(fs::path(path).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			message = Utilities::Stringify("Could not open ", path, ": ", Utilities::GetLastErrorString());
+		}
+		return file;
+	}
+}
+
+JsonStore::~JsonStore()
+{
+	Close();
+}
+
+bool JsonStore::Open(const std::string& path, const JsonStoreOptions& options, std::string* error)
+{
+	Close();
+
+	m_Path = path;
+	m_Options = options;
+	{
+		std::lock_guard<std::mutex> writeLock(m_WriteMutex);
+		std::unique_lock<std::shared_mutex> lock(m_Mutex);
+		if (!Load(error)) {
+			return false;
+		}
+
+		std::string message;
+		if (!m_Writer.Open(m_Path, BufferedFileWriter::Mode::Append, &message)) {
+			return Fail(error, m_Path, message);
+		}
+		m_ReadFile = OpenForReading(m_Path, message);
+		if (m_ReadFile == INVALID_HANDLE_VALUE) {
+			m_Writer.Close();
+			return Fail(error, m_Path, message);
+		}
+	}
+
+	m_Stopping = false;
+	if (m_Options.compactIntervalMs > 0) {
+		m_Compactor = std::thread(&JsonStore::CompactionLoop, this);
+	}
+	return true;
+}
+
+void JsonStore::Close()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_SignalMutex);
+		m_Stopping = true;
+	}
+	m_CompactSignal.notify_all();
+	if (m_Compactor.joinable()) {
+		m_Compactor.join();
+	}
+
+	std::lock_guard<std::mutex> writeLock(m_WriteMutex);
+	std::unique_lock<std::shared_mutex> lock(m_Mutex);
+	m_Writer.Close();
+	if (m_ReadFile != INVALID_HANDLE_VALUE) {
+		CloseHandle(m_ReadFile);
+		m_ReadFile = INVALID_HANDLE_VALUE;
+	}
+	m_Index.clear();
+	m_LogSize = 0;
+	m_LiveBytes = 0;
+}
+
+bool JsonStore::IsOpen() const
+{
+	std::shared_lock<std::shared_mutex> lock(m_Mutex);
+	return m_ReadFile != INVALID_HANDLE_VALUE;
+}
+
+bool JsonStore::Get(std::string_view key, nlohmann::json& value, std::string* error) const
+{
+	std::string text;
+	if (!ReadRecord(key, text, error)) {
+		return false;
+	}
+	try {
+		value = nlohmann::json::parse(text);
+	}
+	catch (const nlohmann::json::exception& e) {
+		return Fail(error, m_Path, Utilities::Stringify("the value of '", key, "' does not parse: ", e.what()));
+	}
+	return true;
+}
+
+bool JsonStore::GetText(std::string_view key, std::string& text, std::string* error) const
+{
+	return ReadRecord(key, text, error);
+}
+
+bool JsonStore::Contains(std::string_view key) const
+{
+	std::shared_lock<std::shared_mutex> lock(m_Mutex);
+	return m_Index.find(key) != m_Index.end();
+}
+
+size_t JsonStore::Count() const
+{
+	std::shared_lock<std::shared_mutex> lock(m_Mutex);
+	return m_Index.size();
+}
+
+std::vector<std::string> JsonStore::Keys() const
+{
+	std::shared_lock<std::shared_mutex> lock(m_Mutex);
+	std::vector<std::string> keys;
+	keys.reserve(m_Index.size());
+	for (const auto& [key, location] : m_Index) {
+		keys.push_back(key);
+	}
+	return keys;
+}
+
+bool JsonStore::Put(std::string_view key, const nlohmann::json& value, std::string* error)
+{
+	std::string text;
+	try {
+		text = value.dump();
+	}
+	catch (const nlohmann::json::exception& e) {
+		return Fail(error, m_Path, e.what());
+	}
+	if (key.size() >= kErased || text.size() >= kErased) {
+		return Fail(error, m_Path, "a record is limited to 4 GiB");
+	}
+
+	std::string record;
+	EncodeRecord(record, key, &text);
+	std::lock_guard<std::mutex> lock(m_WriteMutex);
+	return Append(record, error);
+}
+
+bool JsonStore::PutMany(const nlohmann::json& object, std::string* error)
+{
+	if (!object.is_object()) {
+		return Fail(error, m_Path, "PutMany takes an object");
+	}
+
+	std::string records;
+	for (const auto& [key, value] : object.items()) {
+		std::string text;
+		try {
+			text = value.dump();
+		}
+		catch (const nlohmann::json::exception& e) {
+			return Fail(error, m_Path, e.what());
+		}
+		if (key.size() >= kErased || text.size() >= kErased) {
+			return Fail(error, m_Path, "a record is limited to 4 GiB");
+		}
+		EncodeRecord(records, key, &text);
+	}
+
+	std::lock_guard<std::mutex> lock(m_WriteMutex);
+	return records.empty() || Append(records, error);
+}
+
+bool JsonStore::Erase(std::string_view key, std::string* error)
+{
+	std::lock_guard<std::mutex> lock(m_WriteMutex);
+	// Only writers change the index and they all hold m_WriteMutex
+	if (m_Index.find(key) == m_Index.end()) {
+		return true;
+	}
+	std::string record;
+	EncodeRecord(record, key, nullptr);
+	return Append(record, error);
+}
+
+bool JsonStore::Compact(std::string* error)
+{
+	std::lock_guard<std::mutex> compactLock(m_CompactMutex);
+
+	std::vector<std::pair<std::string, Location>> live;
+	uint64_t end = 0;
+	{
+		std::lock_guard<std::mutex> lock(m_WriteMutex);
+		if (!m_Writer.IsOpen()) {
+			return Fail(error, m_Path, "the store is not open");
+		}
+		live.assign(m_Index.begin(), m_Index.end());
+		end = m_LogSize;
+	}
+
+	// The live records are copied byte for byte, in log order, while writers keep appending
+	// to the old log
+	std::sort(live.begin(), live.end(), [](const auto& a, const auto& b) { return a.second.offset < b.second.offset; });
+
+	const std::string temporary = m_Path + ".compact";
+	std::string message;
+	auto abandon = [&](BufferedFileWriter& out) {
+		out.Close();
+		DeleteFileW(fs::path(temporary).c_str());
+		return Fail(error, m_Path, message);
+	};
+
+	BufferedFileWriter out;
+	MappedFile old;
+	if (!old.Open(m_Path, &message) || old.Size() < end || !out.Open(temporary, BufferedFileWriter::Mode::Truncate, &message)) {
+		if (message.empty()) {
+			message = "the log is shorter than its index";
+		}
+		return abandon(out);
+	}
+
+	Index fresh;
+	fresh.reserve(live.size());
+	uint64_t offset = sizeof(kFileMagic);
+	uint64_t liveBytes = 0;
+	if (!out.Write(std::string_view(kFileMagic, sizeof(kFileMagic)), &message)) {
+		return abandon(out);
+	}
+	for (auto& [key, location] : live) {
+		const uint64_t size = RecordSize(location.keySize, location.valueSize);
+		if (!out.Write(old.View().substr(location.offset, size), &message)) {
+			return abandon(out);
+		}
+		fresh.emplace(std::move(key), Location{ offset, location.keySize, location.valueSize });
+		offset += size;
+		liveBytes += size;
+	}
+	old.Close();
+
+	// Writers wait from here: catch up with what they appended meanwhile, then swap logs
+	std::lock_guard<std::mutex> writeLock(m_WriteMutex);
+	if (!m_Writer.IsOpen()) {
+		message = "the store was closed";
+		return abandon(out);
+	}
+	std::string tail(m_LogSize - end, '\0');
+	if (!ReadAt(m_ReadFile, end, tail.data(), tail.size(), message) || !out.Write(tail, &message)) {
+		return abandon(out);
+	}
+	Scan(tail, offset, fresh, liveBytes);
+	if (!out.Flush(m_Options.fsync != FsyncPolicy::None, &message) || !out.Close(&message)) {
+		return abandon(out);
+	}
+
+	// Readers wait from here. Our own handles go first, the rename cannot replace a file
+	// this process still holds open.
+	std::unique_lock<std::shared_mutex> lock(m_Mutex);
+	m_Writer.Close();
+	CloseHandle(m_ReadFile);
+
+	const bool moved = Utilities::RenameOver(fs::path(temporary), fs::path(m_Path), m_Options.fsync, &message);
+	if (moved) {
+		m_Index = std::move(fresh);
+		m_LogSize = offset + tail.size();
+		m_LiveBytes = liveBytes;
+	}
+	else {
+		DeleteFileW(fs::path(temporary).c_str());
+	}
+
+	// Either log is complete, so the store goes on with whichever is in place
+	std::string reopenMessage;
+	m_ReadFile = OpenForReading(m_Path, reopenMessage);
+	if (m_ReadFile == INVALID_HANDLE_VALUE || !m_Writer.Open(m_Path, BufferedFileWriter::Mode::Append, &reopenMessage)) {
+		message = reopenMessage;
+		return Fail(error, m_Path, message);
+	}
+	return moved ? true : Fail(error, m_Path, message);
+}
+
+uint64_t JsonStore::LogSize() const
+{
+	std::shared_lock<std::shared_mutex> lock(m_Mutex);
+	return m_LogSize;
+}
+
+uint64_t JsonStore::LiveBytes() const
+{
+	std::shared_lock<std::shared_mutex> lock(m_Mutex);
+	return m_LiveBytes;
+}
+
+bool JsonStore::Load(std::string* error)
+{
+	m_Index.clear();
+	m_LogSize = 0;
+	m_LiveBytes = 0;
+
+	std::string message;
+	uint64_t fileSize = 0;
+	uint64_t valid = 0;
+	if (Utilities::FileOrFolderExists(m_Path)) {
+		MappedFile log;
+		if (!log.Open(m_Path, &message)) {
+			return Fail(error, m_Path, message);
+		}
+		const std::string_view data = log.View();
+		fileSize = data.size();
+		if (!data.empty()) {
+			if (data.size() < sizeof(kFileMagic) || std::memcmp(data.data(), kFileMagic, sizeof(kFileMagic)) != 0) {
+				return Fail(error, m_Path, "the file is not a json store");
+			}
+			valid = sizeof(kFileMagic) + Scan(data.substr(sizeof(kFileMagic)), sizeof(kFileMagic), m_Index, m_LiveBytes);
+
+			// A crash mid-append leaves an incomplete record, or after a power loss zeroed or
+			// garbage blocks, at the very end. Only a bad record with an intact one somewhere
+			// after it is damage rather than a torn write.
+			const std::string_view rest = data.substr(valid);
+			if (rest.size() > 1 && ContainsRecord(rest.substr(1))) {
+				m_Index.clear();
+				return Fail(error, m_Path, Utilities::Stringify("the record at offset ", valid, " is corrupt"));
+			}
+		}
+	}
+
+	if (fileSize == 0) {
+		if (!Utilities::AtomicWriteFile(m_Path, std::string_view(kFileMagic, sizeof(kFileMagic)), m_Options.fsync, &message)) {
+			return Fail(error, m_Path, message);
+		}
+		valid = sizeof(kFileMagic);
+	}
+	else if (valid < fileSize) {
+		// Cut the torn record off once the mapping is gone, or the next append would follow it
+		const HANDLE file = CreateFileW(fs::path(m_Path).c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		LARGE_INTEGER position;
+		position.QuadPart = static_cast<LONGLONG>(valid);
+		const bool truncated = file != INVALID_HANDLE_VALUE && SetFilePointerEx(file, position, nullptr, FILE_BEGIN) && SetEndOfFile(file);
+		if (!truncated) {
+			message = Utilities::Stringify("Could not drop the torn record at the end: ", Utilities::GetLastErrorString());
+		}
+		if (file != INVALID_HANDLE_VALUE) {
+			CloseHandle(file);
+		}
+		if (!truncated) {
+			m_Index.clear();
+			return Fail(error, m_Path, message);
+		}
+		Logger::Warn("Dropped ", fileSize - valid, " bytes of a torn record from the end of ", m_Path);
+	}
+
+	m_LogSize = valid;
+	return true;
+}
+
+bool JsonStore::Append(const std::string& records, std::string* error)
+{
+	if (!m_Writer.IsOpen()) {
+		return Fail(error, m_Path, "the store is not open");
+	}
+
+	std::string message;
+	if (!m_Writer.Write(records, &message) || !m_Writer.Flush(m_Options.fsync != FsyncPolicy::None, &message)) {
+		// Part of a record may have reached the file, appending after it would hide the rest
+		m_Writer.Close();
+		return Fail(error, m_Path, message);
+	}
+
+	std::unique_lock<std::shared_mutex> lock(m_Mutex);
+	Scan(records, m_LogSize, m_Index, m_LiveBytes);
+	m_LogSize += records.size();
+	return true;
+}
+
+size_t JsonStore::Scan(std::string_view data, uint64_t offset, Index& index, uint64_t& liveBytes)
+{
+	size_t position = 0;
+	while (data.size() - position >= sizeof(RecordHeader)) {
+		RecordHeader header;
+		std::memcpy(&header, data.data() + position, sizeof(header));
+		const uint64_t size = RecordSize(header.keySize, header.valueSize);
+		if (header.magic != kRecordMagic || size > data.size() - position) {
+			break;
+		}
+		const bool erased = header.valueSize == kErased;
+		const std::string_view key = data.substr(position + sizeof(header), header.keySize);
+		const std::string_view value = erased ? std::string_view() : data.substr(position + sizeof(header) + header.keySize, header.valueSize);
+		if (RecordCrc(header.keySize, header.valueSize, key, value) != header.crc) {
+			break;
+		}
+
+		const auto it = index.find(key);
+		if (it != index.end()) {
+			liveBytes -= RecordSize(it->second.keySize, it->second.valueSize);
+		}
+		const Location location{ offset + position, header.keySize, header.valueSize };
+		if (erased) {
+			if (it != index.end()) {
+				index.erase(it);
+			}
+		}
+		else {
+			if (it != index.end()) {
+				it->second = location;
+			}
+			else {
+				index.emplace(std::string(key), location);
+			}
+			liveBytes += size;
+		}
+		position += static_cast<size_t>(size);
+	}
+	return position;
+}
+
+bool JsonStore::ReadRecord(std::string_view key, std::string& text, std::string* error) const
+{
+	Location location;
+	std::string record;
+	std::string message;
+	{
+		std::shared_lock<std::shared_mutex> lock(m_Mutex);
+		const auto it = m_Index.find(key);
+		if (it == m_Index.end()) {
+			return false;
+		}
+		location = it->second;
+		record.resize(static_cast<size_t>(RecordSize(location.keySize, location.valueSize)));
+		if (!ReadAt(m_ReadFile, location.offset, record.data(), record.size(), message)) {
+			return Fail(error, m_Path, message);
+		}
+	}
+
+	RecordHeader header;
+	std::memcpy(&header, record.data(), sizeof(header));
+	const std::string_view storedKey = std::string_view(record).substr(sizeof(header), location.keySize);
+	const std::string_view value = std::string_view(record).substr(sizeof(header) + location.keySize);
+	if (header.magic != kRecordMagic || header.keySize != location.keySize || header.valueSize != location.valueSize
+		|| storedKey != key || RecordCrc(header.keySize, header.valueSize, storedKey, value) != header.crc) {
+		return Fail(error, m_Path, Utilities::Stringify("the record of '", key, "' at offset ", location.offset, " is corrupt"));
+	}
+
+	record.erase(0, sizeof(header) + location.keySize);
+	text = std::move(record);
+	return true;
+}
+
+bool JsonStore::NeedsCompaction() const
+{
+	std::shared_lock<std::shared_mutex> lock(m_Mutex);
+	if (m_LogSize < m_Options.compactMinBytes) {
+		return false;
+	}
+	const uint64_t records = m_LogSize - sizeof(kFileMagic);
+	return static_cast<double>(records - m_LiveBytes) >= m_Options.compactRatio * static_cast<double>(records);
+}
+
+void JsonStore::CompactionLoop()
+{
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(m_SignalMutex);
+			if (m_CompactSignal.wait_for(lock, std::chrono::milliseconds(m_Options.compactIntervalMs), [&] { return m_Stopping; })) {
+				return;
+			}
+		}
+		if (NeedsCompaction()) {
+			Compact();
+		}
+	}
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include <Windows.h>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../utils/utilities.h"
+#include "../io/buffered_writer.h"
+
+struct JsonStoreOptions
+{
+	// Applies to every append as well as to compacted logs
+	FsyncPolicy fsync = FsyncPolicy::Data;
+	// The background thread compacts once records that were overwritten or erased make up
+	// this share of the log...
+	double compactRatio = 0.5;
+	// ...and the log has at least this many bytes
+	uint64_t compactMinBytes = 4 << 20;
+	// How often the background thread checks, 0 leaves compaction to Compact()
+	unsigned compactIntervalMs = 30000;
+};
+
+// A key to JSON document store kept in one append-only log, for many small records that used
+// to live in one big file rewritten by SaveToJson. Every Put or Erase appends a single record
+// and flushes it, nothing else is written. An in-memory hash index maps each key to the
+// offset of its latest record, and Get reads just that record with a positioned ReadFile and
+// parses it, so unrelated records are never read or parsed.
+//
+// The log starts with an 8 byte "JSTORE01" header followed by records: magic, key size,
+// value size (all ones for an erase), a CRC-32C over the sizes, key and value, then the key
+// and the compact JSON text of the value. A torn record left by a crash is cut off on open.
+//
+// Compaction copies the live records into "<path>.compact" without blocking readers or
+// writers, then copies whatever was appended meanwhile and renames the new log over the old
+// one. Only that last step excludes readers. Every handle on the log is opened with
+// FILE_SHARE_DELETE, so other processes reading it do not make the rename fail.
+class JsonStore
+{
+public:
+	JsonStore() = default;
+	~JsonStore();
+
+	JsonStore(const JsonStore&) = delete;
+	JsonStore& operator=(const JsonStore&) = delete;
+
+	// Creates the log when it does not exist, otherwise reads every record header to build
+	// the index. Values are not parsed.
+	bool Open(const std::string& path, const JsonStoreOptions& options = {}, std::string* error = nullptr);
+	// Stops the compaction thread and closes the log
+	void Close();
+	bool IsOpen() const;
+
+	// False when the key is missing, error is only set or logged when its record cannot be
+	// read back
+	bool Get(std::string_view key, nlohmann::json& value, std::string* error = nullptr) const;
+	// The stored JSON text, unparsed
+	bool GetText(std::string_view key, std::string& text, std::string* error = nullptr) const;
+	bool Contains(std::string_view key) const;
+	size_t Count() const;
+	std::vector<std::string> Keys() const;
+
+	bool Put(std::string_view key, const nlohmann::json& value, std::string* error = nullptr);
+	// Every member of object becomes a record, written with a single append and flush. Turns
+	// a file written by SaveToJson into a store.
+	bool PutMany(const nlohmann::json& object, std::string* error = nullptr);
+	// Erasing a missing key succeeds without writing anything
+	bool Erase(std::string_view key, std::string* error = nullptr);
+
+	// Rewrites the log with only the live records
+	bool Compact(std::string* error = nullptr);
+
+	uint64_t LogSize() const;
+	// Bytes of the records the index points at, the rest of the log is garbage
+	uint64_t LiveBytes() const;
+
+private:
+	struct Location
+	{
+		uint64_t offset = 0;
+		uint32_t keySize = 0;
+		uint32_t valueSize = 0;
+	};
+
+	struct KeyHash
+	{
+		using is_transparent = void;
+		size_t operator()(std::string_view key) const { return std::hash<std::string_view>()(key); }
+	};
+
+	using Index = std::unordered_map<std::string, Location, KeyHash, std::equal_to<>>;
+
+	// Reads the log from the start and cuts off a torn tail
+	bool Load(std::string* error);
+	// Caller holds m_WriteMutex. Appends encoded records and moves the index to them.
+	bool Append(const std::string& records, std::string* error);
+	// Parses the records in data, which starts at offset in the log, into index. Returns the
+	// length of the valid prefix.
+	static size_t Scan(std::string_view data, uint64_t offset, Index& index, uint64_t& liveBytes);
+	bool ReadRecord(std::string_view key, std::string& text, std::string* error) const;
+	bool NeedsCompaction() const;
+	void CompactionLoop();
+
+	std::string m_Path;
+	JsonStoreOptions m_Options;
+
+	// Guards the index, the read handle and the sizes. Writers take it only to publish.
+	mutable std::shared_mutex m_Mutex;
+	Index m_Index;
+	HANDLE m_ReadFile = INVALID_HANDLE_VALUE;
+	uint64_t m_LogSize = 0;
+	uint64_t m_LiveBytes = 0;
+
+	// Serializes writers
+	mutable std::mutex m_WriteMutex;
+	BufferedFileWriter m_Writer;
+
+	// Held for a whole compaction so Compact() and the background thread take turns
+	std::mutex m_CompactMutex;
+	std::mutex m_SignalMutex;
+	std::condition_variable m_CompactSignal;
+	std::thread m_Compactor;
+	bool m_Stopping = false;
+};
@@ -0,0 +1,357 @@
+#include "json_stream_writer.h"
+
+#include <atomic>
+#include <charconv>
+#include <cmath>
+
+JsonStreamWriter::JsonStreamWriter(size_t bufferSize)
+	: m_Writer(bufferSize)
+{
+}
+
+JsonStreamWriter::~JsonStreamWriter()
+{
+	// An unfinished document is thrown away rather than published
+	Close(nullptr);
+}
+
+bool JsonStreamWriter::Open(const std::string& path, const JsonSaveOptions& options, std::string* error)
+{
+	Close(nullptr);
+
+	auto fail = [&](const std::string& message) {
+		if (error) *error = message;
+		else Logger::Error("Failed saving ", path, " to json: ", message);
+		return false;
+	};
+
+	if (options.format != JsonFormat::Text && options.format != JsonFormat::Auto) {
+		return fail("only text can be streamed");
+	}
+
+	m_Path = path;
+	m_Options = options;
+	m_WritePath = path;
+	if (options.atomic) {
+		// Next to the target since the rename has to stay on one volume. The counter keeps
+		// writers open at the same time on one thread apart.
+		static std::atomic<uint64_t> s_Counter{ 0 };
+		m_WritePath += Utilities::Stringify(".", GetCurrentProcessId(), ".", GetCurrentThreadId(), ".", s_Counter.fetch_add(1), ".tmp");
+	}
+
+	std::string message;
+	// Without atomic the target itself is written, so the lock covers the whole stream
+	if (options.lock && !options.atomic && !m_Lock.Acquire(path, true, message)) {
+		return fail(message);
+	}
+	if (!m_Writer.Open(m_WritePath, BufferedFileWriter::Mode::Truncate, &message)) {
+		m_Lock.Release();
+		return fail(message);
+	}
+	m_Frames.clear();
+	m_RootWritten = false;
+	m_Error.clear();
+	return true;
+}
+
+bool JsonStreamWriter::Close(std::string* error)
+{
+	if (!m_Writer.IsOpen()) {
+		return true;
+	}
+
+	if (m_Error.empty() && (!m_RootWritten || !m_Frames.empty())) {
+		m_Error = "the document is incomplete";
+	}
+
+	std::string message = m_Error;
+	bool written = message.empty() && m_Writer.Flush(m_Options.fsync != FsyncPolicy::None, &message);
+	if (!m_Writer.Close(written ? &message : nullptr)) {
+		written = false;
+	}
+
+	if (m_Options.atomic) {
+		const fs::path temporary(m_WritePath);
+		// Like SaveToJson the lock is only held for the publishing step
+		if (written && m_Options.lock && !m_Lock.Acquire(m_Path, true, message)) {
+			written = false;
+		}
+		if (written && !Utilities::RenameOver(temporary, fs::path(m_Path), m_Options.fsync, &message)) {
+			written = false;
+		}
+		if (!written) {
+			DeleteFileW(temporary.c_str());
+		}
+	}
+
+	if (written && m_Options.lock) {
+		written = m_Lock.BumpGeneration(message);
+	}
+	m_Lock.Release();
+
+	m_Frames.clear();
+	m_Error.clear();
+	if (!written) {
+		if (error) *error = message;
+		else Logger::Error("Failed saving ", m_Path, " to json: ", message);
+	}
+	return written;
+}
+
+bool JsonStreamWriter::BeginObject()
+{
+	if (!BeginValue()) {
+		return false;
+	}
+	m_Writer.Buffer().push_back('{');
+	m_Frames.push_back({ true, false, 0 });
+	return Commit();
+}
+
+bool JsonStreamWriter::EndObject()
+{
+	return EndContainer(true);
+}
+
+bool JsonStreamWriter::BeginArray()
+{
+	if (!BeginValue()) {
+		return false;
+	}
+	m_Writer.Buffer().push_back('[');
+	m_Frames.push_back({ false, false, 0 });
+	return Commit();
+}
+
+bool JsonStreamWriter::EndArray()
+{
+	return EndContainer(false);
+}
+
+bool JsonStreamWriter::Key(std::string_view key)
+{
+	if (!m_Error.empty()) {
+		return false;
+	}
+	if (m_Frames.empty() || !m_Frames.back().object || m_Frames.back().keyPending) {
+		return Fail("a key can only start an object member");
+	}
+
+	Frame& frame = m_Frames.back();
+	std::string& out = m_Writer.Buffer();
+	if (frame.count > 0) {
+		out.push_back(',');
+	}
+	NewLine(m_Frames.size());
+	if (!AppendString(out, key)) {
+		return Fail("key is not valid UTF-8");
+	}
+	out.append(m_Options.indent >= 0 ? ": " : ":");
+	frame.keyPending = true;
+	return Commit();
+}
+
+bool JsonStreamWriter::Null()
+{
+	if (!BeginValue()) {
+		return false;
+	}
+	m_Writer.Buffer().append("null");
+	return Commit();
+}
+
+bool JsonStreamWriter::Bool(bool value)
+{
+	if (!BeginValue()) {
+		return false;
+	}
+	m_Writer.Buffer().append(value ? "true" : "false");
+	return Commit();
+}
+
+bool JsonStreamWriter::Int(int64_t value)
+{
+	if (!BeginValue()) {
+		return false;
+	}
+	char buffer[24];
+	const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+	m_Writer.Buffer().append(buffer, static_cast<size_t>(result.ptr - buffer));
+	return Commit();
+}
+
+bool JsonStreamWriter::Uint(uint64_t value)
+{
+	if (!BeginValue()) {
+		return false;
+	}
+	char buffer[24];
+	const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+	m_Writer.Buffer().append(buffer, static_cast<size_t>(result.ptr - buffer));
+	return Commit();
+}
+
+bool JsonStreamWriter::Double(double value)
+{
+	if (!BeginValue()) {
+		return false;
+	}
+	AppendDouble(m_Writer.Buffer(), value);
+	return Commit();
+}
+
+bool JsonStreamWriter::String(std::string_view value)
+{
+	if (!BeginValue()) {
+		return false;
+	}
+	if (!AppendString(m_Writer.Buffer(), value)) {
+		return Fail("string is not valid UTF-8");
+	}
+	return Commit();
+}
+
+bool JsonStreamWriter::Json(const nlohmann::json& value)
+{
+	if (!BeginValue()) {
+		return false;
+	}
+	try {
+		nlohmann::detail::serializer<nlohmann::json> serializer(nlohmann::detail::output_adapter<char>(m_Writer.Buffer()), ' ');
+		const unsigned indent = m_Options.indent >= 0 ? static_cast<unsigned>(m_Options.indent) : 0;
+		serializer.dump(value, m_Options.indent >= 0, false, indent, indent * static_cast<unsigned>(m_Frames.size()));
+	}
+	catch (const nlohmann::json::exception& e) {
+		return Fail(e.what());
+	}
+	return Commit();
+}
+
+bool JsonStreamWriter::AppendString(std::string& out, std::string_view value)
+{
+	if (!Encoding::ValidateUtf8(value)) {
+		return false;
+	}
+
+	// Same escapes as nlohmann's serializer without ensure_ascii: the named ones, \u00XX for
+	// the remaining control characters, everything else verbatim
+	out.push_back('"');
+	size_t run = 0;
+	for (size_t i = 0; i < value.size(); ++i) {
+		const unsigned char c = static_cast<unsigned char>(value[i]);
+		if (c >= 0x20 && c != '"' && c != '\\') {
+			continue;
+		}
+
+		out.append(value.data() + run, i - run);
+		run = i + 1;
+		switch (c) {
+		case '"': out.append("\\\""); break;
+		case '\\': out.append("\\\\"); break;
+		case '\b': out.append("\\b"); break;
+		case '\f': out.append("\\f"); break;
+		case '\n': out.append("\\n"); break;
+		case '\r': out.append("\\r"); break;
+		case '\t': out.append("\\t"); break;
+		default: {
+			static constexpr char kHex[] = "0123456789abcdef";
+			const char escaped[] = { '\\', 'u', '0', '0', kHex[c >> 4], kHex[c & 0xF] };
+			out.append(escaped, sizeof(escaped));
+			break;
+		}
+		}
+	}
+	out.append(value.data() + run, value.size() - run);
+	out.push_back('"');
+	return true;
+}
+
+void JsonStreamWriter::AppendDouble(std::string& out, double value)
+{
+	// Same shortest round-trip formatting nlohmann's serializer uses
+	if (!std::isfinite(value)) {
+		out.append("null");
+		return;
+	}
+	char buffer[64];
+	const char* end = nlohmann::detail::to_chars(buffer, buffer + sizeof(buffer), value);
+	out.append(buffer, static_cast<size_t>(end - buffer));
+}
+
+bool JsonStreamWriter::BeginValue()
+{
+	if (!m_Error.empty()) {
+		return false;
+	}
+	if (!m_Writer.IsOpen()) {
+		return Fail("the writer is not open");
+	}
+
+	if (m_Frames.empty()) {
+		if (m_RootWritten) {
+			return Fail("a document has only one root value");
+		}
+		m_RootWritten = true;
+		return true;
+	}
+
+	Frame& frame = m_Frames.back();
+	if (frame.object) {
+		if (!frame.keyPending) {
+			return Fail("an object member needs a key first");
+		}
+		frame.keyPending = false;
+	}
+	else {
+		if (frame.count > 0) {
+			m_Writer.Buffer().push_back(',');
+		}
+		NewLine(m_Frames.size());
+	}
+	++frame.count;
+	return true;
+}
+
+bool JsonStreamWriter::EndContainer(bool object)
+{
+	if (!m_Error.empty()) {
+		return false;
+	}
+	if (m_Frames.empty() || m_Frames.back().object != object || m_Frames.back().keyPending) {
+		return Fail(object ? "no object to end here" : "no array to end here");
+	}
+
+	// Empty containers stay on one line, as in nlohmann's dump()
+	if (m_Frames.back().count > 0) {
+		NewLine(m_Frames.size() - 1);
+	}
+	m_Writer.Buffer().push_back(object ? '}' : ']');
+	m_Frames.pop_back();
+	return Commit();
+}
+
+bool JsonStreamWriter::Commit()
+{
+	std::string message;
+	if (!m_Writer.Commit(&message)) {
+		return Fail(message);
+	}
+	return true;
+}
+
+void JsonStreamWriter::NewLine(size_t depth)
+{
+	if (m_Options.indent >= 0) {
+		std::string& out = m_Writer.Buffer();
+		out.push_back('\n');
+		out.append(static_cast<size_t>(m_Options.indent) * depth, ' ');
+	}
+}
+
+bool JsonStreamWriter::Fail(const std::string& message)
+{
+	if (m_Error.empty()) {
+		m_Error = message;
+	}
+	return false;
+}
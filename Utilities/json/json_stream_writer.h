@@ -0,0 +1,100 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "../utils/utilities.h"
+#include "../io/buffered_writer.h"
+#include "../io/file_lock.h"
+
+// Writes one JSON text token by token through a BufferedFileWriter, so memory stays at the
+// buffer size plus the nesting depth however large the output gets. Escaping, number
+// formatting and pretty printing match nlohmann's dump() byte for byte.
+//
+// Calls out of order (a key inside an array, a value where a key belongs, a second root)
+// fail. The first failure sticks: every later call returns false and Close() reports it, so
+// a long run of writes can be checked once at the end.
+class JsonStreamWriter
+{
+public:
+	explicit JsonStreamWriter(size_t bufferSize = 4 << 20);
+	~JsonStreamWriter();
+
+	JsonStreamWriter(const JsonStreamWriter&) = delete;
+	JsonStreamWriter& operator=(const JsonStreamWriter&) = delete;
+
+	// Honors indent, atomic, fsync and lock. With atomic the output goes to a temporary file
+	// that only replaces the target once Close() sees a complete document, and lock is held
+	// for that rename alone; without atomic it is held from Open() to Close(). The tokens
+	// arrive one at a time, so threads does not apply.
+	bool Open(const std::string& path, const JsonSaveOptions& options = {}, std::string* error = nullptr);
+	// Finishes the file. Fails, and with atomic leaves the target untouched, when a call
+	// failed or a container is still open.
+	bool Close(std::string* error = nullptr);
+	bool IsOpen() const { return m_Writer.IsOpen(); }
+
+	bool BeginObject();
+	bool EndObject();
+	bool BeginArray();
+	bool EndArray();
+	bool Key(std::string_view key);
+
+	bool Null();
+	bool Bool(bool value);
+	bool Int(int64_t value);
+	bool Uint(uint64_t value);
+	bool Double(double value);
+	bool String(std::string_view value);
+	// Writes a whole DOM subtree in place, indented to the current depth
+	bool Json(const nlohmann::json& value);
+
+	// Picks the overload above that matches T
+	template <typename T>
+	bool Value(const T& value)
+	{
+		if constexpr (std::is_same_v<T, std::nullptr_t>) return Null();
+		else if constexpr (std::is_same_v<T, bool>) return Bool(value);
+		else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) return Int(value);
+		else if constexpr (std::is_integral_v<T>) return Uint(value);
+		else if constexpr (std::is_floating_point_v<T>) return Double(value);
+		else if constexpr (std::is_convertible_v<const T&, std::string_view>) return String(value);
+		else return Json(nlohmann::json(value));
+	}
+
+	bool Failed() const { return !m_Error.empty(); }
+	const std::string& Error() const { return m_Error; }
+	// Nesting depth of the next token
+	size_t Depth() const { return m_Frames.size(); }
+
+	// The escaping and number formatting used above, for other writers that need to match
+	// nlohmann's output. AppendString fails on invalid UTF-8, which nlohmann refuses as well.
+	static bool AppendString(std::string& out, std::string_view value);
+	static void AppendDouble(std::string& out, double value);
+
+private:
+	struct Frame
+	{
+		bool object = false;
+		// A key was written and its value has not been
+		bool keyPending = false;
+		size_t count = 0;
+	};
+
+	// Writes the separator and indentation that go before a value, fails out of place
+	bool BeginValue();
+	bool EndContainer(bool object);
+	bool Commit();
+	void NewLine(size_t depth);
+	bool Fail(const std::string& message);
+
+	BufferedFileWriter m_Writer;
+	std::string m_Path;
+	std::string m_WritePath;
+	JsonSaveOptions m_Options;
+	JsonFileLock m_Lock;
+	std::vector<Frame> m_Frames;
+	bool m_RootWritten = false;
+	std::string m_Error;
+};
@@ -0,0 +1,298 @@
+#include "layered_config.h"
+
+#include <algorithm>
+
+namespace
+{
+	using json = nlohmann::json;
+
+	std::string JoinPath(const std::vector<std::string>& path)
+	{
+		std::string joined;
+		for (const std::string& key : path) {
+			if (!joined.empty()) {
+				joined.push_back('.');
+			}
+			joined += key;
+		}
+		return joined;
+	}
+}
+
+LayeredConfig::LayeredConfig()
+	: m_Merged(json::object())
+{
+}
+
+size_t LayeredConfig::AddLayer(const std::string& name, json patch)
+{
+	// An empty layer on top changes nothing, then the patch is set like any other change.
+	// Over a result that is not an object even an empty one does: it makes it an object.
+	m_Layers.push_back({ name, json::object() });
+	const size_t index = m_Layers.size() - 1;
+	if (m_Merged.is_object()) {
+		SetLayer(index, std::move(patch));
+	}
+	else {
+		m_Layers[index].patch = std::move(patch);
+		Rebuild();
+		++m_Generation;
+	}
+	return index;
+}
+
+int LayeredConfig::FindLayer(const std::string& name) const
+{
+	for (size_t i = 0; i < m_Layers.size(); ++i) {
+		if (m_Layers[i].name == name) {
+			return static_cast<int>(i);
+		}
+	}
+	return -1;
+}
+
+bool LayeredConfig::SetLayer(size_t index, json patch)
+{
+	if (index >= m_Layers.size()) {
+		return false;
+	}
+
+	json before = std::exchange(m_Layers[index].patch, std::move(patch));
+	const json& after = m_Layers[index].patch;
+
+	// A layer that is not an object replaces the whole result, nothing to narrow down
+	if (!before.is_object() || !after.is_object()) {
+		if (before != after) {
+			Rebuild();
+			++m_Generation;
+		}
+		return true;
+	}
+
+	Path path;
+	std::vector<Path> changed;
+	Diff(before, after, path, changed);
+	for (const Path& subtree : changed) {
+		Recompute(subtree);
+	}
+	if (!changed.empty()) {
+		++m_Generation;
+	}
+	return true;
+}
+
+bool LayeredConfig::PatchLayer(size_t index, const json& patch)
+{
+	if (index >= m_Layers.size()) {
+		return false;
+	}
+
+	json& layer = m_Layers[index].patch;
+	if (!layer.is_object() || !patch.is_object()) {
+		json updated = layer;
+		updated.merge_patch(patch);
+		return SetLayer(index, std::move(updated));
+	}
+
+	Path path;
+	std::vector<Path> changed;
+	Touched(layer, patch, path, changed);
+	layer.merge_patch(patch);
+	for (const Path& subtree : changed) {
+		Recompute(subtree);
+	}
+	if (!changed.empty()) {
+		++m_Generation;
+	}
+	return true;
+}
+
+bool LayeredConfig::LoadLayer(size_t index, const std::string& filename, const JsonLoadOptions& options, std::string* error)
+{
+	if (index >= m_Layers.size()) {
+		if (error) *error = Utilities::Stringify("no layer ", index);
+		else Logger::Error("Failed loading ", filename, " into layer ", index, ": no such layer");
+		return false;
+	}
+	json patch;
+	if (!Utilities::LoadFromJson(filename, patch, options, error)) {
+		return false;
+	}
+	return SetLayer(index, std::move(patch));
+}
+
+const json* LayeredConfig::Get(std::string_view path) const
+{
+	if (path.empty()) {
+		return &m_Merged;
+	}
+	const auto it = m_Index.find(path);
+	return it == m_Index.end() ? nullptr : it->second;
+}
+
+void LayeredConfig::Rebuild()
+{
+	m_Merged = json::object();
+	for (const LayerData& layer : m_Layers) {
+		m_Merged.merge_patch(layer.patch);
+	}
+
+	m_Index.clear();
+	if (m_Merged.is_object()) {
+		for (const auto& [key, child] : m_Merged.items()) {
+			if (key.find('.') == std::string::npos) {
+				Index(key, child);
+			}
+		}
+	}
+}
+
+void LayeredConfig::Diff(const json& before, const json& after, Path& path, std::vector<Path>& changed)
+{
+	// Both are objects here, walked side by side in key order. Members only one side has
+	// changed, members both have are followed while both are objects and compared once
+	// either is not.
+	auto left = before.begin();
+	auto right = after.begin();
+	while (left != before.end() || right != after.end()) {
+		if (right == after.end() || (left != before.end() && left.key() < right.key())) {
+			path.push_back(left.key());
+			changed.push_back(path);
+			++left;
+		}
+		else if (left == before.end() || right.key() < left.key()) {
+			path.push_back(right.key());
+			changed.push_back(path);
+			++right;
+		}
+		else {
+			path.push_back(left.key());
+			if (left->is_object() && right->is_object()) {
+				Diff(*left, *right, path, changed);
+			}
+			else if (*left != *right) {
+				changed.push_back(path);
+			}
+			++left;
+			++right;
+		}
+		path.pop_back();
+	}
+}
+
+void LayeredConfig::Touched(const json& layer, const json& patch, Path& path, std::vector<Path>& changed)
+{
+	for (const auto& [key, value] : patch.items()) {
+		path.push_back(key);
+		const auto it = layer.find(key);
+		// Only followed where the layer stays an object, as Recompute() expects
+		if (value.is_object() && it != layer.end() && it->is_object()) {
+			Touched(*it, value, path, changed);
+		}
+		else {
+			changed.push_back(path);
+		}
+		path.pop_back();
+	}
+}
+
+void LayeredConfig::Recompute(const Path& path)
+{
+	// The layer that changed is an object at every ancestor of path, before and after, so the
+	// ancestors in the result are what they were. When one of them is gone or not an object,
+	// a higher layer hides path and there is nothing to update.
+	json* parent = &m_Merged;
+	for (size_t i = 0; i + 1 < path.size(); ++i) {
+		if (!parent->is_object()) {
+			return;
+		}
+		const auto it = parent->find(path[i]);
+		if (it == parent->end()) {
+			return;
+		}
+		parent = &*it;
+	}
+	if (!parent->is_object()) {
+		return;
+	}
+
+	// Fold the layers at path alone. A layer that deletes or replaces an ancestor wipes what
+	// the layers below put there, one that has nothing along the way leaves it alone.
+	json value;
+	bool present = false;
+	for (const LayerData& layer : m_Layers) {
+		const json* node = &layer.patch;
+		bool reached = true;
+		for (const std::string& key : path) {
+			if (!node->is_object()) {
+				value = nullptr;
+				present = false;
+				reached = false;
+				break;
+			}
+			const auto it = node->find(key);
+			if (it == node->end()) {
+				reached = false;
+				break;
+			}
+			node = &*it;
+		}
+		if (!reached) {
+			continue;
+		}
+
+		if (node->is_null()) {
+			value = nullptr;
+			present = false;
+		}
+		else {
+			value.merge_patch(*node);
+			present = true;
+		}
+	}
+
+	// A key with a '.' keeps its whole subtree out of the index
+	const bool indexed = std::none_of(path.begin(), path.end(), [](const std::string& key) { return key.find('.') != std::string::npos; });
+	const std::string prefix = JoinPath(path);
+	const std::string& key = path.back();
+	const auto it = parent->find(key);
+	if (indexed && it != parent->end()) {
+		Unindex(prefix, *it);
+	}
+	if (!present) {
+		if (it != parent->end()) {
+			parent->erase(it);
+		}
+		return;
+	}
+
+	json& slot = (*parent)[key];
+	slot = std::move(value);
+	if (indexed) {
+		Index(prefix, slot);
+	}
+}
+
+void LayeredConfig::Index(const std::string& prefix, const json& node)
+{
+	m_Index[prefix] = &node;
+	if (node.is_object()) {
+		for (const auto& [name, child] : node.items()) {
+			if (name.find('.') == std::string::npos) {
+				Index(prefix + "." + name, child);
+			}
+		}
+	}
+}
+
+void LayeredConfig::Unindex(const std::string& prefix, const json& node)
+{
+	m_Index.erase(prefix);
+	if (node.is_object()) {
+		for (const auto& [name, child] : node.items()) {
+			if (name.find('.') == std::string::npos) {
+				Unindex(prefix + "." + name, child);
+			}
+		}
+	}
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "../utils/utilities.h"
+
+// A config built from stacked layers (defaults, machine, user, environment, ...), each an
+// RFC 7386 merge patch applied over the ones below it. Every layer is kept separately, so
+// when one changes only the subtrees its old and new versions disagree on are merged again,
+// folding just that path through the layers instead of rebuilding the whole result.
+//
+// Lookups by dotted path ("server.tls.port") go through a hash index of every object member
+// that is kept in step with the recomputed subtrees. Members whose key contains a '.' are
+// left out of the index and can only be reached through Merged(). Not thread safe: share it
+// across threads behind a lock, or publish Merged() snapshots.
+class LayeredConfig
+{
+public:
+	LayeredConfig();
+
+	// Adds a layer above all existing ones and returns its index
+	size_t AddLayer(const std::string& name, nlohmann::json patch = nlohmann::json::object());
+	size_t LayerCount() const { return m_Layers.size(); }
+	// The index of the named layer, or -1
+	int FindLayer(const std::string& name) const;
+	const std::string& LayerName(size_t index) const { return m_Layers.at(index).name; }
+	const nlohmann::json& Layer(size_t index) const { return m_Layers.at(index).patch; }
+
+	// Replaces one layer. False when there is no such layer.
+	bool SetLayer(size_t index, nlohmann::json patch);
+	// Applies a merge patch to one layer, only the paths the patch names are looked at
+	bool PatchLayer(size_t index, const nlohmann::json& patch);
+	// Replaces one layer with a file's contents, the layer is unchanged when loading fails
+	bool LoadLayer(size_t index, const std::string& filename, const JsonLoadOptions& options = {}, std::string* error = nullptr);
+
+	const nlohmann::json& Merged() const { return m_Merged; }
+	// nullptr when nothing is at the path, the empty path is the root. Valid until the next
+	// change of any layer.
+	const nlohmann::json* Get(std::string_view path) const;
+
+	template <typename T>
+	T Value(std::string_view path, const T& defaultValue) const
+	{
+		const nlohmann::json* value = Get(path);
+		return value ? value->get<T>() : defaultValue;
+	}
+	std::string Value(std::string_view path, const char* defaultValue) const { return Value<std::string>(path, defaultValue); }
+
+	// Grows by one with every change that reached the merged result
+	uint64_t Generation() const { return m_Generation; }
+
+private:
+	struct LayerData
+	{
+		std::string name;
+		nlohmann::json patch;
+	};
+
+	struct PathHash
+	{
+		using is_transparent = void;
+		size_t operator()(std::string_view path) const { return std::hash<std::string_view>()(path); }
+	};
+
+	using Path = std::vector<std::string>;
+
+	void Rebuild();
+	// Collects the topmost paths where two versions of a layer differ
+	static void Diff(const nlohmann::json& before, const nlohmann::json& after, Path& path, std::vector<Path>& changed);
+	// Collects the topmost paths a merge patch replaces or deletes in layer
+	static void Touched(const nlohmann::json& layer, const nlohmann::json& patch, Path& path, std::vector<Path>& changed);
+	void Recompute(const Path& path);
+	void Index(const std::string& prefix, const nlohmann::json& node);
+	void Unindex(const std::string& prefix, const nlohmann::json& node);
+
+	std::vector<LayerData> m_Layers;
+	nlohmann::json m_Merged;
+	std::unordered_map<std::string, const nlohmann::json*, PathHash, std::equal_to<>> m_Index;
+	uint64_t m_Generation = 0;
+};
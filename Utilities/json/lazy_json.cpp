@@ -0,0 +1,448 @@
+#include "lazy_json.h"
+#include "../utils/cpu_features.h"
+#include "../utils/utilities.h"
+
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+	constexpr size_t kBlockSize = 64;
+
+	struct BlockMasks
+	{
+		uint64_t quote = 0;
+		uint64_t backslash = 0;
+		uint64_t structural = 0;
+	};
+
+// Every x86 build has SSE2, the scalar classifier only exists for other targets
+#if !defined(UTILITIES_SSE2)
+	// '[' and ']' differ from '{' and '}' only in bit 0x20
+	inline bool IsBracket(unsigned char c)
+	{
+		return (c | 0x20) == '{' || (c | 0x20) == '}';
+	}
+
+	BlockMasks ClassifyScalar(const unsigned char* in)
+	{
+		BlockMasks masks;
+		for (size_t i = 0; i < kBlockSize; ++i) {
+			const unsigned char c = in[i];
+			const uint64_t bit = uint64_t(1) << i;
+			if (c == '"') masks.quote |= bit;
+			else if (c == '\\') masks.backslash |= bit;
+			else if (IsBracket(c) || c == ':' || c == ',') masks.structural |= bit;
+		}
+		return masks;
+	}
+#endif
+
+#if defined(UTILITIES_SSE2)
+	inline BlockMasks ClassifySse2(const unsigned char* in)
+	{
+		const __m128i quote = _mm_set1_epi8('"');
+		const __m128i backslash = _mm_set1_epi8('\\');
+		const __m128i lower = _mm_set1_epi8(0x20);
+		const __m128i openBrace = _mm_set1_epi8('{');
+		const __m128i closeBrace = _mm_set1_epi8('}');
+		const __m128i colon = _mm_set1_epi8(':');
+		const __m128i comma = _mm_set1_epi8(',');
+
+		BlockMasks masks;
+		for (size_t i = 0; i < kBlockSize; i += 16) {
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+			const __m128i folded = _mm_or_si128(v, lower);
+			const __m128i structural = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(folded, openBrace), _mm_cmpeq_epi8(folded, closeBrace)),
+				_mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma)));
+
+			masks.quote |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)))) << i;
+			masks.backslash |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash)))) << i;
+			masks.structural |= uint64_t(uint16_t(_mm_movemask_epi8(structural))) << i;
+		}
+		return masks;
+	}
+#endif
+
+#if defined(UTILITIES_X86)
+	UTILITIES_TARGET_AVX2 BlockMasks ClassifyAvx2(const unsigned char* in)
+	{
+		const __m256i quote = _mm256_set1_epi8('"');
+		const __m256i backslash = _mm256_set1_epi8('\\');
+		const __m256i lower = _mm256_set1_epi8(0x20);
+		const __m256i openBrace = _mm256_set1_epi8('{');
+		const __m256i closeBrace = _mm256_set1_epi8('}');
+		const __m256i colon = _mm256_set1_epi8(':');
+		const __m256i comma = _mm256_set1_epi8(',');
+
+		BlockMasks masks;
+		for (size_t i = 0; i < kBlockSize; i += 32) {
+			const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+			const __m256i folded = _mm256_or_si256(v, lower);
+			const __m256i structural = _mm256_or_si256(
+				_mm256_or_si256(_mm256_cmpeq_epi8(folded, openBrace), _mm256_cmpeq_epi8(folded, closeBrace)),
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, colon), _mm256_cmpeq_epi8(v, comma)));
+
+			masks.quote |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote)))) << i;
+			masks.backslash |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, backslash)))) << i;
+			masks.structural |= uint64_t(uint32_t(_mm256_movemask_epi8(structural))) << i;
+		}
+		return masks;
+	}
+#endif
+
+	using ClassifyFn = BlockMasks (*)(const unsigned char*);
+
+	ClassifyFn SelectClassifier()
+	{
+#if defined(UTILITIES_X86)
+		if (CpuFeatures::Get().avx2) {
+			return ClassifyAvx2;
+		}
+#endif
+#if defined(UTILITIES_SSE2)
+		return ClassifySse2;
+#else
+		return ClassifyScalar;
+#endif
+	}
+
+	// Bit i of the result is the xor of bits 0..i, i.e. set while inside a quoted run
+	inline uint64_t PrefixXor(uint64_t bits)
+	{
+		bits ^= bits << 1;
+		bits ^= bits << 2;
+		bits ^= bits << 4;
+		bits ^= bits << 8;
+		bits ^= bits << 16;
+		bits ^= bits << 32;
+		return bits;
+	}
+
+	// Characters escaped by a backslash. Backslash runs are rare, so they are resolved bit
+	// by bit. escapeNext carries a trailing unescaped backslash into the next block.
+	inline uint64_t EscapedChars(uint64_t backslash, bool& escapeNext)
+	{
+		uint64_t escaped = escapeNext ? 1 : 0;
+		escapeNext = false;
+		while (backslash) {
+			const int i = std::countr_zero(backslash);
+			backslash &= backslash - 1;
+			if (escaped & (uint64_t(1) << i)) {
+				continue;
+			}
+			if (i == 63) {
+				escapeNext = true;
+			}
+			else {
+				escaped |= uint64_t(1) << (i + 1);
+			}
+		}
+		return escaped;
+	}
+
+	inline bool IsWhitespace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+	}
+}
+
+bool LazyJsonDocument::Open(const std::string& path, std::string* error)
+{
+	Close();
+
+	if (!m_File.Open(path, error)) {
+		return false;
+	}
+	m_Text = m_File.View();
+
+	if (!BuildIndex(error)) {
+		if (error) *error = Utilities::Stringify(path, ": ", *error);
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool LazyJsonDocument::Load(std::string_view text, std::string* error)
+{
+	Close();
+
+	m_Text = text;
+	if (!BuildIndex(error)) {
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void LazyJsonDocument::Close()
+{
+	m_File.Close();
+	m_Text = {};
+	m_Positions = {};
+	m_OpenBits = {};
+	m_OpenRank = {};
+	m_Match = {};
+}
+
+bool LazyJsonDocument::BuildIndex(std::string* error)
+{
+	auto fail = [&](const std::string& message) {
+		if (error) *error = message;
+		return false;
+	};
+
+	if (m_Text.size() >= UINT32_MAX) {
+		return fail("document is larger than 4 GiB");
+	}
+
+	const auto* in = reinterpret_cast<const unsigned char*>(m_Text.data());
+	const size_t length = m_Text.size();
+	const ClassifyFn classify = SelectClassifier();
+
+	bool escapeNext = false;
+	uint64_t inStringCarry = 0;
+	auto emit = [&](const unsigned char* block, uint32_t base) {
+		const BlockMasks masks = classify(block);
+		uint64_t escaped = 0;
+		if (masks.backslash || escapeNext) {
+			escaped = EscapedChars(masks.backslash, escapeNext);
+		}
+
+		// An opening quote starts an odd run, so it is the only quote set in inString
+		const uint64_t quotes = masks.quote & ~escaped;
+		const uint64_t inString = PrefixXor(quotes) ^ inStringCarry;
+		inStringCarry = uint64_t(int64_t(inString) >> 63);
+
+		uint64_t structural = (masks.structural & ~inString) | (quotes & inString);
+		size_t count = m_Positions.size();
+		m_Positions.resize(count + std::popcount(structural));
+		while (structural) {
+			m_Positions[count++] = base + std::countr_zero(structural);
+			structural &= structural - 1;
+		}
+	};
+
+	m_Positions.reserve(length / 8 + 16);
+	size_t offset = 0;
+	for (; offset + kBlockSize <= length; offset += kBlockSize) {
+		emit(in + offset, static_cast<uint32_t>(offset));
+	}
+	if (offset < length) {
+		unsigned char tail[kBlockSize];
+		memset(tail, ' ', sizeof(tail));
+		memcpy(tail, in + offset, length - offset);
+		emit(tail, static_cast<uint32_t>(offset));
+	}
+	if (inStringCarry) {
+		return fail("unterminated string");
+	}
+
+	// Pair up brackets so containers can be skipped in O(1). Only opening brackets get a
+	// match slot, found through the rank bitmap.
+	const size_t blocks = m_Positions.size() / 64 + 1;
+	m_OpenBits.assign(blocks, 0);
+	m_OpenRank.assign(blocks, 0);
+	m_Match.clear();
+	// Index and ordinal of every unclosed opening bracket
+	std::vector<std::pair<uint32_t, uint32_t>> open;
+	for (uint32_t i = 0; i < m_Positions.size(); ++i) {
+		if (i % 64 == 0) {
+			m_OpenRank[i / 64] = static_cast<uint32_t>(m_Match.size());
+		}
+		const char c = m_Text[m_Positions[i]];
+		if (c == '{' || c == '[') {
+			m_OpenBits[i / 64] |= uint64_t(1) << (i % 64);
+			open.emplace_back(i, static_cast<uint32_t>(m_Match.size()));
+			m_Match.push_back(0);
+		}
+		else if (c == '}' || c == ']') {
+			if (open.empty() || m_Text[m_Positions[open.back().first]] != (c == '}' ? '{' : '[')) {
+				return fail(Utilities::Stringify("unbalanced '", c, "' at offset ", m_Positions[i]));
+			}
+			m_Match[open.back().second] = i;
+			open.pop_back();
+		}
+	}
+	if (!open.empty()) {
+		return fail(Utilities::Stringify("unclosed '", m_Text[m_Positions[open.back().first]], "' at offset ", m_Positions[open.back().first]));
+	}
+
+	if (SkipWhitespace(0) == length) {
+		return fail("document is empty");
+	}
+	return true;
+}
+
+uint32_t LazyJsonDocument::SkipWhitespace(uint32_t offset) const
+{
+	while (offset < m_Text.size() && IsWhitespace(m_Text[offset])) {
+		++offset;
+	}
+	return offset;
+}
+
+uint32_t LazyJsonDocument::NextIndex(const LazyJsonValue& value) const
+{
+	switch (m_Text[value.m_Offset]) {
+	case '{':
+	case '[':
+		return CloseIndex(value.m_Index) + 1;
+	case '"':
+		// The closing quote is not indexed
+		return value.m_Index + 1;
+	default:
+		return value.m_Index;
+	}
+}
+
+uint32_t LazyJsonDocument::ValueEnd(const LazyJsonValue& value) const
+{
+	const char c = m_Text[value.m_Offset];
+	if (c == '{' || c == '[') {
+		return m_Positions[CloseIndex(value.m_Index)] + 1;
+	}
+
+	const uint32_t next = NextIndex(value);
+	uint32_t end = next < m_Positions.size() ? m_Positions[next] : static_cast<uint32_t>(m_Text.size());
+	while (end > value.m_Offset && IsWhitespace(m_Text[end - 1])) {
+		--end;
+	}
+	return end;
+}
+
+LazyJsonValue LazyJsonDocument::Root() const
+{
+	if (m_Text.empty()) {
+		return LazyJsonValue();
+	}
+	return LazyJsonValue(this, SkipWhitespace(0), 0);
+}
+
+nlohmann::json::value_t LazyJsonValue::type() const
+{
+	using value_t = nlohmann::json::value_t;
+
+	if (is_discarded()) {
+		return value_t::discarded;
+	}
+
+	switch (m_Document->m_Text[m_Offset]) {
+	case '{': return value_t::object;
+	case '[': return value_t::array;
+	case '"': return value_t::string;
+	case 't':
+	case 'f': return value_t::boolean;
+	case 'n': return value_t::null;
+	case '-': break;
+	default:
+		if (m_Document->m_Text[m_Offset] < '0' || m_Document->m_Text[m_Offset] > '9') {
+			return value_t::discarded;
+		}
+	}
+
+	const std::string_view number = raw();
+	if (number.find_first_of(".eE") != std::string_view::npos) {
+		return value_t::number_float;
+	}
+	return number[0] == '-' ? value_t::number_integer : value_t::number_unsigned;
+}
+
+size_t LazyJsonValue::size() const
+{
+	size_t count = 0;
+	Children([&](uint32_t, const LazyJsonValue&) {
+		++count;
+		return true;
+	});
+	return count;
+}
+
+LazyJsonValue LazyJsonValue::operator[](std::string_view key) const
+{
+	LazyJsonValue found;
+	if (is_object()) {
+		Children([&](uint32_t keyIndex, const LazyJsonValue& child) {
+			if (!KeyEquals(keyIndex, key)) {
+				return true;
+			}
+			found = child;
+			return false;
+		});
+	}
+	return found;
+}
+
+LazyJsonValue LazyJsonValue::operator[](size_t index) const
+{
+	LazyJsonValue found;
+	if (is_array()) {
+		size_t current = 0;
+		Children([&](uint32_t, const LazyJsonValue& child) {
+			if (current++ != index) {
+				return true;
+			}
+			found = child;
+			return false;
+		});
+	}
+	return found;
+}
+
+LazyJsonValue LazyJsonValue::at(std::string_view key) const
+{
+	LazyJsonValue found = (*this)[key];
+	if (found.is_discarded()) {
+		throw std::out_of_range(Utilities::Stringify("key '", key, "' not found"));
+	}
+	return found;
+}
+
+LazyJsonValue LazyJsonValue::at(size_t index) const
+{
+	LazyJsonValue found = (*this)[index];
+	if (found.is_discarded()) {
+		throw std::out_of_range(Utilities::Stringify("index ", index, " is out of range"));
+	}
+	return found;
+}
+
+std::string_view LazyJsonValue::raw() const
+{
+	if (is_discarded()) {
+		return {};
+	}
+	return m_Document->m_Text.substr(m_Offset, m_Document->ValueEnd(*this) - m_Offset);
+}
+
+nlohmann::json LazyJsonValue::ToJson() const
+{
+	if (is_discarded()) {
+		return nlohmann::json(nlohmann::json::value_t::discarded);
+	}
+	const std::string_view text = raw();
+	return nlohmann::json::parse(text.data(), text.data() + text.size());
+}
+
+std::string LazyJsonValue::Key(uint32_t quoteIndex) const
+{
+	const LazyJsonValue key(m_Document, m_Document->m_Positions[quoteIndex], quoteIndex);
+	const std::string_view text = key.raw();
+	if (text.size() >= 2 && text.find('\\') == std::string_view::npos) {
+		return std::string(text.substr(1, text.size() - 2));
+	}
+	return key.get<std::string>();
+}
+
+bool LazyJsonValue::KeyEquals(uint32_t quoteIndex, std::string_view key) const
+{
+	const LazyJsonValue candidate(m_Document, m_Document->m_Positions[quoteIndex], quoteIndex);
+	const std::string_view text = candidate.raw();
+	if (text.find('\\') == std::string_view::npos) {
+		return text.size() == key.size() + 2 && text.substr(1, key.size()) == key;
+	}
+	return candidate.get<std::string>() == key;
+}
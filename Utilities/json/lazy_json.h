@@ -0,0 +1,217 @@
+#pragma once
+#include <bit>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../dependencies/json.hpp"
+#include "../io/mapped_file.h"
+
+class LazyJsonDocument;
+
+// Read-only handle to one value of a LazyJsonDocument. Nothing is decoded until get<T>()
+// or ToJson() is called, and then only this value's bytes are parsed. Looking up a key
+// or index that does not exist yields a discarded value instead of throwing, so lookups
+// can be chained and checked once at the end. The document must outlive its values.
+class LazyJsonValue
+{
+public:
+	LazyJsonValue() = default;
+
+	nlohmann::json::value_t type() const;
+	bool is_discarded() const { return m_Document == nullptr; }
+	bool is_object() const { return type() == nlohmann::json::value_t::object; }
+	bool is_array() const { return type() == nlohmann::json::value_t::array; }
+	bool is_string() const { return type() == nlohmann::json::value_t::string; }
+	bool is_boolean() const { return type() == nlohmann::json::value_t::boolean; }
+	bool is_null() const { return type() == nlohmann::json::value_t::null; }
+	bool is_number() const
+	{
+		const nlohmann::json::value_t t = type();
+		return t == nlohmann::json::value_t::number_integer || t == nlohmann::json::value_t::number_unsigned ||
+			t == nlohmann::json::value_t::number_float;
+	}
+
+	// Number of members or elements, 0 for scalars
+	size_t size() const;
+	bool contains(std::string_view key) const { return !(*this)[key].is_discarded(); }
+
+	LazyJsonValue operator[](std::string_view key) const;
+	LazyJsonValue operator[](size_t index) const;
+	LazyJsonValue operator[](const char* key) const { return (*this)[std::string_view(key)]; }
+	LazyJsonValue operator[](int index) const { return (*this)[static_cast<size_t>(index)]; }
+
+	// Like operator[] but throws std::out_of_range when the value is missing
+	LazyJsonValue at(std::string_view key) const;
+	LazyJsonValue at(size_t index) const;
+
+	// Calls fn(key, value) for every member of an object, keys come back unescaped
+	template <typename Fn>
+	void items(Fn&& fn) const;
+
+	// Calls fn(value) for every element of an array
+	template <typename Fn>
+	void elements(Fn&& fn) const;
+
+	// The value's source text, a string keeps its quotes and escapes
+	std::string_view raw() const;
+
+	// Parses just this value. Malformed text throws nlohmann::json::parse_error.
+	nlohmann::json ToJson() const;
+
+	template <typename T>
+	T get() const { return ToJson().template get<T>(); }
+
+	template <typename T>
+	T value(std::string_view key, const T& defaultValue) const
+	{
+		LazyJsonValue member = (*this)[key];
+		return member.is_discarded() ? defaultValue : member.get<T>();
+	}
+
+	std::string value(std::string_view key, const char* defaultValue) const { return value<std::string>(key, defaultValue); }
+
+private:
+	friend class LazyJsonDocument;
+
+	LazyJsonValue(const LazyJsonDocument* document, uint32_t offset, uint32_t index)
+		: m_Document(document), m_Offset(offset), m_Index(index)
+	{
+	}
+
+	// Walks the members or elements, stopping when fn returns false
+	template <typename Fn>
+	void Children(Fn&& fn) const;
+	std::string Key(uint32_t quoteIndex) const;
+	bool KeyEquals(uint32_t quoteIndex, std::string_view key) const;
+
+	const LazyJsonDocument* m_Document = nullptr;
+	uint32_t m_Offset = 0;
+	// First structural at or after m_Offset, the value's own one for containers and strings
+	uint32_t m_Index = 0;
+};
+
+// Read-only JSON document that only builds a structural index on load: the positions of
+// every brace, bracket, colon, comma and opening quote outside of strings, found with an
+// SSE2/AVX2 scan, plus the matching close for every container. Values are decoded on
+// access through LazyJsonValue. The index costs 4 bytes per structural character, 4 more
+// per container and a rank bitmap of under 2 bits per structural, and files must stay
+// under 4 GiB because positions are 32 bit.
+class LazyJsonDocument
+{
+public:
+	LazyJsonDocument() = default;
+
+	LazyJsonDocument(const LazyJsonDocument&) = delete;
+	LazyJsonDocument& operator=(const LazyJsonDocument&) = delete;
+	LazyJsonDocument(LazyJsonDocument&&) noexcept = default;
+	LazyJsonDocument& operator=(LazyJsonDocument&&) noexcept = default;
+
+	// Maps the file and indexes it. Fails on unbalanced brackets or unterminated strings,
+	// anything else malformed only surfaces when the broken value is decoded.
+	bool Open(const std::string& path, std::string* error = nullptr);
+	// Indexes text owned by the caller, which has to stay alive as long as the document
+	bool Load(std::string_view text, std::string* error = nullptr);
+	void Close();
+
+	// Discarded when nothing is loaded
+	LazyJsonValue Root() const;
+	std::string_view Text() const { return m_Text; }
+	size_t IndexSize() const { return m_Positions.size(); }
+
+private:
+	friend class LazyJsonValue;
+
+	bool BuildIndex(std::string* error);
+	uint32_t SkipWhitespace(uint32_t offset) const;
+	// Index of the first structural after the value
+	uint32_t NextIndex(const LazyJsonValue& value) const;
+	uint32_t ValueEnd(const LazyJsonValue& value) const;
+	// Index of the bracket closing the '{' or '[' at openIndex
+	uint32_t CloseIndex(uint32_t openIndex) const
+	{
+		const uint32_t block = openIndex / 64;
+		const uint64_t below = m_OpenBits[block] & ((uint64_t(1) << (openIndex % 64)) - 1);
+		return m_Match[m_OpenRank[block] + std::popcount(below)];
+	}
+
+	MappedFile m_File;
+	std::string_view m_Text;
+	std::vector<uint32_t> m_Positions;
+	// Bit i is set when structural i is a '{' or '['. m_OpenRank[b] counts the set bits in
+	// the blocks before b, so an opening bracket's ordinal is one popcount away.
+	std::vector<uint64_t> m_OpenBits;
+	std::vector<uint32_t> m_OpenRank;
+	// By ordinal of the opening bracket, the index of its closing bracket
+	std::vector<uint32_t> m_Match;
+};
+
+template <typename Fn>
+void LazyJsonValue::Children(Fn&& fn) const
+{
+	const char open = is_discarded() ? 0 : m_Document->m_Text[m_Offset];
+	if (open != '{' && open != '[') {
+		return;
+	}
+
+	// Malformed input inside balanced brackets ends the walk early instead of
+	// running off the index, the broken value throws once it is decoded
+	const LazyJsonDocument& document = *m_Document;
+	const std::string_view text = document.m_Text;
+	const uint32_t close = document.CloseIndex(m_Index);
+	uint32_t offset = document.SkipWhitespace(m_Offset + 1);
+	if (offset == document.m_Positions[close]) {
+		return;
+	}
+
+	uint32_t index = m_Index + 1;
+	for (;;) {
+		uint32_t keyIndex = UINT32_MAX;
+		if (open == '{') {
+			// "key" : value, the colon is the structural right after the key's quote
+			if (index + 1 >= close || text[document.m_Positions[index]] != '"' || text[document.m_Positions[index + 1]] != ':') {
+				return;
+			}
+			keyIndex = index;
+			offset = document.SkipWhitespace(document.m_Positions[index + 1] + 1);
+			index += 2;
+		}
+
+		const LazyJsonValue child(m_Document, offset, index);
+		if (!fn(keyIndex, child)) {
+			return;
+		}
+
+		index = document.NextIndex(child);
+		if (index >= close || text[document.m_Positions[index]] != ',') {
+			return;
+		}
+		offset = document.SkipWhitespace(document.m_Positions[index] + 1);
+		++index;
+	}
+}
+
+template <typename Fn>
+void LazyJsonValue::items(Fn&& fn) const
+{
+	if (!is_object()) {
+		return;
+	}
+	Children([&](uint32_t keyIndex, const LazyJsonValue& child) {
+		fn(Key(keyIndex), child);
+		return true;
+	});
+}
+
+template <typename Fn>
+void LazyJsonValue::elements(Fn&& fn) const
+{
+	if (!is_array()) {
+		return;
+	}
+	Children([&](uint32_t, const LazyJsonValue& child) {
+		fn(child);
+		return true;
+	});
+}
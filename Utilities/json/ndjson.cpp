@@ -0,0 +1,284 @@
+#include "ndjson.h"
+#include "../io/mapped_file.h"
+#include "../utils/cpu_features.h"
+#include "../utils/utilities.h"
+
+#include <algorithm>
+#include <bit>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+#if defined(UTILITIES_X86)
+	UTILITIES_TARGET_AVX2 const char* FindNewlineAvx2(const char* begin, const char* end)
+	{
+		const __m256i newline = _mm256_set1_epi8('\n');
+		for (; end - begin >= 32; begin += 32) {
+			const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+			const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline)));
+			if (mask) {
+				return begin + std::countr_zero(mask);
+			}
+		}
+		const void* found = memchr(begin, '\n', end - begin);
+		return found ? static_cast<const char*>(found) : end;
+	}
+#endif
+
+#if defined(UTILITIES_SSE2)
+	const char* FindNewlineSse2(const char* begin, const char* end)
+	{
+		const __m128i newline = _mm_set1_epi8('\n');
+		for (; end - begin >= 16; begin += 16) {
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+			const uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline)));
+			if (mask) {
+				return begin + std::countr_zero(mask);
+			}
+		}
+		const void* found = memchr(begin, '\n', end - begin);
+		return found ? static_cast<const char*>(found) : end;
+	}
+#endif
+
+	struct ParsedLine
+	{
+		size_t line;
+		nlohmann::json record;
+		std::string error;
+	};
+
+	struct Chunk
+	{
+		const char* begin = nullptr;
+		const char* end = nullptr;
+		std::vector<ParsedLine> lines;
+		// Line breaks in the chunk, so the reader can number the next one
+		size_t lineCount = 0;
+		bool ready = false;
+	};
+
+	void ParseChunk(Chunk& chunk)
+	{
+		const char* cursor = chunk.begin;
+		while (cursor < chunk.end) {
+			const char* newline = NdjsonReader::FindNewline(cursor, chunk.end);
+			const char* lineEnd = newline;
+			while (lineEnd > cursor && (lineEnd[-1] == '\r' || lineEnd[-1] == ' ' || lineEnd[-1] == '\t')) {
+				--lineEnd;
+			}
+			const char* lineBegin = cursor;
+			while (lineBegin < lineEnd && (*lineBegin == ' ' || *lineBegin == '\t')) {
+				++lineBegin;
+			}
+
+			if (lineBegin < lineEnd) {
+				ParsedLine& parsed = chunk.lines.emplace_back();
+				parsed.line = chunk.lineCount;
+				try {
+					parsed.record = nlohmann::json::parse(lineBegin, lineEnd);
+				}
+				catch (const nlohmann::json::exception& e) {
+					parsed.error = e.what();
+				}
+			}
+
+			++chunk.lineCount;
+			cursor = newline + 1;
+		}
+	}
+}
+
+const char* NdjsonReader::FindNewline(const char* begin, const char* end)
+{
+#if defined(UTILITIES_X86)
+	if (CpuFeatures::Get().avx2) {
+		return FindNewlineAvx2(begin, end);
+	}
+#endif
+#if defined(UTILITIES_SSE2)
+	return FindNewlineSse2(begin, end);
+#else
+	const void* found = memchr(begin, '\n', end - begin);
+	return found ? static_cast<const char*>(found) : end;
+#endif
+}
+
+bool NdjsonReader::Read(const std::string& filename, const std::function<bool(size_t line, nlohmann::json& record)>& onRecord,
+	const NdjsonReadOptions& options, std::string* error)
+{
+	auto fail = [&](const std::string& message) {
+		if (error) *error = message;
+		else Logger::Error("Failed reading ", filename, ": ", message);
+		return false;
+	};
+
+	MappedFile file;
+	std::string message;
+	if (!file.Open(filename, &message)) {
+		return fail(message);
+	}
+
+	// Cut at the first line break past every chunkSize bytes
+	std::vector<Chunk> chunks;
+	const char* const end = file.Data() + file.Size();
+	const size_t chunkSize = (std::max<size_t>)(options.chunkSize, 1);
+	for (const char* begin = file.Data(); begin < end;) {
+		const char* split = end - begin > static_cast<ptrdiff_t>(chunkSize) ? FindNewline(begin + chunkSize, end) : end;
+		split = split < end ? split + 1 : end;
+		Chunk& chunk = chunks.emplace_back();
+		chunk.begin = begin;
+		chunk.end = split;
+		begin = split;
+	}
+
+	unsigned threads = options.threads ? options.threads : (std::max)(1u, std::thread::hardware_concurrency());
+	threads = static_cast<unsigned>((std::min<size_t>)(threads, chunks.size()));
+	// Parsed chunks waiting for the reader hold whole DOMs, so only a few may run ahead
+	const size_t window = static_cast<size_t>(threads) * 2;
+
+	std::mutex mutex;
+	std::condition_variable changed;
+	size_t nextChunk = 0;
+	size_t delivered = 0;
+	bool stop = false;
+
+	auto worker = [&] {
+		for (;;) {
+			size_t index;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				changed.wait(lock, [&] { return stop || nextChunk >= chunks.size() || nextChunk < delivered + window; });
+				if (stop || nextChunk >= chunks.size()) {
+					return;
+				}
+				index = nextChunk++;
+			}
+
+			ParseChunk(chunks[index]);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				chunks[index].ready = true;
+			}
+			changed.notify_all();
+		}
+	};
+
+	// Stops and joins the workers on every way out, also when a callback throws, since
+	// destroying a joinable thread terminates the process
+	struct PoolJoiner
+	{
+		std::mutex& mutex;
+		std::condition_variable& changed;
+		bool& stop;
+		std::vector<std::thread> pool;
+
+		~PoolJoiner()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stop = true;
+			}
+			changed.notify_all();
+			for (std::thread& thread : pool) {
+				thread.join();
+			}
+		}
+	} workers{ mutex, changed, stop, {} };
+
+	for (unsigned i = 0; i < threads; ++i) {
+		workers.pool.emplace_back(worker);
+	}
+
+	bool failed = false;
+	bool finished = false;
+	size_t lineBase = 1;
+	for (size_t i = 0; i < chunks.size() && !finished; ++i) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait(lock, [&] { return chunks[i].ready; });
+		}
+
+		Chunk& chunk = chunks[i];
+		for (ParsedLine& parsed : chunk.lines) {
+			const size_t line = lineBase + parsed.line;
+			if (!parsed.error.empty()) {
+				if (options.onError) {
+					options.onError(line, parsed.error);
+					continue;
+				}
+				message = Utilities::Stringify("line ", line, ": ", parsed.error);
+				failed = true;
+				finished = true;
+				break;
+			}
+			if (!onRecord(line, parsed.record)) {
+				finished = true;
+				break;
+			}
+		}
+		lineBase += chunk.lineCount;
+		std::vector<ParsedLine>().swap(chunk.lines);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			delivered = i + 1;
+		}
+		changed.notify_all();
+	}
+
+	return failed ? fail(message) : true;
+}
+
+NdjsonWriter::NdjsonWriter(size_t bufferSize)
+	: m_Writer(bufferSize)
+{
+}
+
+NdjsonWriter::~NdjsonWriter()
+{
+	Close();
+}
+
+bool NdjsonWriter::Open(const std::string& filename, std::string* error)
+{
+	return m_Writer.Open(filename, BufferedFileWriter::Mode::Append, error);
+}
+
+bool NdjsonWriter::Close(std::string* error)
+{
+	return m_Writer.Close(error);
+}
+
+bool NdjsonWriter::Write(const nlohmann::json& record, std::string* error)
+{
+	if (!m_Writer.IsOpen()) {
+		if (error) *error = "file is not open";
+		return false;
+	}
+
+	// Serialize straight into the pending batch, a record that fails to dump is cut off again
+	std::string& buffer = m_Writer.Buffer();
+	const size_t mark = buffer.size();
+	try {
+		nlohmann::detail::serializer<nlohmann::json> serializer(nlohmann::detail::output_adapter<char>(buffer), ' ');
+		serializer.dump(record, false, false, 0);
+	}
+	catch (const nlohmann::json::exception& e) {
+		buffer.resize(mark);
+		if (error) *error = e.what();
+		return false;
+	}
+	buffer.push_back('\n');
+	return m_Writer.Commit(error);
+}
+
+bool NdjsonWriter::Flush(bool sync, std::string* error)
+{
+	return m_Writer.Flush(sync, error);
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <functional>
+#include <string>
+
+#include "../dependencies/json.hpp"
+#include "../io/buffered_writer.h"
+
+struct NdjsonReadOptions
+{
+	// Parser threads, 0 means one per core
+	unsigned threads = 0;
+	// Bytes of input per parse task, rounded up to the next line break
+	size_t chunkSize = 4 << 20;
+	// Receives lines that fail to parse. Without it the first bad line fails the read.
+	std::function<void(size_t line, const std::string& message)> onError;
+};
+
+// Reads JSON Lines files. The file is mapped, cut into chunks at line breaks and the
+// chunks are parsed on a thread pool. Records still reach the callback strictly in file
+// order on the calling thread, and only a few chunks are held in memory at any time.
+// Blank lines are skipped, CRLF line ends are accepted.
+class NdjsonReader
+{
+public:
+	// onRecord gets the 1-based line number and the parsed record, returning false stops
+	// the read early (which still counts as success). On failure the reason goes to *error
+	// when given, to the log otherwise.
+	static bool Read(const std::string& filename, const std::function<bool(size_t line, nlohmann::json& record)>& onRecord,
+		const NdjsonReadOptions& options = {}, std::string* error = nullptr);
+
+	// The next '\n' in [begin, end), or end. Scans with AVX2 or SSE2 when available.
+	static const char* FindNewline(const char* begin, const char* end);
+};
+
+// Appends records to a JSON Lines file, one compact dump per line. Lines are batched in
+// memory and written with one WriteFile per buffer-full, so a crash loses at most the
+// records written since the last Flush().
+class NdjsonWriter
+{
+public:
+	explicit NdjsonWriter(size_t bufferSize = 1 << 20);
+	~NdjsonWriter();
+
+	// Creates the file if needed and appends to whatever is there
+	bool Open(const std::string& filename, std::string* error = nullptr);
+	bool Close(std::string* error = nullptr);
+	bool IsOpen() const { return m_Writer.IsOpen(); }
+
+	bool Write(const nlohmann::json& record, std::string* error = nullptr);
+	// With sync the records are also flushed to the disk
+	bool Flush(bool sync = false, std::string* error = nullptr);
+
+private:
+	BufferedFileWriter m_Writer;
+};
@@ -0,0 +1,413 @@
+#include "persistent_json.h"
+#include "../io/mapped_file.h"
+
+namespace
+{
+	bool Fail(std::string* error, const std::string& path, const std::string& message)
+	{
+		if (error) *error = message;
+		else Logger::Error("Failed persisting ", path, ": ", message);
+		return false;
+	}
+
+	std::vector<std::string> PointerTokens(nlohmann::json::json_pointer pointer)
+	{
+		std::vector<std::string> tokens;
+		for (; !pointer.empty(); pointer.pop_back()) {
+			tokens.insert(tokens.begin(), pointer.back());
+		}
+		return tokens;
+	}
+
+	// RFC 6901 array index: "0" or digits without a leading zero
+	bool ParseIndex(const std::string& token, size_t& index)
+	{
+		if (token.empty() || (token.size() > 1 && token[0] == '0') || token.size() > 18) {
+			return false;
+		}
+		index = 0;
+		for (char c : token) {
+			if (c < '0' || c > '9') {
+				return false;
+			}
+			index = index * 10 + static_cast<size_t>(c - '0');
+		}
+		return true;
+	}
+}
+
+PersistentJson::~PersistentJson()
+{
+	Close();
+}
+
+bool PersistentJson::Open(const std::string& path, const PersistentJsonOptions& options, std::string* error)
+{
+	Close();
+
+	m_Path = path;
+	m_JournalPath = path + ".journal";
+	m_Options = options;
+
+	std::lock_guard<std::mutex> lock(m_WriteMutex);
+	if (!Replay(error)) {
+		return false;
+	}
+
+	std::string message;
+	if (!m_Writer.Open(m_JournalPath, BufferedFileWriter::Mode::Append, &message)) {
+		return Fail(error, m_Path, message);
+	}
+
+	m_Stopping = false;
+	m_CompactRequested = m_JournalBytes >= m_Options.compactThreshold;
+	m_Compactor = std::thread(&PersistentJson::CompactionLoop, this);
+	return true;
+}
+
+void PersistentJson::Close()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_SignalMutex);
+		m_Stopping = true;
+	}
+	m_CompactSignal.notify_all();
+	if (m_Compactor.joinable()) {
+		m_Compactor.join();
+	}
+
+	std::lock_guard<std::mutex> lock(m_WriteMutex);
+	m_Writer.Close();
+	m_PendingLines.clear();
+}
+
+nlohmann::json PersistentJson::Get() const
+{
+	std::shared_lock<std::shared_mutex> lock(m_DocumentMutex);
+	return m_Document;
+}
+
+bool PersistentJson::Apply(const nlohmann::json& patch, std::string* error)
+{
+	std::lock_guard<std::mutex> lock(m_WriteMutex);
+	if (!patch.is_array()) {
+		return Fail(error, m_Path, "a patch must be an array of operations");
+	}
+
+	// Only writers change m_Document and they all hold m_WriteMutex, so reading it here is safe
+	nlohmann::json updated;
+	try {
+		updated = m_Document.patch(patch);
+	}
+	catch (const nlohmann::json::exception& e) {
+		return Fail(error, m_Path, e.what());
+	}
+
+	if (!Append(patch, error)) {
+		return false;
+	}
+
+	std::unique_lock<std::shared_mutex> documentLock(m_DocumentMutex);
+	m_Document = std::move(updated);
+	return true;
+}
+
+bool PersistentJson::Set(const nlohmann::json::json_pointer& pointer, const nlohmann::json& value, std::string* error)
+{
+	using json = nlohmann::json;
+
+	std::lock_guard<std::mutex> lock(m_WriteMutex);
+
+	// Walk down to the first token that does not exist yet, that is where the value gets added
+	const std::vector<std::string> tokens = PointerTokens(pointer);
+	const json* node = &m_Document;
+	json::json_pointer existing;
+	size_t depth = 0;
+	for (; depth < tokens.size(); ++depth) {
+		const std::string& token = tokens[depth];
+		if (node->is_object()) {
+			const auto it = node->find(token);
+			if (it == node->end()) {
+				break;
+			}
+			node = &*it;
+		}
+		else if (node->is_array()) {
+			size_t index = 0;
+			if (token == "-") {
+				break;
+			}
+			if (!ParseIndex(token, index) || index > node->size()) {
+				return Fail(error, m_Path, Utilities::Stringify("array index '", token, "' in ", pointer.to_string(), " is out of range"));
+			}
+			if (index == node->size()) {
+				break;
+			}
+			node = &(*node)[index];
+		}
+		else {
+			return Fail(error, m_Path, Utilities::Stringify("cannot set ", pointer.to_string(), " below a ", node->type_name()));
+		}
+		existing /= token;
+	}
+
+	json operation = json::object();
+	if (depth == tokens.size()) {
+		operation["op"] = "replace";
+		operation["path"] = pointer.to_string();
+		operation["value"] = value;
+	}
+	else {
+		json created = value;
+		for (size_t i = tokens.size() - 1; i > depth; --i) {
+			json parent = json::object();
+			parent[tokens[i]] = std::move(created);
+			created = std::move(parent);
+		}
+		operation["op"] = "add";
+		operation["path"] = (existing / tokens[depth]).to_string();
+		operation["value"] = std::move(created);
+	}
+
+	const json patch = json::array({ std::move(operation) });
+	if (!Append(patch, error)) {
+		return false;
+	}
+
+	std::unique_lock<std::shared_mutex> documentLock(m_DocumentMutex);
+	m_Document.patch_inplace(patch);
+	return true;
+}
+
+bool PersistentJson::Update(const std::function<void(nlohmann::json&)>& fn, std::string* error)
+{
+	std::lock_guard<std::mutex> lock(m_WriteMutex);
+
+	nlohmann::json updated = m_Document;
+	nlohmann::json patch;
+	try {
+		fn(updated);
+		patch = nlohmann::json::diff(m_Document, updated);
+	}
+	catch (const nlohmann::json::exception& e) {
+		return Fail(error, m_Path, e.what());
+	}
+
+	if (patch.empty()) {
+		return true;
+	}
+	if (!Append(patch, error)) {
+		return false;
+	}
+
+	std::unique_lock<std::shared_mutex> documentLock(m_DocumentMutex);
+	m_Document = std::move(updated);
+	return true;
+}
+
+bool PersistentJson::Compact(std::string* error)
+{
+	std::lock_guard<std::mutex> compactLock(m_CompactMutex);
+
+	nlohmann::json envelope = nlohmann::json::object();
+	{
+		std::lock_guard<std::mutex> lock(m_WriteMutex);
+		if (!m_Writer.IsOpen()) {
+			return Fail(error, m_Path, "the journal is not open");
+		}
+		envelope["seq"] = m_Sequence;
+		envelope["document"] = m_Document;
+		m_Compacting = true;
+		m_PendingLines.clear();
+	}
+
+	// The snapshot is written without blocking writers, whatever they append meanwhile is
+	// collected in m_PendingLines and becomes the new journal
+	JsonSaveOptions save;
+	save.indent = -1;
+	save.fsync = m_Options.fsync;
+	std::string message;
+	const bool saved = Utilities::SaveToJson(envelope, m_Path, save, &message);
+
+	std::lock_guard<std::mutex> lock(m_WriteMutex);
+	m_Compacting = false;
+	if (!saved) {
+		m_PendingLines.clear();
+		return Fail(error, m_Path, message);
+	}
+
+	std::string journal;
+	for (const std::string& line : m_PendingLines) {
+		journal += line;
+	}
+	m_PendingLines.clear();
+
+	// Appends after this point need a handle on the new file
+	m_Writer.Close();
+	bool trimmed = Utilities::AtomicWriteFile(m_JournalPath, journal, m_Options.fsync, &message);
+	if (trimmed) {
+		m_JournalBytes = journal.size();
+	}
+	if (!m_Writer.Open(m_JournalPath, BufferedFileWriter::Mode::Append, trimmed ? &message : nullptr)) {
+		trimmed = false;
+	}
+	return trimmed ? true : Fail(error, m_Path, message);
+}
+
+uint64_t PersistentJson::Sequence() const
+{
+	std::lock_guard<std::mutex> lock(m_WriteMutex);
+	return m_Sequence;
+}
+
+size_t PersistentJson::JournalSize() const
+{
+	std::lock_guard<std::mutex> lock(m_WriteMutex);
+	return m_JournalBytes;
+}
+
+bool PersistentJson::Replay(std::string* error)
+{
+	nlohmann::json document = nlohmann::json::object();
+	uint64_t sequence = 0;
+	std::string message;
+
+	if (Utilities::FileOrFolderExists(m_Path)) {
+		nlohmann::json envelope;
+		if (!Utilities::LoadFromJson(m_Path, envelope, {}, &message)) {
+			return Fail(error, m_Path, message);
+		}
+		if (!envelope.is_object() || !envelope.contains("seq") || !envelope["seq"].is_number_unsigned() || !envelope.contains("document")) {
+			return Fail(error, m_Path, "the snapshot has no seq and document");
+		}
+		sequence = envelope["seq"].get<uint64_t>();
+		document = std::move(envelope["document"]);
+	}
+
+	size_t validEnd = 0;
+	bool torn = false;
+	std::string kept;
+	if (Utilities::FileOrFolderExists(m_JournalPath)) {
+		MappedFile journal;
+		if (!journal.Open(m_JournalPath, &message)) {
+			return Fail(error, m_Path, message);
+		}
+
+		const std::string_view text = journal.View();
+		size_t lineNumber = 0;
+		while (validEnd < text.size()) {
+			const size_t newline = text.find('\n', validEnd);
+			const bool complete = newline != std::string_view::npos;
+			const size_t next = complete ? newline + 1 : text.size();
+			const std::string_view line = text.substr(validEnd, next - validEnd);
+			++lineNumber;
+
+			if (line.find_first_not_of(" \t\r\n") == std::string_view::npos) {
+				validEnd = next;
+				continue;
+			}
+
+			// Every append ends in a newline, so an unterminated last line is the remains of an
+			// append that never finished. Drop it even when it happens to parse, otherwise the
+			// next append would be glued onto it
+			if (!complete) {
+				break;
+			}
+
+			nlohmann::json record;
+			try {
+				record = nlohmann::json::parse(line.begin(), line.end());
+			}
+			catch (const nlohmann::json::exception& e) {
+				return Fail(error, m_Path, Utilities::Stringify("journal line ", lineNumber, " is corrupt: ", e.what()));
+			}
+
+			if (!record.is_object() || !record.contains("seq") || !record["seq"].is_number_unsigned() ||
+				!record.contains("patch") || !record["patch"].is_array()) {
+				return Fail(error, m_Path, Utilities::Stringify("journal line ", lineNumber, " is not a patch record"));
+			}
+
+			const uint64_t recordSequence = record["seq"].get<uint64_t>();
+			if (recordSequence > sequence) {
+				try {
+					document.patch_inplace(record["patch"]);
+				}
+				catch (const nlohmann::json::exception& e) {
+					return Fail(error, m_Path, Utilities::Stringify("journal line ", lineNumber, " does not apply: ", e.what()));
+				}
+				sequence = recordSequence;
+			}
+			validEnd = next;
+		}
+
+		torn = validEnd < text.size();
+		kept.assign(text.substr(0, torn ? validEnd : 0));
+	}
+
+	// Cut the torn line off once the mapping is gone
+	if (torn && !Utilities::AtomicWriteFile(m_JournalPath, kept, m_Options.fsync, &message)) {
+		return Fail(error, m_Path, message);
+	}
+
+	std::unique_lock<std::shared_mutex> documentLock(m_DocumentMutex);
+	m_Document = std::move(document);
+	m_Sequence = sequence;
+	m_JournalBytes = validEnd;
+	return true;
+}
+
+bool PersistentJson::Append(const nlohmann::json& patch, std::string* error)
+{
+	if (!m_Writer.IsOpen()) {
+		return Fail(error, m_Path, "the journal is not open");
+	}
+
+	nlohmann::json record = nlohmann::json::object();
+	record["seq"] = m_Sequence + 1;
+	record["patch"] = patch;
+
+	std::string line;
+	try {
+		line = record.dump();
+	}
+	catch (const nlohmann::json::exception& e) {
+		return Fail(error, m_Path, e.what());
+	}
+	line.push_back('\n');
+
+	std::string message;
+	if (!m_Writer.Write(line, &message) || !m_Writer.Flush(m_Options.fsync != FsyncPolicy::None, &message)) {
+		// Part of the line may have reached the file, appending after it would corrupt the journal
+		m_Writer.Close();
+		return Fail(error, m_Path, message);
+	}
+
+	++m_Sequence;
+	m_JournalBytes += line.size();
+	if (m_Compacting) {
+		m_PendingLines.push_back(std::move(line));
+	}
+	else if (m_JournalBytes >= m_Options.compactThreshold) {
+		{
+			std::lock_guard<std::mutex> lock(m_SignalMutex);
+			m_CompactRequested = true;
+		}
+		m_CompactSignal.notify_one();
+	}
+	return true;
+}
+
+void PersistentJson::CompactionLoop()
+{
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(m_SignalMutex);
+			m_CompactSignal.wait(lock, [&] { return m_Stopping || m_CompactRequested; });
+			if (m_Stopping) {
+				return;
+			}
+			m_CompactRequested = false;
+		}
+		Compact();
+	}
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../utils/utilities.h"
+#include "../io/buffered_writer.h"
+
+struct PersistentJsonOptions
+{
+	// Journal size that triggers a background compaction into a fresh snapshot
+	size_t compactThreshold = 4 << 20;
+	// Applies to every journal append as well as to snapshots
+	FsyncPolicy fsync = FsyncPolicy::Data;
+};
+
+// A JSON document persisted as a snapshot plus an append-only journal of RFC 6902 patches.
+// Every change appends one {"seq", "patch"} line to "<path>.journal" instead of rewriting
+// the whole file, so disk traffic is proportional to the change. The snapshot at <path>
+// holds {"seq", "document"}, and entries at or below its seq are skipped on replay, which
+// keeps a crash between writing the snapshot and trimming the journal harmless. A torn
+// last journal line left by a crash is dropped on open.
+//
+// Writers are serialized, readers only wait for the in-memory swap, never for the disk.
+class PersistentJson
+{
+public:
+	PersistentJson() = default;
+	~PersistentJson();
+
+	PersistentJson(const PersistentJson&) = delete;
+	PersistentJson& operator=(const PersistentJson&) = delete;
+
+	// Loads the snapshot and replays the journal. A missing snapshot starts from an empty object.
+	bool Open(const std::string& path, const PersistentJsonOptions& options = {}, std::string* error = nullptr);
+	// Waits for a running compaction and closes the journal, no snapshot is written
+	void Close();
+	bool IsOpen() const { return m_Writer.IsOpen(); }
+
+	nlohmann::json Get() const;
+	// Runs fn(const nlohmann::json&) under the read lock, without copying the document
+	template <typename Fn>
+	auto Read(Fn&& fn) const
+	{
+		std::shared_lock<std::shared_mutex> lock(m_DocumentMutex);
+		return fn(static_cast<const nlohmann::json&>(m_Document));
+	}
+
+	// Applies an RFC 6902 patch. Nothing changes when any operation fails.
+	bool Apply(const nlohmann::json& patch, std::string* error = nullptr);
+	// Sets one value, creating missing parents as objects. Journals a single add or replace
+	// and touches nothing else, the cheapest way to make a small change.
+	bool Set(const nlohmann::json::json_pointer& pointer, const nlohmann::json& value, std::string* error = nullptr);
+	// Lets fn edit a copy, then journals json::diff of the result. Copying and diffing are
+	// O(document) in memory, only the write is O(change).
+	bool Update(const std::function<void(nlohmann::json&)>& fn, std::string* error = nullptr);
+
+	// Writes a snapshot and trims the journal right away
+	bool Compact(std::string* error = nullptr);
+
+	uint64_t Sequence() const;
+	size_t JournalSize() const;
+
+private:
+	bool Replay(std::string* error);
+	// Caller holds m_WriteMutex
+	bool Append(const nlohmann::json& patch, std::string* error);
+	void CompactionLoop();
+
+	std::string m_Path;
+	std::string m_JournalPath;
+	PersistentJsonOptions m_Options;
+
+	mutable std::shared_mutex m_DocumentMutex;
+	nlohmann::json m_Document;
+
+	// Serializes writers and guards everything below
+	mutable std::mutex m_WriteMutex;
+	BufferedFileWriter m_Writer;
+	uint64_t m_Sequence = 0;
+	size_t m_JournalBytes = 0;
+	// Journal lines appended while a compaction is writing its snapshot
+	bool m_Compacting = false;
+	std::vector<std::string> m_PendingLines;
+
+	// Held for a whole compaction so Compact() and the background thread take turns
+	std::mutex m_CompactMutex;
+	std::mutex m_SignalMutex;
+	std::condition_variable m_CompactSignal;
+	std::thread m_Compactor;
+	bool m_CompactRequested = false;
+	bool m_Stopping = false;
+};
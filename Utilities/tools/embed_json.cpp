@@ -0,0 +1,59 @@
+// Build step that turns a JSON file into a header for EmbeddedJson or EmbeddedFrozenJson.
+// Built as its own console program, not part of the library project, and run as a
+// pre-build event:
+//
+//     embed_json [--text] <input.json> <output.h> <symbol>
+//
+// The default is a frozen image. --text writes the compact JSON text instead. The header
+// is only rewritten when its contents change, so dependent sources are not rebuilt for
+// nothing.
+#include <iostream>
+#include <string>
+
+#include "../json/embedded_json.h"
+#include "../io/mapped_file.h"
+#include "../utils/utilities.h"
+
+int main(int argc, char** argv)
+{
+	bool frozen = true;
+	int first = 1;
+	if (argc > 1 && std::string(argv[1]) == "--text") {
+		frozen = false;
+		first = 2;
+	}
+	if (argc - first != 3) {
+		std::cerr << "usage: embed_json [--text] <input.json> <output.h> <symbol>\n";
+		return 2;
+	}
+	const std::string input = argv[first];
+	const std::string output = argv[first + 1];
+	const std::string symbol = argv[first + 2];
+
+	std::string error;
+	nlohmann::json value;
+	JsonLoadOptions options;
+	options.validateUtf8 = true;
+	if (!Utilities::LoadFromJson(input, value, options, &error)) {
+		std::cerr << input << ": " << error << "\n";
+		return 1;
+	}
+
+	std::string header;
+	if (!EmbeddedJson::GenerateHeader(value, symbol, frozen, header, &error)) {
+		std::cerr << input << ": " << error << "\n";
+		return 1;
+	}
+
+	MappedFile existing;
+	std::string missing;
+	if (existing.Open(output, &missing) && existing.View() == header) {
+		return 0;
+	}
+	existing.Close();
+	if (!Utilities::AtomicWriteFile(output, header, FsyncPolicy::None, &error)) {
+		std::cerr << output << ": " << error << "\n";
+		return 1;
+	}
+	return 0;
+}
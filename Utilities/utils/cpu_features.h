@@ -0,0 +1,66 @@
+#pragma once
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define UTILITIES_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include <immintrin.h>
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UTILITIES_SSE2 1
+#endif
+#endif
+
+// GCC and Clang only emit AVX2 instructions inside functions marked for that target,
+// MSVC accepts the intrinsics anywhere. Callers must check CpuFeatures::Get().avx2 first.
+#if defined(UTILITIES_X86) && (defined(__GNUC__) || defined(__clang__))
+#define UTILITIES_TARGET_AVX2 __attribute__((target("avx2")))
+#define UTILITIES_TARGET_SSSE3 __attribute__((target("ssse3")))
+#else
+#define UTILITIES_TARGET_AVX2
+#define UTILITIES_TARGET_SSSE3
+#endif
+
+struct CpuFeatures
+{
+	bool sse2 = false;
+	bool ssse3 = false;
+	bool avx2 = false;
+
+	static const CpuFeatures& Get()
+	{
+		static const CpuFeatures features = Detect();
+		return features;
+	}
+
+private:
+	static CpuFeatures Detect()
+	{
+		CpuFeatures features;
+#if defined(UTILITIES_X86)
+#if defined(_MSC_VER)
+		int info[4] = {};
+		__cpuid(info, 0);
+		const int maxLeaf = info[0];
+
+		__cpuid(info, 1);
+		features.sse2 = (info[3] & (1 << 26)) != 0;
+		features.ssse3 = (info[2] & (1 << 9)) != 0;
+		const bool osxsave = (info[2] & (1 << 27)) != 0;
+
+		if (maxLeaf >= 7 && osxsave) {
+			// The OS has to save the upper YMM halves on context switches
+			const unsigned long long xcr0 = _xgetbv(0);
+			__cpuidex(info, 7, 0);
+			features.avx2 = (info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+		}
+#else
+		__builtin_cpu_init();
+		features.sse2 = __builtin_cpu_supports("sse2");
+		features.ssse3 = __builtin_cpu_supports("ssse3");
+		features.avx2 = __builtin_cpu_supports("avx2");
+#endif
+#endif
+		return features;
+	}
+};
@@ -1,19 +1,323 @@
 #include "utilities.h"
+#include "../io/file_lock.h"
+#include "../io/mapped_file.h"
+#include "../json/json_schema.h"
+#include "../json/json_stream_writer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <cwctype>
+#include <exception>
+#include <thread>
+
+namespace
+{
+	bool ReadWholeFile(const std::string& path, std::string& content, std::string* error)
+	{
+		HANDLE file = CreateFileW(fs::path(path).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			*error = Utilities::Stringify("Could not open ", path, ": ", Utilities::GetLastErrorString());
+			return false;
+		}
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size)) {
+			*error = Utilities::Stringify("Could not get the size of ", path, ": ", Utilities::GetLastErrorString());
+			CloseHandle(file);
+			return false;
+		}
+
+		content.resize(static_cast<size_t>(size.QuadPart));
+		size_t offset = 0;
+		while (offset < content.size()) {
+			// ReadFile takes a 32-bit length, anything past 4 GiB needs more than one call
+			const DWORD chunk = static_cast<DWORD>((std::min<size_t>)(content.size() - offset, 0x80000000u));
+			DWORD read = 0;
+			if (!ReadFile(file, &content[offset], chunk, &read, nullptr) || read == 0) {
+				*error = Utilities::Stringify("Could not read ", path, ": ", Utilities::GetLastErrorString());
+				CloseHandle(file);
+				return false;
+			}
+			offset += read;
+		}
+
+		CloseHandle(file);
+		return true;
+	}
+
+	bool WriteWholeFile(HANDLE file, std::string_view content)
+	{
+		size_t offset = 0;
+		while (offset < content.size()) {
+			const DWORD chunk = static_cast<DWORD>((std::min<size_t>)(content.size() - offset, 0x80000000u));
+			DWORD written = 0;
+			if (!WriteFile(file, content.data() + offset, chunk, &written, nullptr)) {
+				return false;
+			}
+			offset += written;
+		}
+		return true;
+	}
+
+	// CBOR tag 55799, a no-op marker that says "this is CBOR"
+	constexpr unsigned char kCborMagic[] = { 0xD9, 0xD9, 0xF7 };
+
+	JsonFormat FormatFromExtension(const std::string& filename)
+	{
+		std::string extension = fs::path(filename).extension().string();
+		for (char& c : extension) {
+			c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+		}
+
+		if (extension == ".cbor") return JsonFormat::Cbor;
+		if (extension == ".msgpack" || extension == ".mpk") return JsonFormat::MessagePack;
+		if (extension == ".ubj" || extension == ".ubjson") return JsonFormat::Ubjson;
+		if (extension == ".bson") return JsonFormat::Bson;
+		if (extension == ".json") return JsonFormat::Text;
+		return JsonFormat::Auto;
+	}
+
+	bool HasCborMagic(std::string_view content)
+	{
+		return content.size() >= sizeof(kCborMagic) && memcmp(content.data(), kCborMagic, sizeof(kCborMagic)) == 0;
+	}
+
+	// '*' matches any run and '?' any single character, compared case-insensitively like the shell
+	bool WildcardMatch(std::wstring_view name, std::wstring_view pattern)
+	{
+		size_t n = 0, p = 0;
+		size_t starP = std::wstring_view::npos, starN = 0;
+		while (n < name.size()) {
+			if (p < pattern.size() && pattern[p] == L'*') {
+				starP = p++;
+				starN = n;
+			}
+			else if (p < pattern.size() && (pattern[p] == L'?' ||
+				std::towlower(pattern[p]) == std::towlower(name[n]))) {
+				++p;
+				++n;
+			}
+			else if (starP != std::wstring_view::npos) {
+				p = starP + 1;
+				n = ++starN;
+			}
+			else {
+				return false;
+			}
+		}
+		while (p < pattern.size() && pattern[p] == L'*') {
+			++p;
+		}
+		return p == pattern.size();
+	}
+
+	nlohmann::json::input_format_t InputFormat(JsonFormat format)
+	{
+		switch (format) {
+		case JsonFormat::Cbor: return nlohmann::json::input_format_t::cbor;
+		case JsonFormat::MessagePack: return nlohmann::json::input_format_t::msgpack;
+		case JsonFormat::Ubjson: return nlohmann::json::input_format_t::ubjson;
+		case JsonFormat::Bson: return nlohmann::json::input_format_t::bson;
+		default: return nlohmann::json::input_format_t::json;
+		}
+	}
+
+	nlohmann::json ParseFormat(std::string_view content, JsonFormat format)
+	{
+		const char* begin = content.data();
+		const char* end = content.data() + content.size();
+
+		switch (format) {
+		case JsonFormat::Cbor:
+			return nlohmann::json::from_cbor(begin, end, true, true, nlohmann::json::cbor_tag_handler_t::ignore);
+		case JsonFormat::MessagePack:
+			return nlohmann::json::from_msgpack(begin, end);
+		case JsonFormat::Ubjson:
+			return nlohmann::json::from_ubjson(begin, end);
+		case JsonFormat::Bson:
+			return nlohmann::json::from_bson(begin, end);
+		default:
+			return nlohmann::json::parse(begin, end);
+		}
+	}
+
+	// Shared body of the LoadFromJson overloads, parse(content, format) does the actual work
+	template <typename Parse>
+	bool LoadDocument(const std::string& filename, const JsonLoadOptions& options, std::string* error, Parse parse)
+	{
+		auto fail = [&](const std::string& message) {
+			if (error) {
+				*error = message;
+			}
+			else {
+				Logger::Error("Failed loading ", filename, " from json: ", message);
+			}
+			return false;
+		};
+
+		std::string message;
+		// Declared first so the lock outlives the mapping and the parse
+		JsonFileLock lock;
+		if (options.lock && !lock.Acquire(filename, false, message)) {
+			return fail(message);
+		}
+
+		MappedFile mapped;
+		std::string buffer;
+		std::string_view content;
+
+		if (options.memoryMap) {
+			if (!mapped.Open(filename, &message)) {
+				return fail(message);
+			}
+			content = mapped.View();
+		}
+		else {
+			if (!ReadWholeFile(filename, buffer, &message)) {
+				return fail(message);
+			}
+			content = buffer;
+		}
+
+		const JsonFormat format = options.format == JsonFormat::Auto ? Utilities::DetectJsonFormat(content, filename) : options.format;
+		if (format == JsonFormat::Text && options.validateUtf8 && !Utilities::ValidateUtf8(content)) {
+			return fail("invalid UTF-8.");
+		}
+
+		if (format == JsonFormat::Cbor && HasCborMagic(content)) {
+			content.remove_prefix(sizeof(kCborMagic));
+		}
+
+		try {
+			parse(content, format);
+		}
+		catch (const nlohmann::json::exception& e) {
+			if (options.format == JsonFormat::Auto && format == JsonFormat::Text && !content.empty() && content.front() == '[') {
+				// "[[", "[{" and "[]" open both text and UBJSON documents
+				try {
+					parse(content, JsonFormat::Ubjson);
+					return true;
+				}
+				catch (const nlohmann::json::exception&) {
+				}
+			}
+			return fail(e.what());
+		}
+		return true;
+	}
+
+	// Serialization buffer reused across saves on the same thread so repeated saves
+	// do not regrow it from scratch. Anything bigger than this is released afterwards.
+	constexpr size_t kRetainedDumpCapacity = 16 * 1024 * 1024;
+
+	std::string& DumpBuffer()
+	{
+		thread_local std::string buffer;
+		buffer.clear();
+		return buffer;
+	}
+
+	void ReleaseDumpBuffer(std::string& buffer)
+	{
+		if (buffer.capacity() > kRetainedDumpCapacity) {
+			std::string().swap(buffer);
+		}
+	}
+
+	// Same text as serializer::dump, with the members of a top-level container serialized in
+	// chunks on several threads and then joined in order. Throws nlohmann's exceptions.
+	void DumpTextParallel(const nlohmann::json& value, int indent, unsigned threads, std::string& out)
+	{
+		const bool pretty = indent >= 0;
+		const unsigned width = pretty ? static_cast<unsigned>(indent) : 0;
+		const bool object = value.is_object();
+		const size_t count = value.size();
+
+		// Objects are a std::map, collect the members once so chunks can start anywhere
+		std::vector<nlohmann::json::const_iterator> members;
+		if (object) {
+			members.reserve(count);
+			for (auto it = value.cbegin(); it != value.cend(); ++it) {
+				members.push_back(it);
+			}
+		}
+
+		const size_t chunkCount = (std::min<size_t>)(count, size_t(threads) * 4);
+		std::vector<std::string> chunks(chunkCount);
+		std::vector<std::exception_ptr> failures(chunkCount);
+		std::atomic<size_t> next{ 0 };
+		auto worker = [&] {
+			for (size_t chunk = next++; chunk < chunkCount; chunk = next++) {
+				std::string& text = chunks[chunk];
+				try {
+					nlohmann::detail::serializer<nlohmann::json> serializer(nlohmann::detail::output_adapter<char>(text), ' ');
+					for (size_t i = count * chunk / chunkCount, end = count * (chunk + 1) / chunkCount; i < end; ++i) {
+						if (i > 0) {
+							text.append(pretty ? ",\n" : ",");
+						}
+						text.append(width, ' ');
+						if (object) {
+							if (!JsonStreamWriter::AppendString(text, members[i].key())) {
+								// Let nlohmann raise the exact error it would have
+								serializer.dump(nlohmann::json(members[i].key()), false, false, 0);
+							}
+							text.append(pretty ? ": " : ":");
+						}
+						serializer.dump(object ? members[i].value() : value[i], pretty, false, width, width);
+					}
+				}
+				catch (...) {
+					failures[chunk] = std::current_exception();
+				}
+			}
+		};
+
+		std::vector<std::thread> pool;
+		for (unsigned i = 1; i < (std::min<size_t>)(threads, chunkCount); ++i) {
+			pool.emplace_back(worker);
+		}
+		worker();
+		for (std::thread& thread : pool) {
+			thread.join();
+		}
+		for (const std::exception_ptr& failure : failures) {
+			if (failure) {
+				std::rethrow_exception(failure);
+			}
+		}
+
+		size_t total = 4;
+		for (const std::string& chunk : chunks) {
+			total += chunk.size();
+		}
+		out.reserve(out.size() + total);
+		out.push_back(object ? '{' : '[');
+		if (pretty) out.push_back('\n');
+		for (std::string& chunk : chunks) {
+			out.append(chunk);
+			std::string().swap(chunk);
+		}
+		if (pretty) out.push_back('\n');
+		out.push_back(object ? '}' : ']');
+	}
+}
 
 std::wstring Utilities::StringToWString(const std::string& str)
 {
-	int size_needed = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), -1, nullptr, 0);
-	std::wstring wstr(size_needed, 0);
-	MultiByteToWideChar(CP_UTF8, 0, str.c_str(), -1, &wstr[0], size_needed);
-	return wstr;
+	return Encoding::Utf8ToWide(str);
 }
 
 std::string Utilities::WStringToString(const std::wstring& wstr)
 {
-	int size_needed = WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), -1, nullptr, 0, nullptr, nullptr);
-	std::string str(size_needed, 0);
-	WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), -1, &str[0], size_needed, nullptr, nullptr);
-	return str;
+	return Encoding::WideToUtf8(wstr);
+}
+
+bool Utilities::ValidateUtf8(std::string_view data)
+{
+	return Encoding::ValidateUtf8(data);
 }
 
 std::string Utilities::PrintBool(const bool& boolean)
@@ -21,30 +325,284 @@ std::string Utilities::PrintBool(const bool& boolean)
 	return (boolean ? "True" : "False");
 }
 
+std::string Utilities::GetLastErrorString(DWORD errorCode)
+{
+	LPSTR buffer = nullptr;
+	const DWORD length = FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+		nullptr, errorCode, 0, reinterpret_cast<LPSTR>(&buffer), 0, nullptr);
+	if (length == 0) {
+		return Stringify("error ", errorCode);
+	}
+
+	std::string message(buffer, length);
+	LocalFree(buffer);
+
+	// System messages end in ".\r\n"
+	while (!message.empty() && (message.back() == '\n' || message.back() == '\r' || message.back() == ' ')) {
+		message.pop_back();
+	}
+	return message;
+}
+
 bool Utilities::SaveToJson(const nlohmann::json& jsonData, const std::string& filename)
 {
-	std::ofstream file(filename);
-	if (file.is_open()) {
-		file << jsonData.dump(4);
-		file.close();
-		return true;
+	return SaveToJson(jsonData, filename, JsonSaveOptions());
+}
+
+bool Utilities::SaveToJson(const nlohmann::json& jsonData, const std::string& filename, const JsonSaveOptions& options, std::string* error)
+{
+	JsonFormat format = options.format;
+	if (format == JsonFormat::Auto) {
+		format = FormatFromExtension(filename);
 	}
-	return false;
+
+	std::string& buffer = DumpBuffer();
+	try {
+		nlohmann::detail::output_adapter<char> output(buffer);
+		switch (format) {
+		case JsonFormat::Cbor:
+			buffer.append(reinterpret_cast<const char*>(kCborMagic), sizeof(kCborMagic));
+			nlohmann::json::to_cbor(jsonData, output);
+			break;
+		case JsonFormat::MessagePack:
+			nlohmann::json::to_msgpack(jsonData, output);
+			break;
+		case JsonFormat::Ubjson:
+			nlohmann::json::to_ubjson(jsonData, output);
+			break;
+		case JsonFormat::Bson:
+			nlohmann::json::to_bson(jsonData, output);
+			break;
+		default: {
+			const unsigned threads = options.threads == 0 ? (std::max)(1u, std::thread::hardware_concurrency()) : options.threads;
+			if (threads > 1 && jsonData.is_structured() && jsonData.size() > 1) {
+				DumpTextParallel(jsonData, options.indent, threads, buffer);
+				break;
+			}
+			nlohmann::detail::serializer<nlohmann::json> serializer(output, ' ');
+			serializer.dump(jsonData, options.indent >= 0, false, options.indent >= 0 ? static_cast<unsigned int>(options.indent) : 0);
+			break;
+		}
+		}
+	}
+	catch (const nlohmann::json::exception& e) {
+		ReleaseDumpBuffer(buffer);
+		if (error) *error = e.what();
+		else Logger::Error("Failed saving ", filename, " to json: ", e.what());
+		return false;
+	}
+
+	// Serialized before locking, the lock is held for the write alone
+	std::string message;
+	const bool saved = WriteJsonFile(filename, buffer, options, &message);
+	ReleaseDumpBuffer(buffer);
+
+	if (!saved) {
+		if (error) *error = message;
+		else Logger::Error("Failed saving ", filename, " to json: ", message);
+	}
+	return saved;
 }
 
-nlohmann::json Utilities::LoadFromJson(const std::string& filename)
+bool Utilities::WriteJsonFile(const std::string& filename, std::string_view content, const JsonSaveOptions& options, std::string* error)
 {
-	std::ifstream file(filename);
-	if (file.is_open()) {
-		nlohmann::json jsonData;
-		file >> jsonData;
-		file.close();
-		return jsonData;
+	std::string message;
+	JsonFileLock lock;
+	if (options.lock && !lock.Acquire(filename, true, message)) {
+		if (error) *error = message;
+		return false;
 	}
-	else
-	{
-		Logger::Error("Failed loading ", filename, " from json.");
+
+	bool saved;
+	if (options.atomic) {
+		saved = AtomicWriteFile(filename, content, options.fsync, &message);
+	}
+	else {
+		std::ofstream file(filename, std::ios::out | std::ios::binary);
+		saved = file.is_open();
+		if (saved) {
+			file.write(content.data(), static_cast<std::streamsize>(content.size()));
+			file.close();
+			saved = !file.fail();
+		}
+		if (!saved) message = Stringify("Could not write ", filename, ".");
+	}
+	if (saved && options.lock) {
+		saved = lock.BumpGeneration(message);
+	}
+
+	if (!saved && error) *error = message;
+	return saved;
+}
+
+nlohmann::json Utilities::LoadFromJson(const std::string& filename, bool validateUtf8)
+{
+	JsonLoadOptions options;
+	options.validateUtf8 = validateUtf8;
+
+	nlohmann::json jsonData;
+	if (!LoadFromJson(filename, jsonData, options)) {
+		return nlohmann::json();
+	}
+	return jsonData;
+}
+
+bool Utilities::LoadFromJson(const std::string& filename, nlohmann::json& jsonData, const JsonLoadOptions& options, std::string* error)
+{
+	if (!options.schema) {
+		return LoadDocument(filename, options, error, [&](std::string_view content, JsonFormat format) {
+			jsonData = ParseFormat(content, format);
+		});
+	}
+
+	// jsonData is only touched once the document has passed validation
+	nlohmann::json parsed;
+	if (!LoadDocument(filename, options, error, [&](std::string_view content, JsonFormat format) { parsed = ParseFormat(content, format); })) {
+		return false;
+	}
+
+	std::string message;
+	if (!options.schema->Validate(parsed, &message)) {
+		if (error) *error = message;
+		else Logger::Error("Failed loading ", filename, " from json: ", message);
+		return false;
+	}
+	jsonData = std::move(parsed);
+	return true;
+}
+
+bool Utilities::LoadFromJson(const std::string& filename, ArenaJsonDocument& document, const JsonLoadOptions& options, std::string* error)
+{
+	return LoadDocument(filename, options, error, [&](std::string_view content, JsonFormat format) {
+		document.Parse(content.data(), content.data() + content.size(), InputFormat(format));
+	});
+}
+
+uint64_t Utilities::GetJsonGeneration(const std::string& filename)
+{
+	return JsonFileLock::PeekGeneration(filename);
+}
+
+std::map<std::string, JsonLoadResult> Utilities::LoadJsonDirectory(const std::string& directoryPath, const std::string& pattern,
+	unsigned threads, const JsonLoadOptions& options)
+{
+	std::map<std::string, JsonLoadResult> results;
+
+	// Names are matched wide, any file name can be listed even where the ANSI code page
+	// cannot spell it. Such a file cannot be opened by a narrow path and is reported under its
+	// UTF-8 name instead.
+	const std::wstring widePattern = fs::path(pattern).wstring();
+	std::vector<std::string> files;
+	std::error_code ec;
+	for (fs::directory_iterator it(directoryPath, ec), end; !ec && it != end; it.increment(ec)) {
+		if (!it->is_regular_file(ec) || !WildcardMatch(it->path().filename().wstring(), widePattern)) {
+			continue;
+		}
+		try {
+			files.push_back(it->path().string());
+		}
+		catch (const std::system_error&) {
+			results[WStringToString(it->path().wstring())].error = "the file name cannot be represented in the ANSI code page";
+		}
+	}
+	if (ec) {
+		Logger::Error("Could not list ", directoryPath, ": ", ec.message());
+		return results;
+	}
+
+	if (threads == 0) {
+		threads = (std::max)(1u, std::thread::hardware_concurrency());
+	}
+	threads = static_cast<unsigned>((std::min<size_t>)(threads, files.size()));
+
+	// Workers claim files through a shared counter and write into their own slots,
+	// so nothing is locked while loading
+	std::vector<JsonLoadResult> loaded(files.size());
+	std::atomic<size_t> next{ 0 };
+	auto worker = [&] {
+		for (size_t i = next++; i < files.size(); i = next++) {
+			// Anything thrown here would end the process, it becomes this file's error instead
+			try {
+				if (!LoadFromJson(files[i], loaded[i].data, options, &loaded[i].error) && loaded[i].error.empty()) {
+					loaded[i].error = "unknown error";
+				}
+			}
+			catch (const std::exception& e) {
+				loaded[i].data = nlohmann::json();
+				loaded[i].error = e.what();
+			}
+			catch (...) {
+				loaded[i].data = nlohmann::json();
+				loaded[i].error = "unknown error";
+			}
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (unsigned i = 1; i < threads; ++i) {
+		pool.emplace_back(worker);
+	}
+	worker();
+	for (std::thread& thread : pool) {
+		thread.join();
 	}
+
+	for (size_t i = 0; i < files.size(); ++i) {
+		results.emplace(std::move(files[i]), std::move(loaded[i]));
+	}
+	return results;
+}
+
+JsonFormat Utilities::DetectJsonFormat(std::string_view content, const std::string& filename)
+{
+	const auto* bytes = reinterpret_cast<const unsigned char*>(content.data());
+	const size_t size = content.size();
+
+	if (HasCborMagic(content)) {
+		return JsonFormat::Cbor;
+	}
+
+	// A BSON document starts with its own little-endian length and ends with a NUL
+	if (size >= 5 && bytes[size - 1] == 0) {
+		const uint32_t declared = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+		if (declared == size) {
+			return JsonFormat::Bson;
+		}
+	}
+
+	const JsonFormat byExtension = FormatFromExtension(filename);
+	if (byExtension != JsonFormat::Auto && byExtension != JsonFormat::Text) {
+		return byExtension;
+	}
+
+	// Text editors like to start files with a UTF-8 byte order mark, the text parser skips it
+	const bool bom = size >= 3 && bytes[0] == 0xEF && bytes[1] == 0xBB && bytes[2] == 0xBF;
+	size_t first = bom ? 3 : 0;
+	while (first < size && (bytes[first] == ' ' || bytes[first] == '\t' || bytes[first] == '\r' || bytes[first] == '\n')) {
+		++first;
+	}
+	if (first == size) {
+		return JsonFormat::Text;
+	}
+
+	const unsigned char lead = bytes[first];
+	if (first == 0 && size > 1 && (lead == '{' || lead == '[')) {
+		// Type and length markers never follow a bracket in text
+		if (strchr(lead == '{' ? "$#iUIlL" : "$#ZNTFiUIlLdDCSH", bytes[1]) && bytes[1] != 0) {
+			return JsonFormat::Ubjson;
+		}
+	}
+	if (strchr("{[\"-0123456789tfn", lead) && lead != 0) {
+		return JsonFormat::Text;
+	}
+
+	// fixmap, fixarray and the 16/32-bit array and map markers
+	if (first == 0 && ((lead >= 0x80 && lead <= 0x9F) || (lead >= 0xDC && lead <= 0xDF))) {
+		return JsonFormat::MessagePack;
+	}
+	// Nothing matched, so let the text parser report what is wrong with it. CBOR written by
+	// SaveToJson carries its tag and was recognized above.
+	return JsonFormat::Text;
 }
 
 std::string Utilities::GetSpecialFolderPath(const std::string& folderName)
@@ -87,6 +645,54 @@ bool Utilities::StartProgram(const std::string& exePath)
 	return true;
 }
 
+bool Utilities::StartProgramWithOutput(const std::string& exePath, const std::string& arguments, HANDLE& output, HANDLE& process, std::string* error)
+{
+	output = nullptr;
+	process = nullptr;
+	auto fail = [&](const std::string& message) {
+		if (error) *error = message;
+		else Logger::Error("Failed to start ", exePath, ": ", message);
+		return false;
+	};
+
+	// Only the write end is inherited, the child must not hold our read end open
+	SECURITY_ATTRIBUTES security = { sizeof(security), nullptr, TRUE };
+	HANDLE readEnd = nullptr;
+	HANDLE writeEnd = nullptr;
+	if (!CreatePipe(&readEnd, &writeEnd, &security, 0)) {
+		return fail(Stringify("Could not create a pipe: ", GetLastErrorString()));
+	}
+	SetHandleInformation(readEnd, HANDLE_FLAG_INHERIT, 0);
+
+	STARTUPINFOW startup = {};
+	startup.cb = sizeof(startup);
+	startup.dwFlags = STARTF_USESTDHANDLES;
+	startup.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+	startup.hStdOutput = writeEnd;
+	startup.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+
+	std::wstring commandLine = L"\"" + StringToWString(exePath) + L"\"";
+	if (!arguments.empty()) {
+		commandLine += L" " + StringToWString(arguments);
+	}
+
+	PROCESS_INFORMATION info = {};
+	const BOOL started = CreateProcessW(nullptr, commandLine.data(), nullptr, nullptr, TRUE, CREATE_NO_WINDOW,
+		nullptr, nullptr, &startup, &info);
+	const std::string message = started ? std::string() : GetLastErrorString();
+	// Once the child has its copy, closing ours lets reads see the end when it exits
+	CloseHandle(writeEnd);
+	if (!started) {
+		CloseHandle(readEnd);
+		return fail(message);
+	}
+
+	CloseHandle(info.hThread);
+	output = readEnd;
+	process = info.hProcess;
+	return true;
+}
+
 fs::path Utilities::CreateFolder(const std::string& path, const std::string& folderName)
 {
 	try {
@@ -170,6 +776,61 @@ bool Utilities::WriteFileContent(const std::string& filePath, const std::string&
 	return true; // Indicate success
 }
 
+bool Utilities::AtomicWriteFile(const std::string& filePath, std::string_view content, FsyncPolicy fsync, std::string* error)
+{
+	// The temporary has to live in the same directory so the rename stays on one volume
+	const fs::path target(filePath);
+	fs::path temporary = target;
+	temporary += Stringify(".", GetCurrentProcessId(), ".", GetCurrentThreadId(), ".tmp");
+
+	HANDLE file = CreateFileW(temporary.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		if (error) *error = Stringify("Could not create ", temporary.string(), ": ", GetLastErrorString());
+		return false;
+	}
+
+	// A single write straight from the caller's buffer, no stream in between
+	bool written = WriteWholeFile(file, content);
+	if (written && fsync != FsyncPolicy::None) {
+		written = FlushFileBuffers(file) != 0;
+	}
+	const DWORD writeError = GetLastError();
+	CloseHandle(file);
+
+	if (!written) {
+		if (error) *error = Stringify("Could not write ", temporary.string(), ": ", GetLastErrorString(writeError));
+		DeleteFileW(temporary.c_str());
+		return false;
+	}
+
+	if (!RenameOver(temporary, target, fsync, error)) {
+		DeleteFileW(temporary.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool Utilities::RenameOver(const fs::path& from, const fs::path& to, FsyncPolicy fsync, std::string* error)
+{
+	const DWORD moveFlags = MOVEFILE_REPLACE_EXISTING | (fsync == FsyncPolicy::Full ? MOVEFILE_WRITE_THROUGH : 0);
+	// A reader that has the target mapped, or open without delete sharing, blocks the rename
+	// until it lets go. Loads only hold the file for the parse, so back off and retry for
+	// about half a second before giving up.
+	DWORD delay = 1;
+	for (;;) {
+		if (MoveFileExW(from.c_str(), to.c_str(), moveFlags)) {
+			return true;
+		}
+		const DWORD moveError = GetLastError();
+		if ((moveError != ERROR_ACCESS_DENIED && moveError != ERROR_SHARING_VIOLATION) || delay > 256) {
+			if (error) *error = Stringify("Could not replace ", to.string(), ": ", GetLastErrorString(moveError));
+			return false;
+		}
+		Sleep(delay);
+		delay *= 2;
+	}
+}
+
 bool Utilities::FileOrFolderExists(const std::string& path)
 {
 	return std::filesystem::exists(path);
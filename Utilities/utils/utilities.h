@@ -5,11 +5,80 @@
 #include <fstream>
 #include <shlobj.h>
 #include <filesystem>
+#include <map>
 
 namespace fs = std::filesystem;
 
 #include "../dependencies/json.hpp"
 #include "../logger/logger.h"
+#include "../encoding/encoding.h"
+#include "../json/arena_json.h"
+
+class JsonSchema;
+
+enum class JsonFormat
+{
+	// Loading sniffs the bytes, saving goes by the file extension and falls back to Text
+	Auto,
+	Text,
+	Cbor,
+	MessagePack,
+	Ubjson,
+	Bson
+};
+
+struct JsonLoadOptions
+{
+	JsonFormat format = JsonFormat::Auto;
+	// Run the SIMD UTF-8 check over the raw bytes before parsing text
+	bool validateUtf8 = false;
+	// Map the file instead of reading it into a heap buffer with one ReadFile
+	bool memoryMap = true;
+	// Reject documents that do not match this compiled schema, nlohmann::json overloads only.
+	// The caller keeps it alive for the duration of the load
+	const JsonSchema* schema = nullptr;
+	// Hold a shared lock on "<file>.lock" while reading, so a writer saving with lock and
+	// atomic off is never seen half done. Atomic saves need no lock on the reading side, but
+	// a load holds the file while it parses and an atomic save landing then has to wait for
+	// it, see JsonSaveOptions::lock.
+	bool lock = false;
+};
+
+// One entry of LoadJsonDirectory, error is empty when the file loaded
+struct JsonLoadResult
+{
+	nlohmann::json data;
+	std::string error;
+};
+
+enum class FsyncPolicy
+{
+	// Atomic against process crashes only, the OS may still lose the data on power loss
+	None,
+	// Flush the temporary file before it is renamed over the target
+	Data,
+	// Also make the rename itself durable before returning
+	Full
+};
+
+struct JsonSaveOptions
+{
+	JsonFormat format = JsonFormat::Text;
+	// Spaces per nesting level, -1 writes compact output. Text only.
+	int indent = 4;
+	// Write to a temporary file next to the target and rename it over the target
+	bool atomic = true;
+	FsyncPolicy fsync = FsyncPolicy::Data;
+	// Text only: serialize the members of a top-level array or object on this many threads,
+	// 0 uses every core. The output is identical to a single-threaded dump.
+	unsigned threads = 1;
+	// Hold an exclusive lock on "<file>.lock" for the write, so processes saving the same file
+	// take turns, and bump the generation counter kept there. See GetJsonGeneration.
+	// Readers of atomic saves need no lock. Windows cannot rename over a file that a reader
+	// has mapped or open, so the rename retries with backoff for about half a second and the
+	// save fails if a reader holds the file longer than that.
+	bool lock = false;
+};
 
 class Utilities
 {
@@ -24,20 +93,56 @@ public:
 
 	static std::wstring StringToWString(const std::string& str);
 	static std::string WStringToString(const std::wstring& str);
+	static bool ValidateUtf8(std::string_view data);
 
 	static std::string PrintBool(const bool& boolean);
+	static std::string GetLastErrorString(DWORD errorCode = GetLastError());
 
 	static bool SaveToJson(const nlohmann::json& jsonData, const std::string& filename);
-	static nlohmann::json LoadFromJson(const std::string& filename);
+	static bool SaveToJson(const nlohmann::json& jsonData, const std::string& filename, const JsonSaveOptions& options, std::string* error = nullptr);
+	// Returns null and logs the reason when the file cannot be opened or parsed
+	static nlohmann::json LoadFromJson(const std::string& filename, bool validateUtf8 = false);
+	// Hands the whole file to the parser as one contiguous buffer. On failure the reason goes
+	// to *error when given, to the log otherwise, and jsonData is left untouched.
+	static bool LoadFromJson(const std::string& filename, nlohmann::json& jsonData, const JsonLoadOptions& options = {}, std::string* error = nullptr);
+	// Same, but every node of the tree comes out of the document's arena
+	static bool LoadFromJson(const std::string& filename, ArenaJsonDocument& document, const JsonLoadOptions& options = {}, std::string* error = nullptr);
+	// Recognizes the CBOR self-describe tag written by SaveToJson, a BSON length prefix, the
+	// MessagePack container markers and UBJSON markers, then the extension, then assumes text
+	static JsonFormat DetectJsonFormat(std::string_view content, const std::string& filename = "");
+	// How many locked saves filename has had, 0 before the first. Read without taking the
+	// lock: take it before loading and compare it later to skip loading an unchanged file.
+	// Only saves with JsonSaveOptions::lock move it, so this detects staleness only when every
+	// writer of the file saves with lock. Plain saves leave no "<file>.lock" behind.
+	static uint64_t GetJsonGeneration(const std::string& filename);
+	// Loads every file in directoryPath whose name matches pattern ('*' and '?', case-insensitive)
+	// on a pool of threads, 0 meaning one per core. Results are keyed by full path, failures
+	// are reported per file and never logged. A file whose name the ANSI code page cannot
+	// spell is reported as failed under its UTF-8 path.
+	static std::map<std::string, JsonLoadResult> LoadJsonDirectory(const std::string& directoryPath, const std::string& pattern = "*.json",
+		unsigned threads = 0, const JsonLoadOptions& options = {});
 
 	static std::string GetSpecialFolderPath(const std::string& folderName);
 	static bool StartProgram(const std::string& exePath);
+	// Starts exePath with its stdout on a pipe. output is the read end, for a JsonPushParser
+	// or ReadFile; the caller closes both handles.
+	static bool StartProgramWithOutput(const std::string& exePath, const std::string& arguments, HANDLE& output,
+		HANDLE& process, std::string* error = nullptr);
 
 	static fs::path CreateFolder(const std::string& path, const std::string& folderName);
 	static fs::path m_CreateFile(const std::string& directoryPath, const std::string& fileName, const std::string& content);
 
 	static std::string ReadFileContent(const std::string& filePath);
 	static bool WriteFileContent(const std::string& filePath, const std::string& content);
+	// Replaces filePath with content so readers see either the old or the new file, never a mix
+	static bool AtomicWriteFile(const std::string& filePath, std::string_view content, FsyncPolicy fsync = FsyncPolicy::Data, std::string* error = nullptr);
+	// Writes already serialized JSON the way SaveToJson does: atomic or in place, under the
+	// exclusive lock and with a generation bump when options.lock is set. Reports only through
+	// the return value and *error, never the log.
+	static bool WriteJsonFile(const std::string& filename, std::string_view content, const JsonSaveOptions& options, std::string* error = nullptr);
+	// Renames from over to, retrying with backoff for about half a second while a reader has
+	// to mapped or open. Leaves from in place when it fails.
+	static bool RenameOver(const fs::path& from, const fs::path& to, FsyncPolicy fsync = FsyncPolicy::Data, std::string* error = nullptr);
 	static bool FileOrFolderExists(const std::string& path);
 	static std::vector<std::string> GetSubFolders(const std::string& directoryPath);
 